@@ -308,14 +308,15 @@ struct Graph
 
 typedef struct
 {
-    Mat4   *OrthoMatrix;
-    Graph  *graph;
-    Scene  *scene;
-    Mat4   *scale_transform;
-    Mat4   *translation;
-    Panel  *panel;
-    Parser *parser; // hello to parser
-    Mat4   *new_transform;
+    Mat4        *OrthoMatrix;
+    Graph       *graph;
+    Scene       *scene;
+    Mat4        *scale_transform;
+    Mat4        *translation;
+    Panel       *panel;
+    Interpreter *interpreter; // scopes of everything typed into the panel
+    Parser      *parser;      // hello to parser
+    Mat4        *new_transform;
 } UserData;
 
 const char *ShaderTypeName(ShaderType shader)
@@ -339,6 +340,8 @@ void ErrorCallback(int code, const char *description)
 
 void Plot1DFromComputationContext(Scene *scene, ComputationContext *context, Graph *graph, MVec3 color,
                                   const char *legend);
+static void ImplicitPlot2DFromComputationContext(Scene *scene, ComputationContext *context);
+static bool RefreshPlots(Scene *scene, SymbolFn *fn);
 
 struct
 {
@@ -415,17 +418,24 @@ static void KeyCallback(GLFWwindow *window, int key, int scancode, int action, i
 
         // Get the execution computation context and plot the function
         ParseStart(data->parser);
-        // Return the function currently parsed.
 
-        SymbolFn           *fn      = GetLatestParsedFn();
-        ComputationContext *context = NewComputation(fn);
-
-        float               rands[3];
-        for (uint32_t i = 0; i < 3; ++i)
-            rands[i] = (rand() % 100) / 100.0f;
+        // Plots depending on whatever the line redefined are redrawn in place, a function that isn't plotted yet gets a
+        // plot of its own : f(x) as a curve, f(x, y) as the contour f(x, y) = 0
+        SymbolFn *fn = GetLatestParsedFn(data->interpreter);
+        if (!RefreshPlots(data->scene, fn) && fn)
+        {
+            if (GetSymbolFnArity(fn) == 2)
+                ImplicitPlot2DFromComputationContext(data->scene, NewComputation(fn));
+            else
+            {
+                float rands[3];
+                for (uint32_t i = 0; i < 3; ++i)
+                    rands[i] = (rand() % 100) / 100.0f;
 
-        Plot1DFromComputationContext(data->scene, context, data->graph, *(MVec3 *)(rands), "Plotted from context");
-        DestroyComputationContext(context);
+                Plot1DFromComputationContext(data->scene, NewComputation(fn), data->graph, *(MVec3 *)(rands),
+                                             "Plotted from context");
+            }
+        }
     }
     PanelKeyCallback(data->panel, key, scancode, action, mod);
     // TODO :: Update the orthographic projection for that seamless transition and update the scissor window
@@ -738,18 +748,108 @@ GLFWwindow *LoadGLFW(int width, int height, const char *title)
     return window;
 }
 
-typedef struct FunctionPlotData
+// Vertex stores
+// Plots write their vertices once, in the layout they are uploaded in, into blocks chained like the expression arenas.
+// Blocks never move and each is twice as large as the one before, so millions of vertices take a few dozen allocations
+// and nothing is copied before the upload. Emptying a store keeps its room, merged into a single block.
+
+#define VERTEX_BLOCK_SIZE 16384 // bytes of the first block
+
+typedef struct VertexBlock
 {
-    bool          updated;
+    struct VertexBlock *next;
+    size_t              used;
+    size_t              size;
+    max_align_t         data[];
+} VertexBlock;
 
-    FunctionType  fn_type;
-    void         *function;
-    GPUBatch     *batch;
-    uint32_t      max;
-    uint32_t      count;
-    MVec3         color;
-    VertexData2D *samples;
-    char          plot_name[25];
+typedef struct VertexStore
+{
+    uint32_t     stride; // bytes of a vertex
+    uint32_t     count;
+    size_t       room;   // bytes of all the blocks
+    VertexBlock *first;
+    VertexBlock *last;   // the one being filled
+} VertexStore;
+
+static VertexBlock *NewVertexBlock(size_t size)
+{
+    VertexBlock *block = malloc(sizeof(*block) + size);
+    assert(block != NULL);
+    block->next = NULL;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+// Room for count vertices in a row. A run that doesn't fit in the last block starts the next one, the end left over is
+// never uploaded.
+static void *PushVertices(VertexStore *store, uint32_t count)
+{
+    assert(store->stride != 0);
+    size_t       size  = (size_t)store->stride * count;
+    VertexBlock *block = store->last;
+    if (!block || block->used + size > block->size)
+    {
+        size_t capacity = block ? block->size * 2 : VERTEX_BLOCK_SIZE;
+        block           = NewVertexBlock(capacity > size ? capacity : size);
+        if (store->last)
+            store->last->next = block;
+        else
+            store->first = block;
+        store->last = block;
+        store->room = store->room + block->size;
+    }
+
+    void *vertices = (uint8_t *)block->data + block->used;
+    block->used    = block->used + size;
+    store->count   = store->count + count;
+    return vertices;
+}
+
+static void ReleaseVertices(VertexStore *store)
+{
+    for (VertexBlock *block = store->first, *next; block; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+    *store = (VertexStore){.stride = store->stride};
+}
+
+static void ClearVertices(VertexStore *store)
+{
+    if (store->first != store->last)
+    {
+        size_t room = store->room;
+        ReleaseVertices(store);
+        store->first = store->last = NewVertexBlock(room);
+        store->room                = room;
+    }
+    else if (store->first)
+        store->first->used = 0;
+    store->count = 0;
+}
+
+typedef struct SampledCurve SampledCurve;
+
+typedef struct FunctionPlotData
+{
+    bool                updated;
+
+    FunctionType        fn_type;
+    void               *function;
+    void               *user;    // handed back to function, when it is one of the batched callbacks
+    bool                batched;
+    ComputationContext *context; // of plots parsed from text, resampled when a definition it reads is replaced
+    MChebyshevProxy    *proxy;   // stands in for function when the plot was made by Plot1DProxy
+    SymbolFn           *derivative;
+    ComputationContext *slope;   // of context, for the directions along the curve
+    SampledCurve       *curve;   // samples kept for the view, of the plots that follow it
+    GPUBatch           *batch;
+    MVec3               color;
+    VertexStore         vertices; // VertexData2D, as the batch draws them
+    char                plot_name[25];
 } FunctionPlotData;
 
 typedef struct VectorData
@@ -762,10 +862,8 @@ typedef struct VectorPlotData
     bool           updated;
     GPUBatch      *batch;
     VectorField2D *field;
-    uint32_t       max;
-    uint32_t       count;
     // Color range
-    VectorData *points;
+    VertexStore points; // VectorData, six for each arrow
     // Color, to be decided
 } VectorPlotData;
 
@@ -808,8 +906,619 @@ typedef struct Scene
     FontData    axes_labels;
     FontData    legends;
     VectorArray fields;
+
+    Mat4       *view;          // plot units to pixels, curves are sampled for it
+    float       tolerance;     // in pixels, how far a sampled curve may stray from its chords
+    uint32_t    sample_budget; // samples a plot made from now on may keep
+    uint32_t    sample_cache;  // and may cache across views
 } Scene;
 
+// Adaptive sampling
+// A curve starts out as even segments, each with its midpoint evaluated. The segment straying most from its chord on
+// screen is split at that midpoint, and the two halves get theirs, until every segment is within the tolerance of the
+// scene or the plot has used up its budget of samples. Splits are done SAMPLE_ROUND at a time, so the callback gets
+// whole batches of parameters. Chords longer than SAMPLE_MAX_CHORD pixels are split as well : parametric curves get
+// samples evenly along their length however fast they run, and a feature hiding between the samples of a flat looking
+// segment is still found.
+// Segments lying off screen on one side are left alone, so are those narrower than SAMPLE_MIN_SPLIT of the first ones,
+// where only jumps and poles end up.
+//
+// Samples are kept with their plot and follow the view. 1D plots cover the visible range, on a grid of even segments
+// whose spacing is a power of two : after a pan the samples still on screen are kept, even segments are laid over the
+// strips exposed, and only what is over the tolerance then gets refined. A change of scale starts over.
+//
+// Every sample laid this way sits on a dyadic grid, of x for 1D plots and of the fraction of the range for parametric
+// ones : level k holds the multiples of 2^-k, and each finer level only adds the midpoints of the one above. Every
+// value computed goes into a pyramid of those levels, bounded by an LRU cap, which is looked up before calling the
+// curve. Starting over after a zoom in then only evaluates the new midpoints, and a zoom out is all lookups.
+
+#define SAMPLE_INITIAL_SEGMENTS 32
+#define SAMPLE_ROUND            64
+#define SAMPLE_MAX_CHORD        64.0f               // pixels
+#define SAMPLE_MIN_SPLIT        (1.0 / (1 << 15))   // of the first segments
+#define SAMPLE_NONE             UINT32_MAX
+#define PLOT_MIN_BUDGET         256                 // room for the first segments of any view
+#define PLOT_DEFAULT_BUDGET     4096
+#define PYRAMID_MIN_LEVEL       -20                 // levels coarser than this, and finer than the last, are counted
+#define PYRAMID_LEVELS          64                  // with the ends
+#define PYRAMID_DEFAULT_CAP     32768               // samples
+
+// Points of a curve at n parameters, n is at most 2 * SAMPLE_ROUND. Directions along the curve are optional, they are
+// zero on entry and the secants to the next samples are drawn where they are left so.
+typedef void (*CurveFn)(void *curve, const double *ts, MVec2 *points, MVec2 *directions, uint32_t n);
+
+typedef struct CurveSample
+{
+    double   t;
+    MVec2    point;
+    MVec2    direction;
+    uint32_t next; // sample following this one on the curve, once this one is linked in
+    uint32_t mid;  // midpoint of the segment up to next
+} CurveSample;
+
+typedef struct CurveSegment
+{
+    uint32_t left;
+    float    error; // how far over the tolerance, split while above 1
+} CurveSegment;
+
+typedef struct PyramidEntry
+{
+    double   t;
+    MVec2    point;
+    MVec2    direction;
+    uint32_t chain; // next entry of the bucket
+    uint32_t older; // neighbours in order of use
+    uint32_t newer;
+    int32_t  level;
+} PyramidEntry;
+
+typedef struct SamplePyramid
+{
+    uint32_t      cap;
+    uint32_t      count;
+    uint32_t      mask;    // of the buckets
+    uint32_t     *buckets; // first entry of each
+    PyramidEntry *entries; // cap of them, count in use
+    uint32_t      oldest;
+    uint32_t      newest;
+    uint32_t      levels[PYRAMID_LEVELS];
+} SamplePyramid;
+
+typedef struct SampleView
+{
+    MVec2 pixels; // per unit along x and y
+    MVec2 min;    // corners of the visible region, in plot units
+    MVec2 max;
+    float tolerance;
+} SampleView;
+
+struct SampledCurve
+{
+    CurveFn       fn;
+    void         *curve;
+    bool          follows_view; // samples the visible range, instead of the one it was made with
+    double        origin;       // the curve is called at origin + scale * t
+    double        scale;
+    double        t0, t1;
+    double        spacing;      // of the first segments, t0 and t1 are multiples of it
+    Mat4          view;         // the samples were refined for
+    SamplePyramid pyramid;
+    uint32_t      budget;
+    uint32_t      count;
+    uint32_t      first;
+    CurveSample  *samples;      // budget of them
+    CurveSample  *spare;        // to compact samples into on a pan
+    CurveSegment *segments;     // max heap on error while refining
+};
+
+// Pixel scale and visible region of the scene
+static SampleView SceneSampleView(Scene *scene)
+{
+    SampleView view = {.pixels = {200.0f, 200.0f}, .min = {-10.0f, -FLT_MAX}, .max = {10.0f, FLT_MAX}};
+    view.tolerance  = scene->tolerance;
+    if (!scene->view)
+        return view;
+
+    Mat4 *transform = scene->view;
+    view.pixels     = (MVec2){transform->elem[0][0], transform->elem[1][1]};
+    view.min        = (MVec2){-transform->elem[0][3] / view.pixels.x, -transform->elem[1][3] / view.pixels.y};
+    view.max        = (MVec2){view.min.x + screen_width / view.pixels.x, view.min.y + screen_height / view.pixels.y};
+    return view;
+}
+
+static bool IsFinitePoint(MVec2 point)
+{
+    return isfinite(point.x) && isfinite(point.y);
+}
+
+static bool AllBeyond(float a, float b, float c, float min, float max)
+{
+    return (a < min && b < min && c < min) || (a > max && b > max && c > max);
+}
+
+static float SegmentError(SampledCurve *sampled, SampleView *view, uint32_t left)
+{
+    CurveSample *a = &sampled->samples[left];
+    CurveSample *m = &sampled->samples[a->mid];
+    CurveSample *b = &sampled->samples[a->next];
+    if (b->t - a->t < sampled->spacing * SAMPLE_MIN_SPLIT)
+        return 0.0f;
+
+    // Splitting on towards a point that isn't there finds where the curve stops
+    bool finite_a = IsFinitePoint(a->point), finite_m = IsFinitePoint(m->point), finite_b = IsFinitePoint(b->point);
+    if (!finite_a && !finite_m && !finite_b)
+        return 0.0f;
+    if (!finite_a || !finite_m || !finite_b)
+        return FLT_MAX;
+
+    if (AllBeyond(a->point.x, m->point.x, b->point.x, view->min.x, view->max.x) ||
+        AllBeyond(a->point.y, m->point.y, b->point.y, view->min.y, view->max.y))
+        return 0.0f;
+
+    // Distance in pixels from the midpoint to the chord, not to its line : curves doubling back are caught too
+    float dx     = (b->point.x - a->point.x) * view->pixels.x;
+    float dy     = (b->point.y - a->point.y) * view->pixels.y;
+    float mx     = (m->point.x - a->point.x) * view->pixels.x;
+    float my     = (m->point.y - a->point.y) * view->pixels.y;
+    float length = dx * dx + dy * dy;
+    float s      = length > 0.0f ? fminf(fmaxf((mx * dx + my * dy) / length, 0.0f), 1.0f) : 0.0f;
+    float error  = hypotf(mx - s * dx, my - s * dy) / view->tolerance;
+    return fmaxf(error, sqrtf(length) / SAMPLE_MAX_CHORD);
+}
+
+static void PushSegment(SampledCurve *sampled, uint32_t *count, CurveSegment entry)
+{
+    CurveSegment *heap  = sampled->segments;
+    uint32_t      index = (*count)++;
+    while (index && heap[(index - 1) / 2].error < entry.error)
+    {
+        heap[index] = heap[(index - 1) / 2];
+        index       = (index - 1) / 2;
+    }
+    heap[index] = entry;
+}
+
+static CurveSegment PopSegment(SampledCurve *sampled, uint32_t *count)
+{
+    CurveSegment *heap  = sampled->segments;
+    CurveSegment  top   = heap[0];
+    CurveSegment  last  = heap[--(*count)];
+    uint32_t      index = 0;
+    for (;;)
+    {
+        uint32_t child = 2 * index + 1;
+        if (child >= *count)
+            break;
+        if (child + 1 < *count && heap[child + 1].error > heap[child].error)
+            child = child + 1;
+        if (heap[child].error <= last.error)
+            break;
+        heap[index] = heap[child];
+        index       = child;
+    }
+    heap[index] = last;
+    return top;
+}
+
+// Level of the grid t first appears on
+static int32_t SampleLevel(double t)
+{
+    int32_t level = PYRAMID_MIN_LEVEL;
+    if (t != 0.0)
+    {
+        int      exponent;
+        uint64_t mantissa = (uint64_t)fabs(ldexp(frexp(t, &exponent), 53));
+        for (level = 53 - exponent; !(mantissa & 1); mantissa >>= 1)
+            level = level - 1;
+    }
+    if (level < PYRAMID_MIN_LEVEL)
+        return PYRAMID_MIN_LEVEL;
+    return level < PYRAMID_MIN_LEVEL + PYRAMID_LEVELS ? level : PYRAMID_MIN_LEVEL + PYRAMID_LEVELS - 1;
+}
+
+static uint32_t *PyramidBucket(SamplePyramid *pyramid, double t)
+{
+    uint64_t bits;
+    memcpy(&bits, &t, sizeof(bits));
+    bits = bits * 0x9E3779B97F4A7C15ULL;
+    return &pyramid->buckets[(bits >> 32) & pyramid->mask];
+}
+
+static void InitPyramid(SamplePyramid *pyramid, uint32_t cap)
+{
+    uint32_t buckets = 1;
+    while (buckets < cap)
+        buckets = buckets * 2;
+    *pyramid         = (SamplePyramid){.cap = cap, .mask = buckets - 1};
+    pyramid->buckets = malloc(sizeof(*pyramid->buckets) * buckets);
+    pyramid->entries = malloc(sizeof(*pyramid->entries) * cap);
+    assert(pyramid->buckets && pyramid->entries);
+    memset(pyramid->buckets, 0xff, sizeof(*pyramid->buckets) * buckets);
+    pyramid->oldest = pyramid->newest = SAMPLE_NONE;
+}
+
+// Forgets every value, when the curve they came from changed
+static void ClearPyramid(SamplePyramid *pyramid)
+{
+    memset(pyramid->buckets, 0xff, sizeof(*pyramid->buckets) * (pyramid->mask + 1));
+    memset(pyramid->levels, 0, sizeof(pyramid->levels));
+    pyramid->count  = 0;
+    pyramid->oldest = pyramid->newest = SAMPLE_NONE;
+}
+
+static void UnlinkUse(SamplePyramid *pyramid, uint32_t index)
+{
+    PyramidEntry *entry = &pyramid->entries[index];
+    if (entry->older != SAMPLE_NONE)
+        pyramid->entries[entry->older].newer = entry->newer;
+    else
+        pyramid->oldest = entry->newer;
+    if (entry->newer != SAMPLE_NONE)
+        pyramid->entries[entry->newer].older = entry->older;
+    else
+        pyramid->newest = entry->older;
+}
+
+static void LinkNewest(SamplePyramid *pyramid, uint32_t index)
+{
+    PyramidEntry *entry = &pyramid->entries[index];
+    entry->older        = pyramid->newest;
+    entry->newer        = SAMPLE_NONE;
+    if (pyramid->newest != SAMPLE_NONE)
+        pyramid->entries[pyramid->newest].newer = index;
+    else
+        pyramid->oldest = index;
+    pyramid->newest = index;
+}
+
+// Entry of t, marked as just used, or NULL
+static PyramidEntry *FindInPyramid(SamplePyramid *pyramid, double t)
+{
+    for (uint32_t index = *PyramidBucket(pyramid, t); index != SAMPLE_NONE; index = pyramid->entries[index].chain)
+    {
+        if (pyramid->entries[index].t != t)
+            continue;
+        UnlinkUse(pyramid, index);
+        LinkNewest(pyramid, index);
+        return &pyramid->entries[index];
+    }
+    return NULL;
+}
+
+// Takes the place of the least recently used entry once the cap is reached
+static void AddToPyramid(SamplePyramid *pyramid, double t, MVec2 point, MVec2 direction)
+{
+    uint32_t index = pyramid->count;
+    if (pyramid->count < pyramid->cap)
+        pyramid->count = pyramid->count + 1;
+    else
+    {
+        index               = pyramid->oldest;
+        PyramidEntry *entry = &pyramid->entries[index];
+        uint32_t     *link  = PyramidBucket(pyramid, entry->t);
+        while (*link != index)
+            link = &pyramid->entries[*link].chain;
+        *link = entry->chain;
+        UnlinkUse(pyramid, index);
+        pyramid->levels[entry->level - PYRAMID_MIN_LEVEL]--;
+    }
+
+    uint32_t     *bucket = PyramidBucket(pyramid, t);
+    PyramidEntry *entry  = &pyramid->entries[index];
+    *entry = (PyramidEntry){.t = t, .point = point, .direction = direction, .chain = *bucket, .level = SampleLevel(t)};
+    *bucket = index;
+    LinkNewest(pyramid, index);
+    pyramid->levels[entry->level - PYRAMID_MIN_LEVEL]++;
+}
+
+static void ReleasePyramid(SamplePyramid *pyramid)
+{
+    free(pyramid->buckets);
+    free(pyramid->entries);
+}
+
+// Calls the curve on the samples from first missing from the pyramid, and adds them to it
+static void EvaluateMisses(SampledCurve *sampled, const uint32_t *misses, uint32_t n)
+{
+    double ts[2 * SAMPLE_ROUND];
+    MVec2  points[2 * SAMPLE_ROUND], directions[2 * SAMPLE_ROUND];
+    for (uint32_t i = 0; i < n; ++i)
+        ts[i] = sampled->origin + sampled->scale * sampled->samples[misses[i]].t;
+    memset(directions, 0, sizeof(*directions) * n);
+    sampled->fn(sampled->curve, ts, points, directions, n);
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        CurveSample *sample = &sampled->samples[misses[i]];
+        sample->point       = points[i];
+        sample->direction   = directions[i];
+        AddToPyramid(&sampled->pyramid, sample->t, points[i], directions[i]);
+    }
+}
+
+// New samples at n parameters, linked to nothing yet, and returns the first of them. Only those missing from the
+// pyramid are evaluated.
+static uint32_t NewSamples(SampledCurve *sampled, const double *ts, uint32_t n)
+{
+    uint32_t misses[2 * SAMPLE_ROUND], missed = 0;
+    uint32_t first = sampled->count;
+    assert(sampled->count + n <= sampled->budget);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        CurveSample  *sample = &sampled->samples[sampled->count++];
+        PyramidEntry *entry  = FindInPyramid(&sampled->pyramid, ts[i]);
+        *sample              = (CurveSample){.t = ts[i], .next = SAMPLE_NONE, .mid = SAMPLE_NONE};
+        if (entry)
+        {
+            sample->point     = entry->point;
+            sample->direction = entry->direction;
+            continue;
+        }
+
+        misses[missed++] = first + i;
+        if (missed == 2 * SAMPLE_ROUND)
+        {
+            EvaluateMisses(sampled, misses, missed);
+            missed = 0;
+        }
+    }
+    if (missed)
+        EvaluateMisses(sampled, misses, missed);
+    return first;
+}
+
+static uint32_t StripSegments(SampledCurve *sampled, double a, double b)
+{
+    return (uint32_t)((b - a) / sampled->spacing + 0.5);
+}
+
+// Lays even segments from a to b, starting from the sample left and ending on right when those are given, and returns
+// the first sample of the strip
+static uint32_t LayStrip(SampledCurve *sampled, double a, double b, uint32_t left, uint32_t right)
+{
+    double   ts[4 * SAMPLE_INITIAL_SEGMENTS + 8];
+    uint32_t segments = StripSegments(sampled, a, b), n = 0;
+    assert(segments && 2 * segments + 1 <= sizeof(ts) / sizeof(*ts));
+
+    // Ends on the grid are products of the spacing, so they match the samples already laid exactly
+    double origin = a / sampled->spacing;
+    if (left == SAMPLE_NONE)
+        ts[n++] = a;
+    for (uint32_t segment = 0; segment < segments; ++segment)
+    {
+        ts[n++] = (origin + segment + 0.5) * sampled->spacing;
+        if (segment + 1 < segments || right == SAMPLE_NONE)
+            ts[n++] = segment + 1 < segments ? (origin + segment + 1) * sampled->spacing : b;
+    }
+
+    uint32_t sample = NewSamples(sampled, ts, n);
+    uint32_t prev   = left == SAMPLE_NONE ? sample++ : left;
+    uint32_t first  = prev;
+    for (uint32_t segment = 0; segment < segments; ++segment)
+    {
+        CurveSample *start = &sampled->samples[prev];
+        start->mid         = sample++;
+        start->next        = segment + 1 < segments || right == SAMPLE_NONE ? sample++ : right;
+        prev               = start->next;
+    }
+    return first;
+}
+
+// Splits what strays over the tolerance of view, as long as the budget lasts
+static void RefineCurve(SampledCurve *sampled, SampleView *view)
+{
+    uint32_t count = 0;
+    for (uint32_t sample = sampled->first; sample != SAMPLE_NONE; sample = sampled->samples[sample].next)
+    {
+        if (sampled->samples[sample].mid != SAMPLE_NONE)
+            PushSegment(sampled, &count, (CurveSegment){sample, SegmentError(sampled, view, sample)});
+    }
+
+    CurveSegment splits[SAMPLE_ROUND];
+    double       ts[2 * SAMPLE_ROUND];
+    for (;;)
+    {
+        uint32_t round = 0;
+        while (round < SAMPLE_ROUND && count && sampled->segments[0].error > 1.0f &&
+               sampled->count + 2 * (round + 1) <= sampled->budget)
+            splits[round++] = PopSegment(sampled, &count);
+        if (!round)
+            break;
+
+        for (uint32_t split = 0; split < round; ++split)
+        {
+            CurveSample *left  = &sampled->samples[splits[split].left];
+            CurveSample *mid   = &sampled->samples[left->mid];
+            CurveSample *right = &sampled->samples[left->next];
+            ts[2 * split]      = 0.5 * (left->t + mid->t);
+            ts[2 * split + 1]  = 0.5 * (mid->t + right->t);
+        }
+        uint32_t sample = NewSamples(sampled, ts, 2 * round);
+
+        for (uint32_t split = 0; split < round; ++split)
+        {
+            CurveSample *left = &sampled->samples[splits[split].left];
+            CurveSample *mid  = &sampled->samples[left->mid];
+            mid->next         = left->next;
+            mid->mid          = sample + 2 * split + 1;
+            left->next        = left->mid;
+            left->mid         = sample + 2 * split;
+            for (uint32_t half = splits[split].left; half != mid->next; half = sampled->samples[half].next)
+                PushSegment(sampled, &count, (CurveSegment){half, SegmentError(sampled, view, half)});
+        }
+    }
+}
+
+// Lays the first segments over the whole range, the visible one when following the view
+static void ResetCurve(SampledCurve *sampled, SampleView *view)
+{
+    if (sampled->follows_view)
+    {
+        double width     = view->max.x - view->min.x;
+        sampled->spacing = ldexp(1.0, (int)floor(log2(width / SAMPLE_INITIAL_SEGMENTS)));
+        sampled->t0      = floor(view->min.x / sampled->spacing) * sampled->spacing;
+        sampled->t1      = ceil(view->max.x / sampled->spacing) * sampled->spacing;
+    }
+    else
+        sampled->spacing = 1.0 / SAMPLE_INITIAL_SEGMENTS;
+
+    sampled->count = 0;
+    sampled->first = LayStrip(sampled, sampled->t0, sampled->t1, SAMPLE_NONE, SAMPLE_NONE);
+}
+
+// Keeps the samples over the part of the range still visible, in order at the start of the buffer, and lays the first
+// segments over the strips exposed. False when there is nothing to keep or no room for the strips.
+static bool SlideCurve(SampledCurve *sampled, SampleView *view)
+{
+    double t0 = floor(view->min.x / sampled->spacing) * sampled->spacing;
+    double t1 = ceil(view->max.x / sampled->spacing) * sampled->spacing;
+    if (t1 <= sampled->t0 || t0 >= sampled->t1)
+        return false;
+
+    // Every multiple of the spacing in range is a sample, so the range kept starts and ends on one
+    CurveSample *samples = sampled->samples, *kept = sampled->spare;
+    uint32_t     count = 0, last = SAMPLE_NONE;
+    for (uint32_t sample = sampled->first; sample != SAMPLE_NONE; sample = samples[sample].next)
+    {
+        if (samples[sample].t < t0)
+            continue;
+        if (samples[sample].t > t1)
+            break;
+        if (last != SAMPLE_NONE)
+            kept[last].next = count;
+        last              = count;
+        kept[count]       = samples[sample];
+        kept[count].next  = SAMPLE_NONE;
+        kept[count++].mid = SAMPLE_NONE;
+        if (samples[sample].mid != SAMPLE_NONE && samples[sample].t < t1)
+        {
+            kept[last].mid = count;
+            kept[count++]  = samples[samples[sample].mid];
+        }
+    }
+
+    uint32_t strips = 0;
+    if (t0 < sampled->t0)
+        strips = strips + 2 * StripSegments(sampled, t0, sampled->t0);
+    if (t1 > sampled->t1)
+        strips = strips + 2 * StripSegments(sampled, sampled->t1, t1);
+    if (count + strips > sampled->budget)
+        return false;
+
+    sampled->spare   = samples;
+    sampled->samples = kept;
+    sampled->count   = count;
+    sampled->first   = 0;
+    if (t0 < sampled->t0)
+        sampled->first = LayStrip(sampled, t0, sampled->t0, SAMPLE_NONE, sampled->first);
+    if (t1 > sampled->t1)
+        LayStrip(sampled, sampled->t1, t1, last, SAMPLE_NONE);
+    sampled->t0 = t0;
+    sampled->t1 = t1;
+    return true;
+}
+
+// Brings the samples up to the view of scene, true when they changed. A pan reuses them, a zoom starts over.
+static bool UpdateCurve(SampledCurve *sampled, Scene *scene)
+{
+    if (sampled->count && (!scene->view || !memcmp(&sampled->view, scene->view, sizeof(*scene->view))))
+        return false;
+
+    SampleView view   = SceneSampleView(scene);
+    bool       panned = sampled->count && sampled->view.elem[0][0] == view.pixels.x &&
+                  sampled->view.elem[1][1] == view.pixels.y;
+    if (!panned || (sampled->follows_view && !SlideCurve(sampled, &view)))
+        ResetCurve(sampled, &view);
+    RefineCurve(sampled, &view);
+    if (scene->view)
+        sampled->view = *scene->view;
+    return true;
+}
+
+// Directions of a line strip from its secants, the last vertex takes the one before it
+static void WriteSecants(VertexData2D *vertices, uint32_t count)
+{
+    for (uint32_t vertex = 0; vertex + 1 < count; ++vertex)
+    {
+        vertices[vertex].n_x = vertices[vertex + 1].x - vertices[vertex].x;
+        vertices[vertex].n_y = vertices[vertex + 1].y - vertices[vertex].y;
+    }
+    if (count == 1)
+    {
+        vertices[0].n_x = 1.0f;
+        vertices[0].n_y = 1.0f;
+    }
+    else if (count > 1)
+    {
+        vertices[count - 1].n_x = vertices[count - 2].n_x;
+        vertices[count - 1].n_y = vertices[count - 2].n_y;
+    }
+}
+
+// Writes the samples along the curve as a line strip, over what store held
+static void WriteCurveVertices(SampledCurve *sampled, VertexStore *store)
+{
+    uint32_t count = 0;
+    for (uint32_t sample = sampled->first; sample != SAMPLE_NONE; sample = sampled->samples[sample].next)
+        count++;
+    ClearVertices(store);
+    VertexData2D *vertices = PushVertices(store, count);
+
+    count                  = 0;
+    for (uint32_t sample = sampled->first; sample != SAMPLE_NONE; sample = sampled->samples[sample].next)
+    {
+        MVec2 point       = sampled->samples[sample].point;
+        vertices[count++] = (VertexData2D){.x = point.x, .y = point.y};
+    }
+    WriteSecants(vertices, count);
+
+    // Directions given by the curve take the place of the secants
+    count = 0;
+    for (uint32_t sample = sampled->first; sample != SAMPLE_NONE; sample = sampled->samples[sample].next, ++count)
+    {
+        MVec2 direction = sampled->samples[sample].direction;
+        if ((direction.x != 0.0f || direction.y != 0.0f) && IsFinitePoint(direction))
+        {
+            vertices[count].n_x = direction.x;
+            vertices[count].n_y = direction.y;
+        }
+    }
+}
+
+// Curves that don't follow the view are sampled from t0 to t1, on a grid of that range
+static SampledCurve *CreateSampledCurve(CurveFn fn, void *curve, double t0, double t1, bool follows_view,
+                                        uint32_t budget, uint32_t cache)
+{
+    SampledCurve *sampled = malloc(sizeof(*sampled));
+    assert(sampled != NULL);
+    *sampled          = (SampledCurve){.fn = fn, .curve = curve, .follows_view = follows_view, .scale = 1.0};
+    if (!follows_view)
+    {
+        sampled->origin = t0;
+        sampled->scale  = t1 - t0;
+        sampled->t1     = 1.0;
+    }
+    sampled->budget   = budget;
+    sampled->samples  = malloc(sizeof(*sampled->samples) * budget);
+    sampled->spare    = malloc(sizeof(*sampled->spare) * budget);
+    sampled->segments = malloc(sizeof(*sampled->segments) * budget);
+    assert(sampled->samples && sampled->spare && sampled->segments);
+    InitPyramid(&sampled->pyramid, cache);
+    return sampled;
+}
+
+static void DestroySampledCurve(SampledCurve *sampled)
+{
+    if (!sampled)
+        return;
+    free(sampled->samples);
+    free(sampled->spare);
+    free(sampled->segments);
+    ReleasePyramid(&sampled->pyramid);
+    free(sampled);
+}
+
 struct State
 {
     bool   bPressed;
@@ -863,6 +1572,38 @@ void PrepareBatch(GPUBatch *batch)
     }
 }
 
+// Copies store into the buffer of batch block by block, the buffer grows to twice what it has to hold when it is too
+// small. Position comes first in every layout, attribute 1 takes the rest of a vertex.
+static void UploadVertices(GPUBatch *batch, VertexStore *store)
+{
+    size_t size = (size_t)store->count * store->stride;
+    assert(size <= UINT32_MAX);
+
+    glBindVertexArray(batch->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->vertex_buffer.vbo);
+    if (size > batch->vertex_buffer.max)
+    {
+        batch->vertex_buffer.max = size <= UINT32_MAX / 2 ? (uint32_t)size * 2 : UINT32_MAX;
+        glBufferData(GL_ARRAY_BUFFER, batch->vertex_buffer.max, NULL, GL_STATIC_DRAW);
+    }
+
+    size_t offset = 0;
+    for (VertexBlock *block = store->first; block && offset < size; block = block->next)
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, block->used, block->data);
+        offset = offset + block->used;
+    }
+
+    GLint components = store->stride / sizeof(float) - 2;
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, store->stride, NULL);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, components, GL_FLOAT, GL_FALSE, store->stride, (const void *)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    batch->vertex_buffer.count = (uint32_t)size;
+    batch->vertex_buffer.dirty = false;
+}
+
 typedef MVec2 (*parametricfn)(double);
 
 void InitGraph(Graph *graph)
@@ -940,7 +1681,7 @@ void Destroy2DScene(Scene *scene)
 void Init2DScene(Scene *scene)
 {
     memset(scene, 0, sizeof(*scene));
-    // Init enough memory for 10 graphs
+    // Room for 10 graphs to begin with, NewFunctionPlot makes more
     scene->plots.max               = 10;
     scene->plots.count             = 0;
     scene->plots.functions         = malloc(sizeof(*scene->plots.functions) * scene->plots.max);
@@ -963,6 +1704,10 @@ void Init2DScene(Scene *scene)
     scene->axes_labels.batch   = CreateNewBatch(TRIANGLES);
     scene->axes_labels.updated = true;
     scene->axes_labels.data    = malloc(sizeof(*scene->axes_labels.data) * scene->axes_labels.max);
+
+    scene->tolerance           = 0.5f;
+    scene->sample_budget       = PLOT_DEFAULT_BUDGET;
+    scene->sample_cache        = PYRAMID_DEFAULT_CAP;
 }
 
 void RenderScene(Scene *scene, unsigned int program, bool showPoints, Mat4 *mscene, Mat4 *transform)
@@ -982,15 +1727,10 @@ void RenderScene(Scene *scene, unsigned int program, bool showPoints, Mat4 *msce
 
         if (function->updated)
         {
-            assert(function->count * 4 * 4 < function->batch->vertex_buffer.max);
-            memcpy(function->batch->vertex_buffer.data, function->samples, sizeof(uint8_t) * function->count * 4 * 4);
-            function->batch->vertex_buffer.count = function->count * 4 * 4;
-            function->updated                    = false;
-            function->batch->vertex_buffer.dirty = true;
+            UploadVertices(function->batch, &function->vertices);
+            function->updated = false;
         }
-
-        PrepareBatch(function->batch);
-        DrawBatch(function->batch, function->batch->vertex_buffer.count / (4 * 4));
+        DrawBatch(function->batch, function->vertices.count);
     }
 
     Mat4 product = MatrixMultiply(mscene, transform);
@@ -1004,16 +1744,10 @@ void RenderScene(Scene *scene, unsigned int program, bool showPoints, Mat4 *msce
         VectorPlotData *field = &scene->fields.vector_fields[id];
         if (field->updated)
         {
-            assert(field->count * 5 * 4 < field->batch->vertex_buffer.max);
-            memcpy(field->batch->vertex_buffer.data, field->points, field->count * 5 * 4);
-            field->batch->vertex_buffer.count = field->count * 5 * 4;
-            field->updated                    = false;
-            field->batch->vertex_buffer.dirty = true;
+            UploadVertices(field->batch, &field->points);
+            field->updated = false;
         }
-
-        // Nice one
-        PrepareVertexBatch(field->batch);
-        DrawBatch(field->batch, field->batch->vertex_buffer.count / (5 * 4));
+        DrawBatch(field->batch, field->points.count);
     }
 }
 
@@ -1067,135 +1801,283 @@ void ResetScene(Scene *scene_group)
 //     scene->plots.count++;
 // }
 
-void Plot1D(Scene *scene, ParametricFn1D func, Graph *graph, MVec3 color, const char *legend)
+// Value of a 1D plot at x, from its proxy when it has one
+static double InvokeParametric1D(FunctionPlotData *function, double x)
 {
-    // No check done here currently
-    const uint32_t max_verts                           = 10000;
-    scene->plots.functions[scene->plots.count].max     = max_verts; // 1000 vertices for each graph at most
-    scene->plots.functions[scene->plots.count].samples = malloc(sizeof(MVec2) * max_verts);
-    assert(scene->plots.functions[scene->plots.count].samples);
-
-    float             init     = -10.0f;
-    float             term     = 10.0f;
-    float             step     = 0.1f;
-
-    FunctionPlotData *function = &scene->plots.functions[scene->plots.count];
-    function->fn_type          = PARAMETRIC_1D;
-
-    VertexData2D vec;
-    vec.x                                = init;
-    vec.y                                = func(vec.x);
-    vec.n_x                              = 1.0f;
-    vec.n_y                              = 1.0f;
-
-    function->samples[function->count++] = vec;
-
-    float n_x, n_y;
-    for (float x = init + step; x <= term; x += step)
-    {
-        vec.x = x;
-        vec.y = func(vec.x);
-        assert(function->count < function->max);
-        n_x                                        = x - function->samples[function->count - 1].x;
-        n_y                                        = vec.y - function->samples[function->count - 1].y;
-        function->samples[function->count - 1].n_x = n_x;
-        function->samples[function->count - 1].n_y = n_y;
-        function->samples[function->count++]       = vec;
-    }
-    function->color    = color;
-    function->function = func;
-    function->batch    = CreateNewBatch(LINE_STRIP);
-    assert(function->batch);
+    if (function->proxy)
+        return MorphEvalProxy(function->proxy, x);
+    if (function->batched)
+    {
+        double y;
+        ((ParametricBatchFn1D)function->function)(&x, &y, 1, function->user);
+        return y;
+    }
+    return ((ParametricFn1D)function->function)(x);
+}
+
+static void Parametric1DCurve(void *curve, const double *ts, MVec2 *points, MVec2 *directions, uint32_t n)
+{
+    FunctionPlotData *function = curve;
+    if (function->batched && !function->proxy)
+    {
+        // A whole round in one call, values are spread into the points afterwards
+        double ys[2 * SAMPLE_ROUND];
+        assert(n <= 2 * SAMPLE_ROUND);
+        ((ParametricBatchFn1D)function->function)(ts, ys, n, function->user);
+        for (uint32_t i = 0; i < n; ++i)
+            points[i] = (MVec2){ts[i], ys[i]};
+        return;
+    }
+    for (uint32_t i = 0; i < n; ++i)
+        points[i] = (MVec2){ts[i], InvokeParametric1D(function, ts[i])};
+}
+
+static void Parametric2DCurve(void *curve, const double *ts, MVec2 *points, MVec2 *directions, uint32_t n)
+{
+    FunctionPlotData *function = curve;
+    if (function->batched)
+    {
+        ((ParametricBatchFn2D)function->function)(ts, points, n, function->user);
+        return;
+    }
+    for (uint32_t i = 0; i < n; ++i)
+        points[i] = ((ParametricFn2D)function->function)(ts[i]);
+}
+
+// Directions along the curve come from the exact derivative, when the function has one
+static void ContextCurve(void *curve, const double *ts, MVec2 *points, MVec2 *directions, uint32_t n)
+{
+    FunctionPlotData *function = curve;
+    float             xs[2 * SAMPLE_ROUND], ys[2 * SAMPLE_ROUND], slopes[2 * SAMPLE_ROUND];
+    assert(n <= 2 * SAMPLE_ROUND);
+    for (uint32_t i = 0; i < n; ++i)
+        xs[i] = (float)ts[i];
+    EvalFromContextBatch(function->context, xs, NULL, ys, n);
+    for (uint32_t i = 0; i < n; ++i)
+        points[i] = (MVec2){xs[i], ys[i]};
+
+    if (!function->slope)
+        return;
+    EvalFromContextBatch(function->slope, xs, NULL, slopes, n);
+    for (uint32_t i = 0; i < n; ++i)
+        directions[i] = (MVec2){1.0f, slopes[i]};
+}
+
+// Next plot of the scene, its vertices are allocated as they are written
+// The array doubles when full. Sampled curves point back at their plot, so they are moved along with it.
+static FunctionPlotData *NewFunctionPlot(Scene *scene, FunctionType fn_type)
+{
+    PlotArray *plots = &scene->plots;
+    if (plots->count == plots->max)
+    {
+        FunctionPlotData *functions = realloc(plots->functions, sizeof(*functions) * plots->max * 2);
+        assert(functions != NULL);
+        for (uint32_t plot = 0; plot < plots->count; ++plot)
+        {
+            if (functions[plot].curve)
+                functions[plot].curve->curve = &functions[plot];
+        }
+        plots->functions = functions;
+        plots->max       = plots->max * 2;
+    }
+
+    FunctionPlotData *function = &plots->functions[plots->count];
+    *function                  = (FunctionPlotData){0};
+    function->fn_type          = fn_type;
+    function->vertices.stride  = sizeof(VertexData2D);
+    return function;
+}
+
+// Resamples the plots whose samples were made for another view, the next frame uploads them
+static void UpdatePlotSamples(Scene *scene)
+{
+    for (uint32_t plot = 0; plot < scene->plots.count; ++plot)
+    {
+        FunctionPlotData *function = &scene->plots.functions[plot];
+        if (!function->curve || !UpdateCurve(function->curve, scene))
+            continue;
+        WriteCurveVertices(function->curve, &function->vertices);
+        function->updated = true;
+    }
+}
+
+// Adds function to the scene, drawing the vertices it holds as a line strip
+static void AddLineStrip(Scene *scene, FunctionPlotData *function, MVec3 color)
+{
+    function->color   = color;
+    function->batch   = CreateNewBatch(LINE_STRIP);
     function->updated = true;
+    assert(function->batch);
     scene->plots.count++;
 }
 
+static void PlotCurve(Scene *scene, FunctionPlotData *function, MVec3 color)
+{
+    UpdateCurve(function->curve, scene);
+    WriteCurveVertices(function->curve, &function->vertices);
+    AddLineStrip(scene, function, color);
+}
+
+// Plots over the visible range, and follows the view. func is a ParametricBatchFn1D when batched is set.
+static void PlotParametric1D(Scene *scene, void *func, void *user, bool batched, MChebyshevProxy *proxy, MVec3 color)
+{
+    FunctionPlotData *function = NewFunctionPlot(scene, PARAMETRIC_1D);
+    function->function         = func;
+    function->user             = user;
+    function->batched          = batched;
+    function->proxy            = proxy;
+    function->curve            = CreateSampledCurve(Parametric1DCurve, function, -10.0, 10.0, true, scene->sample_budget,
+                                                    scene->sample_cache);
+    PlotCurve(scene, function, color);
+}
+
+void Plot1D(Scene *scene, ParametricFn1D func, Graph *graph, MVec3 color, const char *legend)
+{
+    PlotParametric1D(scene, (void *)func, NULL, false, NULL, color);
+}
+
+void Plot1DBatched(Scene *scene, ParametricBatchFn1D func, void *user, Graph *graph, MVec3 color, const char *legend)
+{
+    (void)graph;
+    (void)legend;
+    PlotParametric1D(scene, (void *)func, user, true, NULL, color);
+}
+
+// The proxy covers the range Plot1D used to sample, and the plot owns it. Outside of it nothing is drawn.
+void Plot1DProxy(Scene *scene, ParametricFn1D func, Graph *graph, MVec3 color, const char *legend, double tolerance)
+{
+    (void)graph;
+    (void)legend;
+    PlotParametric1D(scene, (void *)func, NULL, false, MorphCreateProxy(func, -10.0, 10.0, tolerance), color);
+}
+
+void Plot1DProxyBatched(Scene *scene, ParametricBatchFn1D func, void *user, Graph *graph, MVec3 color,
+                        const char *legend, double tolerance)
+{
+    (void)graph;
+    (void)legend;
+    MChebyshevProxy *proxy = MorphCreateProxyBatched(func, user, -10.0, 10.0, tolerance);
+    PlotParametric1D(scene, (void *)func, user, true, proxy, color);
+}
+
+// Samples are placed by the curve itself now, step_ is left unused
 void MorphParametric2DPlot(Scene *scene, ParametricFn2D fn, float tInit, float tTerm, MVec3 rgb, const char *cstronly,
                            float step_)
 {
-    const uint32_t max_verts                           = 10000;
-    scene->plots.functions[scene->plots.count].max     = max_verts; // 1000 vertices for each graph at most
-    scene->plots.functions[scene->plots.count].samples = malloc(sizeof(MVec2) * max_verts);
-    scene->plots.functions[scene->plots.count].count   = 0;
-
-    float             init                             = tInit;
-    float             term                             = tTerm;
-    float             step                             = step_;
-
-    FunctionPlotData *function                         = &scene->plots.functions[scene->plots.count];
-    function->fn_type                                  = PARAMETRIC_2D;
-
-    VertexData2D vec;
-    MVec2        sample                  = fn(init);
-    vec.x                                = sample.x;
-    vec.y                                = sample.y;
-    vec.n_x                              = 1.0f;
-    vec.n_y                              = 1.0f;
-
-    function->samples[function->count++] = vec;
-
-    float n_x, n_y;
-    for (float t = init + step; t <= term; t += step)
-    {
-        sample = fn((double)t);
-        vec.x  = sample.x;
-        vec.y  = sample.y;
-        // fprintf(stderr, "\nSampled : [%5g, %5g].", sample.x, sample.y);
-        assert(function->count * 2 < function->max);
-        n_x                                        = vec.x - function->samples[function->count - 1].x;
-        n_y                                        = vec.y - function->samples[function->count - 1].y;
-        function->samples[function->count - 1].n_x = n_x;
-        function->samples[function->count - 1].n_y = n_y;
-        function->samples[function->count++]       = vec;
-    }
-    function->color    = rgb;
-    function->function = NULL;
-    function->batch    = CreateNewBatch(LINE_STRIP);
-    function->updated  = true;
-    scene->plots.count++;
+    (void)cstronly;
+    (void)step_;
+    FunctionPlotData *function = NewFunctionPlot(scene, PARAMETRIC_2D);
+    function->function         = (void *)fn;
+    function->curve            = CreateSampledCurve(Parametric2DCurve, function, tInit, tTerm, false, scene->sample_budget,
+                                                    scene->sample_cache);
+    PlotCurve(scene, function, rgb);
 }
 
-void Plot1DFromComputationContext(Scene *scene, ComputationContext *context, Graph *graph, MVec3 color,
-                                  const char *legend)
+void MorphParametric2DPlotBatched(Scene *scene, ParametricBatchFn2D fn, void *user, float tInit, float tTerm, MVec3 rgb,
+                                  const char *cstronly)
 {
-    // No check done here currently
-    const uint32_t max_verts                           = 1000;
-    scene->plots.functions[scene->plots.count].max     = max_verts; // 1000 vertices for each graph at most
-    scene->plots.functions[scene->plots.count].samples = malloc(sizeof(MVec2) * max_verts);
+    (void)cstronly;
+    FunctionPlotData *function = NewFunctionPlot(scene, PARAMETRIC_2D);
+    function->function         = (void *)fn;
+    function->user             = user;
+    function->batched          = true;
+    function->curve            = CreateSampledCurve(Parametric2DCurve, function, tInit, tTerm, false, scene->sample_budget,
+                                                    scene->sample_cache);
+    PlotCurve(scene, function, rgb);
+}
 
-    float             init                             = -10.0f;
-    float             term                             = 10.0f;
-    float             step                             = 0.1f;
+// Points are joined in the order given. They are written once, into a single block the size of the list.
+void MorphPlotList(MorphPlotDevice *device, float *xpts, float *ypts, int length, MVec3 rgb, const char *cstronly)
+{
+    assert(length >= 0);
+    FunctionPlotData *function = NewFunctionPlot(device->scene, LIST);
+    VertexData2D     *vertices = PushVertices(&function->vertices, (uint32_t)length);
+    for (int point = 0; point < length; ++point)
+        vertices[point] = (VertexData2D){.x = xpts[point], .y = ypts[point]};
+    WriteSecants(vertices, (uint32_t)length);
+    AddLineStrip(device->scene, function, rgb);
+}
 
-    FunctionPlotData *function                         = &scene->plots.functions[scene->plots.count];
-    function->fn_type                                  = PARAMETRIC_1D;
+#define PLOT_CHUNK 1024 // points fn is called on at once
 
-    VertexData2D vec;
-    vec.x                                = init;
-    vec.y                                = EvalFromContext(context, vec.x, 0.0f);
-    vec.n_x                              = 1.0f;
-    vec.n_y                              = 1.0f;
+// Samples fn every step from xinit to xend, a chunk of points at a time. The plot keeps these samples whatever the
+// view, and fn is a ParametricBatchFn1D when batched is set.
+static void PlotFunc(MorphPlotDevice *device, void *fn, void *user, bool batched, MVec3 color, double xinit,
+                     double xend, double step)
+{
+    assert(step > 0.0 && xinit <= xend);
+    double points = floor((xend - xinit) / step) + 1.0;
+    assert(points < UINT32_MAX);
 
-    function->samples[function->count++] = vec;
+    uint32_t          count    = (uint32_t)points;
+    FunctionPlotData *function = NewFunctionPlot(device->scene, PARAMETRIC_1D);
+    function->function         = fn;
+    function->user             = user;
+    function->batched          = batched;
+    VertexData2D *vertices     = PushVertices(&function->vertices, count);
 
-    float n_x, n_y;
-    for (float x = init + step; x <= term; x += step)
+    double        xs[PLOT_CHUNK], ys[PLOT_CHUNK];
+    for (uint32_t first = 0; first < count; first += PLOT_CHUNK)
     {
-        vec.x = x;
-        vec.y = EvalFromContext(context, vec.x, 0.0f);
-        assert(function->count < function->max);
-        n_x                                        = x - function->samples[function->count - 1].x;
-        n_y                                        = vec.y - function->samples[function->count - 1].y;
-        function->samples[function->count - 1].n_x = n_x;
-        function->samples[function->count - 1].n_y = n_y;
-        function->samples[function->count++]       = vec;
+        // x is found from the index, adding step up would drift over millions of samples
+        uint32_t n = count - first < PLOT_CHUNK ? count - first : PLOT_CHUNK;
+        for (uint32_t i = 0; i < n; ++i)
+            xs[i] = xinit + step * (first + i);
+        if (batched)
+            ((ParametricBatchFn1D)fn)(xs, ys, n, user);
+        else
+        {
+            for (uint32_t i = 0; i < n; ++i)
+                ys[i] = ((ParametricFn1D)fn)(xs[i]);
+        }
+        for (uint32_t i = 0; i < n; ++i)
+            vertices[first + i] = (VertexData2D){.x = xs[i], .y = ys[i]};
     }
-    function->color = color;
+    WriteSecants(vertices, count);
+    AddLineStrip(device->scene, function, color);
+}
+
+void MorphPlotFunc(MorphPlotDevice *device, ParametricFn1D fn, MVec3 color, float xinit, float xend,
+                   const char *cstronly, float step)
+{
+    (void)cstronly;
+    PlotFunc(device, (void *)fn, NULL, false, color, xinit, xend, step);
+}
+
+void MorphPlotFuncBatched(MorphPlotDevice *device, ParametricBatchFn1D fn, void *user, MVec3 color, float xinit,
+                          float xend, const char *cstronly, float step)
+{
+    (void)cstronly;
+    PlotFunc(device, (void *)fn, user, true, color, xinit, xend, step);
+}
+
+// Starts the samples of a plot of x over, the next frame uploads them into the same batch
+static void Sample1DFromComputationContext(Scene *scene, FunctionPlotData *function)
+{
+    if (function->slope)
+        DestroyComputationContext(function->slope);
+    DestroySymbolFn(function->derivative);
+    function->derivative = DifferentiateSymbolFn(function->context->fn, 0);
+    function->slope      = function->derivative ? NewComputation(function->derivative) : NULL;
+
+    ClearPyramid(&function->curve->pyramid);
+    function->curve->count = 0;
+    UpdateCurve(function->curve, scene);
+    WriteCurveVertices(function->curve, &function->vertices);
+    function->updated = true;
+}
 
-    // Gotta treat both function as same
-    function->function = parabola;
-    function->batch    = CreateNewBatch(LINE_STRIP);
-    function->updated  = true;
+// The plot takes context, and resamples it whenever RefreshPlots finds a definition it reads replaced
+void Plot1DFromComputationContext(Scene *scene, ComputationContext *context, Graph *graph, MVec3 color,
+                                  const char *legend)
+{
+    FunctionPlotData *function = NewFunctionPlot(scene, PARAMETRIC_1D);
+    function->context          = context;
+    function->curve            = CreateSampledCurve(ContextCurve, function, -10.0, 10.0, true, scene->sample_budget,
+                                                    scene->sample_cache);
+    Sample1DFromComputationContext(scene, function);
+    function->color = color;
+    function->batch = CreateNewBatch(LINE_STRIP);
     scene->plots.count++;
 }
 
@@ -1507,18 +2389,39 @@ void RenderLabels(Scene *scene, Font *font, Graph *graph, Mat4 *combined_matrix)
 //     scene_group->graphname[scene_group->graphcount - 1]  = GiveOnlyStaticStrings;
 // }
 
-// From computation context not handled yet
-bool InvokeAndTestFunction(void *function, FunctionType type, MVec2 vec)
+static double InvokeImplicit2D(FunctionPlotData *function, double x, double y)
 {
-    // TODO :: For function from computation context
-    switch (type)
+    if (function->batched)
+    {
+        double value;
+        ((ImplicitBatchFn2D)function->function)(&x, &y, &value, 1, function->user);
+        return value;
+    }
+    return ((ImplicitFn2D)function->function)(x, y);
+}
+
+// Whether vec lies on the plot. Plots parsed from text are evaluated through their context, the others through the
+// function they were made with, if they kept one.
+bool InvokeAndTestFunction(FunctionPlotData *function, MVec2 vec)
+{
+    if (function->context)
+    {
+        float value = EvalFromContext(function->context, vec.x, vec.y);
+        if (function->fn_type == PARAMETRIC_1D)
+            value = value - vec.y;
+        return fabsf(value) < 0.04f;
+    }
+    if (!function->function)
+        return false;
+    switch (function->fn_type)
     {
     case PARAMETRIC_1D:
-        return fabs(((ParametricFn1D)function)(vec.x) - vec.y) < 0.04f;
+        return fabs(InvokeParametric1D(function, vec.x) - vec.y) < 0.04f;
     case IMPLICIT_2D:
-        return fabs(((ImplicitFn2D)function)(vec.x, vec.y)) < 0.04f;
+        return fabs(InvokeImplicit2D(function, vec.x, vec.y)) < 0.04f;
+    default:
+        return false;
     }
-    return false;
 }
 
 void HandleEvents(GLFWwindow *window, Scene *scene, State *state, Graph *graph, Mat4 *translate_matrix,
@@ -1577,8 +2480,7 @@ void HandleEvents(GLFWwindow *window, Scene *scene, State *state, Graph *graph,
         scene->plots.current_selection = -1;
         for (uint32_t fn = 0; fn < scene->plots.count; ++fn)
         {
-            if (InvokeAndTestFunction(scene->plots.functions[fn].function, scene->plots.functions[fn].fn_type,
-                                      (MVec2){vec[0], vec[1]}))
+            if (InvokeAndTestFunction(&scene->plots.functions[fn], (MVec2){vec[0], vec[1]}))
             {
                 scene->plots.current_selection = fn;
                 break;
@@ -1706,6 +2608,7 @@ MorphPlotDevice MorphCreateDevice()
         *new_transform = IdentityMatrix();
 
     *new_transform = ScalarMatrix(200.0f, 200.0f, 1.0f);
+    scene->view    = new_transform;
     Graph *graph   = malloc(sizeof(*graph));
     InitGraph(graph);
 
@@ -1716,7 +2619,9 @@ MorphPlotDevice MorphCreateDevice()
     Panel *panel       = CreatePanel(screen_width, screen_height);
     panel->render.font = ComicSans;
 
-    Parser   *parser   = CreateParser(NULL, 0);
+    InitInterpreter();
+    Interpreter *interpreter = CreateInterpreter();
+    Parser      *parser      = CreateParser(interpreter, NULL, 0);
 
     UserData *data     = malloc(sizeof(*data));
     if (data)
@@ -1724,6 +2629,7 @@ MorphPlotDevice MorphCreateDevice()
                            .graph           = graph,
                            .scale_transform = scale_matrix,
                            .panel           = panel,
+                           .interpreter     = interpreter,
                            .parser          = parser,
                            .scene           = scene,
                            .new_transform   = new_transform, // The ultimate transformation
@@ -1766,7 +2672,6 @@ MorphPlotDevice MorphCreateDevice()
 
     device.should_close = false;
 
-    InitInterpreter();
     scroll_animation.duration_constant = 0.05f;
     scroll_animation.offset_changed    = true;
     scroll_animation.offset            = 0.0f;
@@ -1807,6 +2712,8 @@ void MorphDestroyDevice(MorphPlotDevice *device)
     Destroy2DScene(device->scene);
     free(device->scene);
     UserData *data = glfwGetWindowUserPointer(device->window);
+    if (data)
+        DestroyInterpreter(data->interpreter);
     free(data);
     free(device->transform);
     free(device->graph);
@@ -1815,17 +2722,6 @@ void MorphDestroyDevice(MorphPlotDevice *device)
     glfwTerminate();
 }
 
-// void MorphPlotList(MorphPlotDevice *device, float *x, float *y, int length, MVec3 rgb, const char *cstronly)
-//{
-//     for (int points = 0; points < length; ++points)
-//         AddSinglePoint(device->render_scene, (MVec2){x[points], y[points]});
-//
-//     assert(device->render_scene->graphcount < device->render_scene->cMaxGraph);
-//     device->render_scene->graphbreak[device->render_scene->graphcount++]   = device->render_scene->pCount;
-//     device->render_scene->graphcolor[device->render_scene->graphcount - 1] = rgb;
-//     device->render_scene->graphname[device->render_scene->graphcount - 1]  = cstronly;
-// }
-
 void ResetRenderScene(Scene *scene)
 {
     static int counter = 0;
@@ -1839,9 +2735,19 @@ void ResetRenderScene(Scene *scene)
         free(scene->plots.functions[plot].batch->vertex_buffer.data);
         free(scene->plots.functions[plot].batch);
 
-        assert(scene->plots.functions[plot].samples);
-        free(scene->plots.functions[plot].samples);
-        scene->plots.functions[plot].count = 0;
+        ReleaseVertices(&scene->plots.functions[plot].vertices);
+        if (scene->plots.functions[plot].context)
+            DestroyComputationContext(scene->plots.functions[plot].context);
+        if (scene->plots.functions[plot].slope)
+            DestroyComputationContext(scene->plots.functions[plot].slope);
+        DestroySymbolFn(scene->plots.functions[plot].derivative);
+        MorphDestroyProxy(scene->plots.functions[plot].proxy);
+        DestroySampledCurve(scene->plots.functions[plot].curve);
+        scene->plots.functions[plot].context    = NULL;
+        scene->plots.functions[plot].slope      = NULL;
+        scene->plots.functions[plot].derivative = NULL;
+        scene->plots.functions[plot].proxy      = NULL;
+        scene->plots.functions[plot].curve      = NULL;
     }
     scene->plots.count = 0;
 }
@@ -1851,6 +2757,28 @@ void MorphResetPlotting(MorphPlotDevice *device)
     ResetRenderScene(device->scene);
 }
 
+void MorphSetSampling(MorphPlotDevice *device, float tolerance, uint32_t budget)
+{
+    assert(tolerance > 0.0f);
+    device->scene->tolerance     = tolerance;
+    device->scene->sample_budget = budget < PLOT_MIN_BUDGET ? PLOT_MIN_BUDGET : budget;
+}
+
+void MorphSetSampleCache(MorphPlotDevice *device, uint32_t samples)
+{
+    device->scene->sample_cache = samples < PLOT_MIN_BUDGET ? PLOT_MIN_BUDGET : samples;
+}
+
+uint32_t MorphCachedSamples(MorphPlotDevice *device, uint32_t plot, int32_t level)
+{
+    Scene *scene = device->scene;
+    if (plot >= scene->plots.count || !scene->plots.functions[plot].curve)
+        return 0;
+    if (level < PYRAMID_MIN_LEVEL || level >= PYRAMID_MIN_LEVEL + PYRAMID_LEVELS)
+        return 0;
+    return scene->plots.functions[plot].curve->pyramid.levels[level - PYRAMID_MIN_LEVEL];
+}
+
 double ImplicitCircle(double x, double y)
 {
     return x * x + y * y - 4; // Implicit circle of radius 2
@@ -1866,125 +2794,175 @@ double ImplicitHyperbola(double x, double y)
     return x * x - y * y - 1;
 }
 
-double PartialDerivativeX(ImplicitFn2D fn, double x, double y, double h)
+// Dual numbers, see Morph.h
+MDual MDualConstant(double value)
 {
-    return (fn(x + h, y) - fn(x, y)) / h;
+    return (MDual){.value = value};
 }
 
-double PartialDerivativeY(ImplicitFn2D fn, double x, double y, double h)
+MDual MDualAdd(MDual a, MDual b)
 {
-    return (fn(x, y + h) - fn(x, y)) / h;
+    return (MDual){a.value + b.value, a.dx + b.dx, a.dy + b.dy};
 }
 
-MVec2 Gradient2D(ImplicitFn2D fn, double x, double y, double h)
+MDual MDualSub(MDual a, MDual b)
 {
-    return (MVec2){PartialDerivativeX(fn, x, y, h), PartialDerivativeY(fn, x, y, h)};
+    return (MDual){a.value - b.value, a.dx - b.dx, a.dy - b.dy};
 }
 
-MVec2 ContourDirection(ImplicitFn2D fn, double x, double y, double h)
+MDual MDualMul(MDual a, MDual b)
 {
-    MVec2 grad = Gradient2D(fn, x, y, h);
-    float norm = sqrtf(grad.x * grad.x + grad.y * grad.y);
-    return (MVec2){.x = -grad.y / norm, .y = grad.x / norm};
+    return (MDual){a.value * b.value, a.dx * b.value + a.value * b.dx, a.dy * b.value + a.value * b.dy};
 }
 
-// Takes functions of the form f(x,y) - c to plot f(x,y) = c
+MDual MDualDiv(MDual a, MDual b)
+{
+    double quotient = a.value / b.value;
+    return (MDual){quotient, (a.dx - quotient * b.dx) / b.value, (a.dy - quotient * b.dy) / b.value};
+}
 
-void ImplicitFunctionPlot2D(MorphPlotDevice *device, ImplicitFn2D fn)
+MDual MDualPow(MDual a, double n)
+{
+    double slope = n * pow(a.value, n - 1);
+    return (MDual){pow(a.value, n), slope * a.dx, slope * a.dy};
+}
+
+MDual MDualSin(MDual a)
+{
+    double slope = cos(a.value);
+    return (MDual){sin(a.value), slope * a.dx, slope * a.dy};
+}
+
+MDual MDualCos(MDual a)
+{
+    double slope = -sin(a.value);
+    return (MDual){cos(a.value), slope * a.dx, slope * a.dy};
+}
+
+MDual MDualExp(MDual a)
+{
+    double value = exp(a.value);
+    return (MDual){value, value * a.dx, value * a.dy};
+}
+
+MDual MDualLog(MDual a)
+{
+    return (MDual){log(a.value), a.dx / a.value, a.dy / a.value};
+}
+
+MDual MDualSqrt(MDual a)
+{
+    double value = sqrt(a.value);
+    return (MDual){value, 0.5 * a.dx / value, 0.5 * a.dy / value};
+}
+
+// Value of an implicit function at (x, y) along with its gradient
+typedef double (*ImplicitSampler)(void *fn, void *user, double x, double y, MVec2 *gradient);
+
+// Plain native functions can't be differentiated, so they still pay two more evaluations for forward differences
+static double SampleWithDifferences(void *fn, void *user, double x, double y, MVec2 *gradient)
+{
+    (void)user;
+    const double h     = 0.0005;
+    ImplicitFn2D f     = (ImplicitFn2D)fn;
+    double       value = f(x, y);
+    gradient->x        = (f(x + h, y) - value) / h;
+    gradient->y        = (f(x, y + h) - value) / h;
+    return value;
+}
+
+// Same differences, all three points in one call
+static double SampleBatchWithDifferences(void *fn, void *user, double x, double y, MVec2 *gradient)
+{
+    const double h     = 0.0005;
+    double       xs[3] = {x, x + h, x};
+    double       ys[3] = {y, y, y + h};
+    double       values[3];
+    ((ImplicitBatchFn2D)fn)(xs, ys, values, 3, user);
+    gradient->x = (values[1] - values[0]) / h;
+    gradient->y = (values[2] - values[0]) / h;
+    return values[0];
+}
+
+static double SampleDual(void *fn, void *user, double x, double y, MVec2 *gradient)
+{
+    (void)user;
+    MDual value = ((ImplicitDualFn2D)fn)((MDual){.value = x, .dx = 1.0}, (MDual){.value = y, .dy = 1.0});
+    gradient->x = value.dx;
+    gradient->y = value.dy;
+    return value.value;
+}
+
+static MVec2 ContourDirection(MVec2 gradient)
 {
-    Scene         *scene     = device->scene;
+    float norm = sqrtf(gradient.x * gradient.x + gradient.y * gradient.y);
+    return (MVec2){.x = -gradient.y / norm, .y = gradient.x / norm};
+}
 
-    const uint32_t max_verts = 10000;
+// Takes functions of the form f(x,y) - c to plot f(x,y) = c
+// native is the function kept for hit testing, NULL when the plot can't be tested. It is an ImplicitBatchFn2D taking
+// user when batched is set.
+static void TraceImplicitFunction2D(MorphPlotDevice *device, ImplicitSampler sample, void *fn, void *user, void *native,
+                                    bool batched)
+{
+    Scene *scene = device->scene;
 
     // First determine a point in the function using any method
     // My approach :
     // Start at the origin and move along the partial derivatives to reach to the initial position on the surface
 
-    MVec2        vec   = {0, 0}; // start at the origin and land on the contour
-    float        hstep = 0.025f, kstep = 0.025f;
+    MVec2    vec              = {0, 0}; // start at the origin and land on the contour
+    MVec2    gradient;
+    double   value;
 
-    float        h            = 0.0005;
+    float    h                = 0.0005;
 
-    uint32_t     sample_count = 0;
-    VertexData2D vertex;
+    uint32_t counter          = 0;
 
-    uint32_t     counter          = 0;
-
-    uint32_t     plots            = 4;
-    int32_t      dir[]            = {1, -1, 1, -1};
-    float        origin_offsets[] = {0.1f, 0.1f, -0.1f, -0.1f};
+    uint32_t plots            = 4;
+    int32_t  dir[]            = {1, -1, 1, -1};
+    float    origin_offsets[] = {0.1f, 0.1f, -0.1f, -0.1f};
 
     while (plots--)
     {
         // To reach the contour line, we must travel along the partial derivatives first and use Newton Raphson
         // method to find the point of contour Taking y constant for now and moving in the direction of partial
         // derivative
-        scene->plots.functions[scene->plots.count].max     = max_verts; // 1000 vertices for each graph at most
-        scene->plots.functions[scene->plots.count].samples = malloc(sizeof(MVec2) * max_verts);
-
-        FunctionPlotData *function                         = &scene->plots.functions[scene->plots.count];
-        function->fn_type                                  = IMPLICIT_2D;
-        function->color                                    = (MVec3){1.0f, 0.5f, 0.6f};
-        function->function                                 = fn;
+        FunctionPlotData *function = NewFunctionPlot(scene, IMPLICIT_2D);
+        function->color            = (MVec3){1.0f, 0.5f, 0.6f};
+        function->function         = native;
+        function->user             = user;
+        function->batched          = batched;
 
-        vec.x                                              = origin_offsets[plots];
-        vec.y                                              = 0.0f;
+        vec.x                      = origin_offsets[plots];
+        vec.y                      = 0.0f;
 
-        int32_t max_movement                               = 15000;
-        while (fabs(fn(vec.x, vec.y)) > 0.0025f)
-        {
-            // vec.y = vec.y - fn(vec.x, vec.y) / PartialDerivativeY(fn, vec.x, vec.y, hstep);
-            vec.x = vec.x - fn(vec.x, vec.y) / PartialDerivativeX(fn, vec.x, vec.y, hstep);
-        }
+        int32_t max_movement       = 15000;
+        // Each Newton step takes the value and the derivative from a single sample
+        while (fabs(value = sample(fn, user, vec.x, vec.y, &gradient)) > 0.0025f)
+            vec.x = vec.x - value / gradient.x;
 
-        vertex.x                             = vec.x;
-        vertex.y                             = vec.y;
-
-        function->samples[function->count++] = vertex;
-
-        // Now move along the contour of the implicit function.
-        // Calculate partial derivative along X and Y direction.
-        // Gradient of the function
+        VertexData2D *last = PushVertices(&function->vertices, 1);
+        *last              = (VertexData2D){.x = vec.x, .y = vec.y};
 
+        // Now move along the contour of the implicit function, perpendicular to its gradient
         while (max_movement--)
         {
-            // Calculate delX and delY such that they remains in the contour
-            // dy = -hstep * PartialDerivativeX(fn, vec.x, vec.y, h) / PartialDerivativeY(fn, vec.x + hstep, vec.y,
-            // h);
-
-            // If the path can't remain in the contour, then dx will be ??
-            // dx = hstep; // -hstep * PartialDerivativeY(fn, vec.x, vec.y, h) / PartialDerivativeX(fn, vec.x, vec.y
-            // + kstep, h); else
-            // {
-            //     x_inc =
-            //         -hstep * PartialDerivativeY(fn, vec.x, vec.y, h) / PartialDerivativeX(fn, vec.x, vec.y +
-            //         kstep, h);
-
-            // }
-            // Trace back to the contour after the increment
-            // Move toward that and again trace back to the contour
-            // Lets apply concept from the higher dimensional vector calculus
-
-            MVec2 tangent = ContourDirection(fn, vec.x, vec.y, h);
+            sample(fn, user, vec.x, vec.y, &gradient);
+            MVec2 tangent = ContourDirection(gradient);
             float dx      = dir[plots] * tangent.x * h * 2.5f;
             float dy      = dir[plots] * tangent.y * h * 2.5f;
 
             // once this is finished move toward the negative contour
-            vec.x = vec.x + dx;
-            vec.y = vec.y + dy;
+            vec.x         = vec.x + dx;
+            vec.y         = vec.y + dy;
 
-            // while (fabs(fn(vec.x, vec.y)) > FLT_EPSILON)
-            //{
-            //     vec.y = vec.y - fn(vec.x, vec.y) / PartialDerivativeY(fn, vec.x, vec.y, hstep);
-            // }
             if (counter++ % 100 == 0)
             {
-                assert(function->count < function->max);
-                vertex.x                                   = vec.x;
-                vertex.y                                   = vec.y;
-                function->samples[function->count - 1].n_x = vec.x - function->samples[function->count - 1].x;
-                function->samples[function->count - 1].n_y = vec.y - function->samples[function->count - 1].y;
-                function->samples[function->count++]       = vertex;
+                last->n_x = vec.x - last->x;
+                last->n_y = vec.y - last->y;
+                last      = PushVertices(&function->vertices, 1);
+                *last     = (VertexData2D){.x = vec.x, .y = vec.y};
             }
         }
         function->color   = (MVec3){1.0f, 0.0f, 1.0f};
@@ -1994,6 +2972,156 @@ void ImplicitFunctionPlot2D(MorphPlotDevice *device, ImplicitFn2D fn)
     }
 }
 
+void ImplicitFunctionPlot2D(MorphPlotDevice *device, ImplicitFn2D fn)
+{
+    TraceImplicitFunction2D(device, SampleWithDifferences, (void *)fn, NULL, (void *)fn, false);
+}
+
+void ImplicitFunctionPlot2DDual(MorphPlotDevice *device, ImplicitDualFn2D fn)
+{
+    TraceImplicitFunction2D(device, SampleDual, (void *)fn, NULL, NULL, false);
+}
+
+void ImplicitFunctionPlot2DBatched(MorphPlotDevice *device, ImplicitBatchFn2D fn, void *user)
+{
+    TraceImplicitFunction2D(device, SampleBatchWithDifferences, (void *)fn, user, (void *)fn, true);
+}
+
+// Point on the edge from a to b where f crosses zero, fa and fb having opposite signs
+static VertexData2D EdgeCrossing(MVec2 a, MVec2 b, float fa, float fb)
+{
+    float t = fa / (fa - fb);
+    return (VertexData2D){.x = a.x + t * (b.x - a.x), .y = a.y + t * (b.y - a.y)};
+}
+
+// Marching squares over one cell, emitting the pieces of the contour as separate segments
+static void ContourCell(ComputationContext *context, FunctionPlotData *function, Interval x, Interval y)
+{
+    MVec2        corners[4] = {{x.lo, y.lo}, {x.hi, y.lo}, {x.hi, y.hi}, {x.lo, y.hi}};
+    float        values[4];
+    VertexData2D crossings[4];
+    uint32_t     count = 0;
+
+    for (uint32_t corner = 0; corner < 4; ++corner)
+    {
+        values[corner] = EvalFromContext(context, corners[corner].x, corners[corner].y);
+        if (isnan(values[corner]))
+            return;
+    }
+
+    // Crossing of edge i, between corner i and the next one
+    for (uint32_t edge = 0; edge < 4; ++edge)
+    {
+        uint32_t next = (edge + 1) % 4;
+        if ((values[edge] < 0.0f) != (values[next] < 0.0f))
+            crossings[count++] = EdgeCrossing(corners[edge], corners[next], values[edge], values[next]);
+    }
+
+    VertexData2D segments[4];
+    if (count == 2)
+    {
+        segments[0] = crossings[0];
+        segments[1] = crossings[1];
+    }
+    else if (count == 4)
+    {
+        // Saddle, the center decides which pair of opposite corners the contour separates
+        float center = EvalFromContext(context, (x.lo + x.hi) / 2, (y.lo + y.hi) / 2);
+        bool  joined = (center < 0.0f) == (values[0] < 0.0f);
+        for (uint32_t i = 0; i < 4; ++i)
+            segments[i] = crossings[joined ? i : (i + 3) % 4];
+    }
+    else
+        return;
+
+    VertexData2D *vertices = PushVertices(&function->vertices, count);
+    for (uint32_t i = 0; i < count; i += 2)
+    {
+        float n_x           = segments[i + 1].x - segments[i].x;
+        float n_y           = segments[i + 1].y - segments[i].y;
+        segments[i].n_x     = n_x;
+        segments[i].n_y     = n_y;
+        segments[i + 1].n_x = n_x;
+        segments[i + 1].n_y = n_y;
+        vertices[i]         = segments[i];
+        vertices[i + 1]     = segments[i + 1];
+    }
+}
+
+// Splits the box into quarters as long as its range of values may hold zero, boxes proven free of the contour are
+// dropped whole. An empty range, where f is undefined, is dropped too.
+static void SubdivideImplicit(ComputationContext *context, FunctionPlotData *function, Interval x, Interval y,
+                              uint32_t depth)
+{
+    Interval range = EvalFromContextInterval(context, x, y);
+    if (range.lo > 0.0f || range.hi < 0.0f)
+        return;
+
+    if (!depth)
+    {
+        ContourCell(context, function, x, y);
+        return;
+    }
+
+    float    mid_x      = (x.lo + x.hi) / 2;
+    float    mid_y      = (y.lo + y.hi) / 2;
+    Interval halves_x[] = {{x.lo, mid_x}, {mid_x, x.hi}};
+    Interval halves_y[] = {{y.lo, mid_y}, {mid_y, y.hi}};
+    for (uint32_t i = 0; i < 4; ++i)
+        SubdivideImplicit(context, function, halves_x[i & 1], halves_y[i >> 1], depth - 1);
+}
+
+// Parsed functions are plotted by subdividing the plane with interval arithmetic, instead of tracing from a seed
+static void SampleImplicitFromComputationContext(FunctionPlotData *function, ComputationContext *context)
+{
+    const float    extent = 10.0f;
+    const uint32_t depth  = 8; // cells of 20 / 256 units
+
+    ClearVertices(&function->vertices);
+    SubdivideImplicit(context, function, (Interval){-extent, extent}, (Interval){-extent, extent}, depth);
+    function->updated = true;
+}
+
+// Takes context like Plot1DFromComputationContext
+static void ImplicitPlot2DFromComputationContext(Scene *scene, ComputationContext *context)
+{
+    FunctionPlotData *function = NewFunctionPlot(scene, IMPLICIT_2D);
+    function->context          = context;
+
+    SampleImplicitFromComputationContext(function, context);
+    function->color = (MVec3){1.0f, 0.0f, 1.0f};
+    function->batch = CreateNewBatch(LINES);
+    scene->plots.count++;
+}
+
+void ImplicitFunctionPlot2DFromComputationContext(MorphPlotDevice *device, ComputationContext *context)
+{
+    ImplicitPlot2DFromComputationContext(device->scene, context);
+}
+
+// Resamples the plots reading a definition replaced since they were last sampled, into the buffers they have. The
+// others keep their samples and their GPU buffers untouched. True when one of them plots fn.
+static bool RefreshPlots(Scene *scene, SymbolFn *fn)
+{
+    bool plotted = false;
+    for (uint32_t plot = 0; plot < scene->plots.count; ++plot)
+    {
+        FunctionPlotData *function = &scene->plots.functions[plot];
+        if (!function->context)
+            continue;
+
+        if (RefreshComputation(function->context) != COMPUTATION_UNCHANGED)
+        {
+            if (function->fn_type == IMPLICIT_2D)
+                SampleImplicitFromComputationContext(function, function->context);
+            else
+                Sample1DFromComputationContext(scene, function);
+        }
+        plotted = plotted || function->context->fn == fn;
+    }
+    return plotted;
+}
+
 double Square(double x)
 {
     return x * x;
@@ -2023,6 +3151,7 @@ void Draw(MorphPlotDevice *device, Mat4 *translate, Mat4 *scale, bool show_point
     Mat4 ntransform              = MatrixMultiply(translate, &nscalar);
 
     RenderGraph(device->graph, &graph_transform, Y, Y);
+    UpdatePlotSamples(device->scene);
     RenderScene(device->scene, device->program, false, device->transform, device->new_transform);
 
     RenderLabels(device->scene, device->font, device->graph, &outer_transform);
@@ -2130,80 +3259,89 @@ void MorphPhantomShow(MorphPlotDevice *device)
 
 static void DrawVector(VectorPlotData *plot, MVec2 pos, MVec2 dir)
 {
-    assert(plot->count + 6 < plot->max);
-
     // Normalize the direction first
-    float mag                     = sqrt(dir.x * dir.x + dir.y * dir.y);
-    MVec2 unit                    = (MVec2){.x = dir.x / mag, .y = dir.y / mag};
-    MVec2 norm                    = (MVec2){.x = -unit.y, .y = unit.x};
-
-    float t                       = 0.01f;
-
-    MVec2 end                     = {.x = pos.x + 0.5f * unit.x, .y = pos.y + 0.5f * unit.y};
-
-    plot->points[plot->count].x   = pos.x + t * norm.x;
-    plot->points[plot->count].y   = pos.y + t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
-
-    plot->points[plot->count].x   = pos.x - t * norm.x;
-    plot->points[plot->count].y   = pos.y - t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
-
-    plot->points[plot->count].x   = end.x + t * norm.x;
-    plot->points[plot->count].y   = end.y + t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
-
-    plot->points[plot->count].x   = pos.x - t * norm.x;
-    plot->points[plot->count].y   = pos.y - t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
-
-    plot->points[plot->count].x   = end.x + t * norm.x;
-    plot->points[plot->count].y   = end.y + t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
-
-    plot->points[plot->count].x   = end.x - t * norm.x;
-    plot->points[plot->count].y   = end.y - t * norm.y;
-    plot->points[plot->count].r   = 0.0f;
-    plot->points[plot->count].g   = 1.0f;
-    plot->points[plot->count++].b = 0.0f;
+    float mag  = sqrt(dir.x * dir.x + dir.y * dir.y);
+    MVec2 unit = (MVec2){.x = dir.x / mag, .y = dir.y / mag};
+    MVec2 norm = (MVec2){.x = -unit.y, .y = unit.x};
+
+    float t    = 0.01f;
+
+    MVec2 end  = {.x = pos.x + 0.5f * unit.x, .y = pos.y + 0.5f * unit.y};
+
+    // Two triangles along the shaft
+    MVec2       corners[] = {{pos.x + t * norm.x, pos.y + t * norm.y}, {pos.x - t * norm.x, pos.y - t * norm.y},
+                             {end.x + t * norm.x, end.y + t * norm.y}, {pos.x - t * norm.x, pos.y - t * norm.y},
+                             {end.x + t * norm.x, end.y + t * norm.y}, {end.x - t * norm.x, end.y - t * norm.y}};
+
+    VectorData *points    = PushVertices(&plot->points, 6);
+    for (uint32_t corner = 0; corner < 6; ++corner)
+        points[corner] = (VectorData){corners[corner].x, corners[corner].y, 0.0f, 1.0f, 0.0f};
 }
 
-void MorphPlotVectorField2D(MorphPlotDevice *device, VectorField2D field_2d, Range x, Range y)
+// Arrows on a grid of step 0.5 over x and y, the field is evaluated at all of its points at once when it is batched
+static void PlotVectorField(MorphPlotDevice *device, VectorField2D field, VectorFieldBatch2D batch, void *user, Range x,
+                            Range y)
 {
-    // On progress
-    // Unimplemented();
     // Every elements are rendered using lines, but we don't care much as how each line is rendered separately
-    // Allocate enough vector first
+    VectorPlotData *plot = &device->scene->fields.vector_fields[0];
+    plot->points.stride  = sizeof(VectorData);
+    ClearVertices(&plot->points);
+
+    float    step   = 0.5f;
+    uint32_t points = 0;
+    for (float u = x.min; u <= x.max; u += step)
+    {
+        for (float v = y.min; v <= y.max; v += step)
+            points++;
+    }
 
-    const uint32_t max_verts                      = 10000;
-    device->scene->fields.vector_fields[0].max    = max_verts; // 1000 vertices for each graph at most
-    device->scene->fields.vector_fields[0].points = malloc(sizeof(VectorData) * max_verts);
-    device->scene->fields.vector_fields[0].count  = 0;
-    assert(device->scene->fields.vector_fields[0].points);
+    double *xs      = malloc(sizeof(*xs) * points);
+    double *ys      = malloc(sizeof(*ys) * points);
+    MVec2  *vectors = malloc(sizeof(*vectors) * points);
+    assert((xs && ys && vectors) || !points);
 
-    float step = 0.5f;
+    uint32_t point = 0;
     for (float u = x.min; u <= x.max; u += step)
     {
         for (float v = y.min; v <= y.max; v += step)
         {
-            // Render a line with arrow facing the vector direction
-            // The array are supposed to be discontinuous too, so how should it be plotted?
-            DrawVector(&device->scene->fields.vector_fields[0], (MVec2){u, v}, (MVec2){u, v});
+            xs[point] = u;
+            ys[point] = v;
+            point++;
         }
     }
 
-    // DrawVector(&device->scene->fields.vector_fields[0], (MVec2){0.0f, 0.0f}, (MVec2){1.0f, 1.0f});
-    device->scene->fields.vector_fields[0].batch   = CreateNewBatch(GL_TRIANGLES);
-    device->scene->fields.vector_fields[0].updated = true;
-    device->scene->fields.count                    = 1;
+    if (batch)
+        batch(xs, ys, vectors, points, user);
+    else
+    {
+        for (point = 0; point < points; ++point)
+            vectors[point] = field(xs[point], ys[point]);
+    }
+
+    // Render a line with arrow facing the vector direction
+    for (point = 0; point < points; ++point)
+    {
+        // Zero vectors have no direction to point in
+        if (vectors[point].x != 0.0f || vectors[point].y != 0.0f)
+            DrawVector(plot, (MVec2){xs[point], ys[point]}, vectors[point]);
+    }
+    free(xs);
+    free(ys);
+    free(vectors);
+
+    if (!plot->batch)
+        plot->batch = CreateNewBatch(GL_TRIANGLES);
+    plot->updated               = true;
+    device->scene->fields.count = 1;
+}
+
+void MorphPlotVectorField2D(MorphPlotDevice *device, VectorField2D field_2d, Range x, Range y)
+{
+    PlotVectorField(device, field_2d, NULL, NULL, x, y);
+}
+
+void MorphPlotVectorField2DBatched(MorphPlotDevice *device, VectorFieldBatch2D field_2d, void *user, Range x, Range y)
+{
+    PlotVectorField(device, NULL, field_2d, user, x, y);
 }
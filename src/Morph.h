@@ -4,6 +4,8 @@
 // Ye .. this API will be called Morph -> Morphism now
 #include <GLFW/glfw3.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct Scene Scene;
 typedef struct Graph Graph;
@@ -12,6 +14,8 @@ typedef struct Mat4  Mat4;
 typedef struct State State;
 typedef struct Panel Panel;
 
+typedef struct ComputationContext ComputationContext;
+
 typedef struct
 {
     float x;
@@ -39,6 +43,34 @@ typedef double (*ImplicitFn2D)(double x, double y);
 typedef MVec2 (*VectorField2D)(double, double); // Parameteric representation of a vector field
 typedef MVec2 (*VectorField1D)(double);
 
+// Batched forms of the callbacks above, taking n points at once and handing user back untouched. A whole batch of
+// samples costs a single call, and hosts can pass state or closures from other languages through user.
+typedef void (*ParametricBatchFn1D)(const double *x, double *y, size_t n, void *user);
+typedef void (*ParametricBatchFn2D)(const double *t, MVec2 *points, size_t n, void *user);
+typedef void (*ImplicitBatchFn2D)(const double *x, const double *y, double *values, size_t n, void *user);
+typedef void (*VectorFieldBatch2D)(const double *x, const double *y, MVec2 *vectors, size_t n, void *user);
+
+// Value along with its partial derivatives in x and y, for implicit functions that carry their own gradient
+typedef struct MDual
+{
+    double value;
+    double dx;
+    double dy;
+} MDual;
+
+typedef MDual (*ImplicitDualFn2D)(MDual x, MDual y);
+
+// Piecewise Chebyshev approximation of a costly ParametricFn1D over a fixed domain, see chebyshev.c
+typedef struct MChebyshevProxy MChebyshevProxy;
+
+typedef struct MChebyshevProxyReport
+{
+    uint32_t pieces;
+    uint32_t coefficients; // over all pieces, what an evaluation walks is one piece's worth
+    uint32_t unresolved;   // pieces over poles or jumps, left at the finest subdivision
+    double   error;        // largest estimate of the converged pieces, relative to max(1, |f|)
+} MChebyshevProxyReport;
+
 typedef struct
 {
     unsigned int program, vao, vbo;
@@ -67,16 +99,68 @@ void            MorphShow(MorphPlotDevice *device);  // This call blocks
 void            MorphPhantomShow(MorphPlotDevice *); // This is non blocking
 void            MorphDestroyDevice(MorphPlotDevice *device);
 
+// Plots kept as given : the points of the list, or fn sampled every step from xinit to xend. There is no cap on how
+// many points they take.
 void   MorphPlotList(MorphPlotDevice *device, float *xpts, float *ypts, int length, MVec3 rgb, const char *cstronly);
 void   MorphPlotFunc(MorphPlotDevice *device, ParametricFn1D fn, MVec3 color, float xinit, float xend,
                      const char *cstronly, float step);
+void   MorphPlotFuncBatched(MorphPlotDevice *device, ParametricBatchFn1D fn, void *user, MVec3 color, float xinit,
+                            float xend, const char *cstronly, float step);
 void   MorphParametric2DPlot(Scene *scene, ParametricFn2D fn, float tInit, float tTerm, MVec3 rgb, const char *cstronly,
-                             float step);
+                             float step); // step is unused, samples are placed adaptively
+void   MorphParametric2DPlotBatched(Scene *scene, ParametricBatchFn2D fn, void *user, float tInit, float tTerm, MVec3 rgb,
+                                    const char *cstronly);
+
+// Curves are sampled for the view until they stray no more than tolerance pixels from their chords, keeping at most
+// budget samples per plot. Applies to the plots made after the call, the defaults are half a pixel and 4096.
+void   MorphSetSampling(MorphPlotDevice *device, float tolerance, uint32_t budget);
+// Plots made after the call cache up to samples values across views, the least recently used go first. Default 32768.
+void   MorphSetSampleCache(MorphPlotDevice *device, uint32_t samples);
+// Values the plot-th plot caches at level, those spaced 2^-level apart : along x for 1D plots, along the fraction of
+// their range for parametric ones. Level -20 also counts the coarser ones and level 43 the finer ones.
+uint32_t MorphCachedSamples(MorphPlotDevice *device, uint32_t plot, int32_t level);
+
+// Plot1D over a proxy of func built to tolerance : sampling and hit testing never call func again. func is called from
+// several threads while the proxy is built, so it must not keep state between calls.
+void   Plot1DProxy(Scene *scene, ParametricFn1D func, Graph *graph, MVec3 color, const char *legend, double tolerance);
+void   Plot1DBatched(Scene *scene, ParametricBatchFn1D func, void *user, Graph *graph, MVec3 color, const char *legend);
+void   Plot1DProxyBatched(Scene *scene, ParametricBatchFn1D func, void *user, Graph *graph, MVec3 color,
+                          const char *legend, double tolerance);
+
+// The callback is only called by create and refine
+MChebyshevProxy      *MorphCreateProxy(ParametricFn1D fn, double xinit, double xend, double tolerance);
+MChebyshevProxy      *MorphCreateProxyBatched(ParametricBatchFn1D fn, void *user, double xinit, double xend,
+                                              double tolerance);
+void                  MorphRefineProxy(MChebyshevProxy *proxy, double tolerance);
+double                MorphEvalProxy(const MChebyshevProxy *proxy, double x);
+// Writes up to max roots in increasing order, where the proxy changes sign, and returns their count
+uint32_t              MorphProxyRoots(const MChebyshevProxy *proxy, double *roots, uint32_t max);
+MChebyshevProxyReport MorphGetProxyReport(const MChebyshevProxy *proxy);
+void                  MorphDestroyProxy(MChebyshevProxy *proxy);
 
 double MorphTimeSinceCreation(MorphPlotDevice *device);
 void   MorphResetPlotting(MorphPlotDevice *device);
 bool   MorphShouldWindowClose(MorphPlotDevice *device);
 void   ImplicitFunctionPlot2D(MorphPlotDevice *device, ImplicitFn2D fn);
+void   ImplicitFunctionPlot2DDual(MorphPlotDevice *device, ImplicitDualFn2D fn); // Exact gradients, no differencing
+void   ImplicitFunctionPlot2DBatched(MorphPlotDevice *device, ImplicitBatchFn2D fn, void *user);
+// Contour f(x, y) = 0 of a function of two arguments parsed by the interpreter, see NewComputation. The plot owns
+// context and resamples it when a definition it reads is replaced.
+void   ImplicitFunctionPlot2DFromComputationContext(MorphPlotDevice *device, ComputationContext *context);
+
+// Arithmetic on dual numbers, to write an ImplicitDualFn2D
+MDual  MDualConstant(double value);
+MDual  MDualAdd(MDual a, MDual b);
+MDual  MDualSub(MDual a, MDual b);
+MDual  MDualMul(MDual a, MDual b);
+MDual  MDualDiv(MDual a, MDual b);
+MDual  MDualPow(MDual a, double n);
+MDual  MDualSin(MDual a);
+MDual  MDualCos(MDual a);
+MDual  MDualExp(MDual a);
+MDual  MDualLog(MDual a);
+MDual  MDualSqrt(MDual a);
 
 // On progress :
-void MorphPlotVectorField2D(MorphPlotDevice* device, VectorField2D field_2d, Range x, Range y); // Currently unimplemented
+void MorphPlotVectorField2D(MorphPlotDevice* device, VectorField2D field_2d, Range x, Range y); // Arrows on a grid of step 0.5
+void MorphPlotVectorField2DBatched(MorphPlotDevice *device, VectorFieldBatch2D field_2d, void *user, Range x, Range y);
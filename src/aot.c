@@ -0,0 +1,439 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _DEFAULT_SOURCE // mkdir, getpid and dlopen under -std=c11
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Ahead of time compilation
+// The fully inlined program of a function is written out as C, one local per register, and built by the system C
+// compiler into a shared object that is loaded with dlopen. The source only depends on the optimized expression :
+// globals are numbered in the order the program reads them and passed in by the caller, builtins are called by their
+// libm name or through a table indexed like the builtin library. So the same expression typed in another session gives
+// the same source, and the shared objects are cached on disk under a hash of it, next to the source they were built
+// from. The compiler only runs for expressions never seen before.
+//
+// Globals are read by the caller on every evaluation, once per batch, so redefined values show up without rebuilding.
+// Redefined functions need a new AotCompile, like they need a new JitCompile.
+
+#if !defined(_WIN32)
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define AOT_VERSION     "morph-aot-1" // part of every hash, bump when the generated source changes meaning
+#define AOT_MAX_GLOBALS 64            // read by a single function, gathered on the stack of each evaluation
+
+typedef double (*AotEntry)(double x, double y, const double *globals, const fn_ptr *fn, const fn2_ptr *fn2);
+typedef void (*AotBatchEntry)(const float *xs, const float *ys, float *out, size_t n, const double *globals,
+                              const fn_ptr *fn, const fn2_ptr *fn2);
+
+struct AotFunction
+{
+    void             *library;
+    AotEntry          entry;
+    AotBatchEntry     batch_entry;
+    SymbolTableStack *stack;
+    uint32_t          globals_count;
+    Binding           globals[AOT_MAX_GLOBALS]; // of the variables passed in, in the order the source numbers them
+    fn_ptr            fn[BUILTIN_COUNT];
+    fn2_ptr           fn2[BUILTIN_COUNT];
+};
+
+typedef struct Source
+{
+    char    *text;
+    uint32_t count;
+    uint32_t max;
+} Source;
+
+static void Append(Source *source, const char *format, ...)
+{
+    for (;;)
+    {
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(source->text + source->count, source->max - source->count, format, args);
+        va_end(args);
+        Assert(len >= 0);
+        if (source->count + (uint32_t)len < source->max)
+        {
+            source->count = source->count + (uint32_t)len;
+            return;
+        }
+        source->max  = source->max ? source->max * 2 : 4096;
+        source->text = realloc(source->text, source->max);
+        Assert(source->text != NULL);
+    }
+}
+
+// Builtins libm has under the same meaning, the others go through the table
+static const char *LibmName(uint32_t index)
+{
+    switch (index)
+    {
+    case BUILTIN_SIN:
+        return "sin";
+    case BUILTIN_COS:
+        return "cos";
+    case BUILTIN_TAN:
+        return "tan";
+    case BUILTIN_EXP:
+        return "exp";
+    case BUILTIN_SQRT:
+        return "sqrt";
+    case BUILTIN_LOG:
+        return "log";
+    case BUILTIN_ABS:
+        return "fabs";
+    case BUILTIN_FLOOR:
+        return "floor";
+    case BUILTIN_MIN:
+        return "fmin";
+    case BUILTIN_MAX:
+        return "fmax";
+    case BUILTIN_ATAN2:
+        return "atan2";
+    case BUILTIN_CBRT:
+        return "cbrt";
+    default:
+        return NULL;
+    }
+}
+
+static void AppendConstant(Source *source, float value)
+{
+    if (isnan(value))
+        Append(source, "NAN");
+    else if (isinf(value))
+        Append(source, value > 0 ? "INFINITY" : "-INFINITY");
+    else
+        Append(source, "%a", (double)value); // exact
+}
+
+// Index of the global at binding in the numbering of the source, false when there are too many of them
+static bool GlobalIndex(AotFunction *aot, Binding binding, uint32_t *index)
+{
+    for (*index = 0; *index < aot->globals_count; ++*index)
+    {
+        if (aot->globals[*index].depth == binding.depth && aot->globals[*index].slot == binding.slot)
+            return true;
+    }
+    if (aot->globals_count == AOT_MAX_GLOBALS)
+        return false;
+    aot->globals[aot->globals_count++] = binding;
+    return true;
+}
+
+// False when the program still calls user functions or reads too many globals
+static bool GenerateSource(Program *program, AotFunction *aot, Source *source)
+{
+    Append(source, "// Generated by Morph from an optimized expression, see aot.c\n"
+                   "#include <math.h>\n"
+                   "#include <stddef.h>\n\n"
+                   "typedef double (*fn_ptr)(double);\n"
+                   "typedef double (*fn2_ptr)(double, double);\n\n"
+                   "static inline double Eval(double x, double y, const double *g, const fn_ptr *fn, "
+                   "const fn2_ptr *fn2)\n{\n");
+
+    for (uint32_t pc = 0; pc < program->count; ++pc)
+    {
+        Instruction ins = program->code[pc];
+        Append(source, "    const double r%u = ", pc);
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+            AppendConstant(source, ins.value);
+            break;
+        case OPCODE_ARG:
+            // Arguments past the second are always 0 in the outermost frame
+            Append(source, ins.a == 0 ? "x" : ins.a == 1 ? "y" : "0.0");
+            break;
+        case OPCODE_LOAD:
+        {
+            uint32_t index;
+            if (!GlobalIndex(aot, (Binding){.depth = ins.a, .slot = ins.b}, &index))
+                return false;
+            Append(source, "g[%u]", index);
+            break;
+        }
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        {
+            static const char operators[] = {[OPCODE_ADD] = '+', [OPCODE_SUB] = '-', [OPCODE_MUL] = '*',
+                                             [OPCODE_DIV] = '/'};
+            Append(source, "r%u %c r%u", ins.a, operators[ins.opcode], ins.b);
+            break;
+        }
+        case OPCODE_BUILTIN:
+            if (LibmName(ins.b))
+                Append(source, "%s(r%u)", LibmName(ins.b), ins.a);
+            else
+                Append(source, "fn[%u](r%u)", ins.b, ins.a);
+            break;
+        case OPCODE_BUILTIN2:
+            if (LibmName(ins.c))
+                Append(source, "%s(r%u, r%u)", LibmName(ins.c), ins.a, ins.b);
+            else
+                Append(source, "fn2[%u](r%u, r%u)", ins.c, ins.a, ins.b);
+            break;
+        default:
+            return false;
+        }
+        Append(source, ";\n");
+    }
+
+    Append(source,
+           "    return r%u;\n}\n\n"
+           "double morph_eval(double x, double y, const double *g, const fn_ptr *fn, const fn2_ptr *fn2)\n{\n"
+           "    return Eval(x, y, g, fn, fn2);\n}\n\n"
+           "void morph_eval_batch(const float *xs, const float *ys, float *out, size_t n, const double *g,\n"
+           "                      const fn_ptr *fn, const fn2_ptr *fn2)\n{\n"
+           "    for (size_t i = 0; i < n; ++i)\n"
+           "        out[i] = (float)Eval(xs[i], ys ? ys[i] : 0.0, g, fn, fn2);\n}\n",
+           program->count - 1);
+    return true;
+}
+
+// FNV-1a, the key of the cache
+static uint64_t HashString(uint64_t hash, const char *str)
+{
+    for (; *str; ++str)
+        hash = (hash ^ (uint8_t)*str) * 0x100000001B3ull;
+    return hash;
+}
+
+void SetAotCache(Interpreter *interpreter, const char *directory)
+{
+    free(interpreter->aot_cache);
+    interpreter->aot_cache = NULL;
+    if (directory)
+    {
+        size_t len             = strlen(directory);
+        interpreter->aot_cache = malloc(len + 1);
+        Assert(interpreter->aot_cache != NULL);
+        memcpy(interpreter->aot_cache, directory, len + 1);
+    }
+}
+
+#if !defined(_WIN32)
+
+static const char *Compiler(void)
+{
+    const char *cc = getenv("MORPH_CC");
+    return cc && *cc ? cc : "cc";
+}
+
+// Whatever is loaded from the cache runs in this process, so anyone else able to write there could run code in it. The
+// cache and the objects in it must belong to the user and be writable by no one else, and are never followed through a
+// symbolic link : a /tmp/morph-<uid> made by someone else first turns the cache off rather than being used.
+static bool IsOwnedByUser(const char *path, bool directory)
+{
+    struct stat status;
+    if (lstat(path, &status))
+        return false;
+    if (directory ? !S_ISDIR(status.st_mode) : !S_ISREG(status.st_mode))
+        return false;
+    return status.st_uid == getuid() && !(status.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// Directory set on the interpreter, else MORPH_AOT_CACHE, else the cache directory of the user
+static bool CacheDirectory(Interpreter *interpreter, char *path, size_t size)
+{
+    const char *xdg  = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    const char *env  = getenv("MORPH_AOT_CACHE");
+    int         len;
+
+    if (interpreter->aot_cache)
+        len = snprintf(path, size, "%s", interpreter->aot_cache);
+    else if (env && *env)
+        len = snprintf(path, size, "%s", env);
+    else if (xdg && *xdg)
+        len = snprintf(path, size, "%s/morph", xdg);
+    else if (home && *home)
+        len = snprintf(path, size, "%s/.cache/morph", home);
+    else
+        len = snprintf(path, size, "/tmp/morph-%u", (unsigned)getuid());
+    // Paths are quoted for the shell
+    if (len <= 0 || (size_t)len >= size || strchr(path, '\''))
+        return false;
+
+    // mkdir -p, private to the user
+    for (char *slash = path + 1;; ++slash)
+    {
+        if (*slash != '/' && *slash)
+            continue;
+        char end = *slash;
+        *slash   = '\0';
+        mkdir(path, 0700);
+        *slash = end;
+        if (!end)
+            break;
+    }
+    return IsOwnedByUser(path, true);
+}
+
+static bool FileEquals(const char *path, const Source *source)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    char  *contents = malloc(source->count + 1);
+    size_t len      = contents ? fread(contents, 1, source->count + 1, file) : 0;
+    bool   equal    = len == source->count && !memcmp(contents, source->text, len);
+    free(contents);
+    fclose(file);
+    return equal;
+}
+
+// Builds the shared object of source under base.so, through files private to this process that are renamed into place
+// once complete, so that sessions sharing the cache never load a half written object
+static bool Build(const char *base, const Source *source)
+{
+    char     source_path[1024], object_path[1024], final_source[1024], final_object[1024], command[4096];
+    unsigned pid = (unsigned)getpid();
+    snprintf(source_path, sizeof(source_path), "%s.%u.c", base, pid);
+    snprintf(object_path, sizeof(object_path), "%s.%u.so", base, pid);
+    snprintf(final_source, sizeof(final_source), "%s.c", base);
+    snprintf(final_object, sizeof(final_object), "%s.so", base);
+
+    FILE *file = fopen(source_path, "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(source->text, 1, source->count, file) == source->count;
+    if (fclose(file) || !written)
+    {
+        remove(source_path);
+        return false;
+    }
+
+    snprintf(command, sizeof(command), "%s -O2 -shared -fPIC -o '%s' '%s' -lm", Compiler(), object_path, source_path);
+    // Modes don't depend on the umask, the object wouldn't be trusted if the group could write it
+    bool built = !system(command) && !chmod(object_path, 0700) && !chmod(source_path, 0600) &&
+                 !rename(object_path, final_object) && !rename(source_path, final_source);
+    if (!built)
+    {
+        fprintf(stderr, "Error : Failed to build %s with %s.\n", final_object, Compiler());
+        remove(object_path);
+        remove(source_path);
+    }
+    return built;
+}
+
+static void *OpenLibrary(const char *base, AotEntry *entry, AotBatchEntry *batch_entry)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.so", base);
+    if (!IsOwnedByUser(path, false))
+        return NULL;
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!library)
+        return NULL;
+
+    // Function pointers out of the void * of dlsym, as POSIX allows
+    *(void **)entry       = dlsym(library, "morph_eval");
+    *(void **)batch_entry = dlsym(library, "morph_eval_batch");
+    if (!*entry || !*batch_entry)
+    {
+        dlclose(library);
+        return NULL;
+    }
+    return library;
+}
+
+#endif
+
+AotFunction *AotCompile(ComputationContext *context)
+{
+    Assert(context != NULL);
+#if defined(_WIN32)
+    // No dlopen, and no C compiler to count on
+    return NULL;
+#else
+    AotFunction *aot = malloc(sizeof(*aot));
+    Assert(aot != NULL);
+    memset(aot, 0, sizeof(*aot));
+    aot->stack = &context->fn->interpreter->stack;
+    for (uint32_t index = 0; index < BUILTIN_COUNT; ++index)
+    {
+        aot->fn[index]  = builtins.functions[index].fn;
+        aot->fn2[index] = builtins.functions[index].fn2;
+    }
+
+    // Every call is inlined, nothing is left for the tree walker
+    Source   source    = {0};
+    Program *program   = CompileSymbolFnWithBudget(context->fn, UINT32_MAX);
+    bool     generated = GenerateSource(program, aot, &source);
+    DestroyProgram(program);
+
+    char directory[768], base[900];
+    if (!generated || !CacheDirectory(context->fn->interpreter, directory, sizeof(directory)))
+    {
+        free(source.text);
+        free(aot);
+        return NULL;
+    }
+
+    uint64_t hash = HashString(HashString(HashString(0xCBF29CE484222325ull, AOT_VERSION), Compiler()), source.text);
+    snprintf(base, sizeof(base), "%s/%016llx", directory, (unsigned long long)hash);
+
+    // A cached object is only trusted next to the very source it was built from
+    char source_path[1024];
+    snprintf(source_path, sizeof(source_path), "%s.c", base);
+    if (FileEquals(source_path, &source))
+        aot->library = OpenLibrary(base, &aot->entry, &aot->batch_entry);
+    if (!aot->library && Build(base, &source))
+        aot->library = OpenLibrary(base, &aot->entry, &aot->batch_entry);
+
+    free(source.text);
+    if (!aot->library)
+    {
+        free(aot);
+        return NULL;
+    }
+    return aot;
+#endif
+}
+
+static void GatherGlobals(AotFunction *aot, double *globals)
+{
+    for (uint32_t index = 0; index < aot->globals_count; ++index)
+    {
+        Binding binding = aot->globals[index];
+        globals[index]  = aot->stack->symbol_tables[binding.depth]->variables[binding.slot].data.value;
+    }
+}
+
+double AotEval(AotFunction *aot, double x, double y)
+{
+    double globals[AOT_MAX_GLOBALS];
+    GatherGlobals(aot, globals);
+    return aot->entry(x, y, globals, aot->fn, aot->fn2);
+}
+
+void AotEvalBatch(AotFunction *aot, const float *xs, const float *ys, float *out, size_t n)
+{
+    double globals[AOT_MAX_GLOBALS];
+    GatherGlobals(aot, globals);
+    aot->batch_entry(xs, ys, out, n, globals, aot->fn, aot->fn2);
+}
+
+void AotDestroy(AotFunction *aot)
+{
+    if (!aot)
+        return;
+#if !defined(_WIN32)
+    dlclose(aot->library);
+#endif
+    free(aot);
+}
@@ -0,0 +1,403 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Batch interpreter
+// Runs a compiled program over BATCH_LANES samples at once. Each instruction becomes one call to a kernel that sweeps
+// a whole row of registers, so the dispatch cost is paid once per block instead of once per sample. The kernels are
+// picked once at runtime from the instruction sets the cpu supports.
+
+typedef void (*BinaryKernel)(float *out, const float *a, const float *b);
+typedef void (*UnaryKernel)(float *out, const float *a);
+
+typedef struct BatchKernels
+{
+    const char  *name;
+    BinaryKernel add, sub, mul, div;
+    UnaryKernel  sin, cos, tan, exp, sqrt, log, abs, floor;
+    BinaryKernel min, max, pow, atan2, mod;
+} BatchKernels;
+
+// Scalar kernels, used where no vector instruction set is available
+
+static void AddScalar(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; ++i)
+        out[i] = a[i] + b[i];
+}
+
+static void SubScalar(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; ++i)
+        out[i] = a[i] - b[i];
+}
+
+static void MulScalar(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; ++i)
+        out[i] = a[i] * b[i];
+}
+
+static void DivScalar(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; ++i)
+        out[i] = a[i] / b[i];
+}
+
+#define SCALAR_UNARY_KERNEL(name, fn)                                                                                  \
+    static void name(float *out, const float *a)                                                                       \
+    {                                                                                                                  \
+        for (uint32_t i = 0; i < BATCH_LANES; ++i)                                                                     \
+            out[i] = fn(a[i]);                                                                                         \
+    }
+
+SCALAR_UNARY_KERNEL(SinScalar, sinf)
+SCALAR_UNARY_KERNEL(CosScalar, cosf)
+SCALAR_UNARY_KERNEL(TanScalar, tanf)
+SCALAR_UNARY_KERNEL(ExpScalar, expf)
+SCALAR_UNARY_KERNEL(SqrtScalar, sqrtf)
+SCALAR_UNARY_KERNEL(LogScalar, logf)
+SCALAR_UNARY_KERNEL(AbsScalar, fabsf)
+SCALAR_UNARY_KERNEL(FloorScalar, floorf)
+
+#define SCALAR_BINARY_KERNEL(name, fn)                                                                                 \
+    static void name(float *out, const float *a, const float *b)                                                       \
+    {                                                                                                                  \
+        for (uint32_t i = 0; i < BATCH_LANES; ++i)                                                                     \
+            out[i] = fn(a[i], b[i]);                                                                                   \
+    }
+
+static float FlooredModf(float a, float b)
+{
+    return a - b * floorf(a / b);
+}
+
+SCALAR_BINARY_KERNEL(MinScalar, fminf)
+SCALAR_BINARY_KERNEL(MaxScalar, fmaxf)
+SCALAR_BINARY_KERNEL(PowScalar, (float)Power)
+SCALAR_BINARY_KERNEL(Atan2Scalar, atan2f)
+SCALAR_BINARY_KERNEL(ModScalar, FlooredModf)
+
+static const BatchKernels scalar_kernels = {
+    "scalar",   AddScalar, SubScalar, MulScalar,   DivScalar, SinScalar, CosScalar, TanScalar,   ExpScalar,
+    SqrtScalar, LogScalar, AbsScalar, FloorScalar, MinScalar, MaxScalar, PowScalar, Atan2Scalar, ModScalar};
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BATCH_X86
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// SSE2
+#define KERNEL(name) name##SSE2
+#define KERNEL_ATTR
+#define V __m128
+#define VI __m128i
+#define V_WIDTH 4
+#define V_SET1 _mm_set1_ps
+#define V_LOAD _mm_loadu_ps
+#define V_STORE _mm_storeu_ps
+#define V_ADD _mm_add_ps
+#define V_SUB _mm_sub_ps
+#define V_MUL _mm_mul_ps
+#define V_DIV _mm_div_ps
+#define V_SQRT _mm_sqrt_ps
+#define V_MIN _mm_min_ps
+#define V_MAX _mm_max_ps
+#define V_AND _mm_and_ps
+#define V_ANDNOT _mm_andnot_ps
+#define V_OR _mm_or_ps
+#define V_XOR _mm_xor_ps
+#define V_CMPLT _mm_cmplt_ps
+#define V_CMPGT _mm_cmpgt_ps
+#define V_CMPEQ _mm_cmpeq_ps
+#define V_CMPUNORD _mm_cmpunord_ps
+#define V_MOVEMASK _mm_movemask_ps
+#define V_TOI _mm_cvttps_epi32
+#define V_CAST _mm_castsi128_ps
+#define VI_SET1 _mm_set1_epi32
+#define VI_TOF _mm_cvtepi32_ps
+#define VI_CAST _mm_castps_si128
+#define VI_ADD _mm_add_epi32
+#define VI_SUB _mm_sub_epi32
+#define VI_AND _mm_and_si128
+#define VI_ANDNOT _mm_andnot_si128
+#define VI_SLLI _mm_slli_epi32
+#define VI_SRLI _mm_srli_epi32
+#define VI_CMPEQ _mm_cmpeq_epi32
+
+#include "./batch_kernels.h"
+
+#undef KERNEL
+#undef KERNEL_ATTR
+#undef V
+#undef VI
+#undef V_WIDTH
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_SQRT
+#undef V_MIN
+#undef V_MAX
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_XOR
+#undef V_CMPLT
+#undef V_CMPGT
+#undef V_CMPEQ
+#undef V_CMPUNORD
+#undef V_MOVEMASK
+#undef V_TOI
+#undef V_CAST
+#undef VI_SET1
+#undef VI_TOF
+#undef VI_CAST
+#undef VI_ADD
+#undef VI_SUB
+#undef VI_AND
+#undef VI_ANDNOT
+#undef VI_SLLI
+#undef VI_SRLI
+#undef VI_CMPEQ
+
+// AVX2, compiled for the instruction set regardless of the flags of the rest of the build and only called when the cpu
+// reports it
+#define KERNEL(name) name##AVX2
+#if defined(_MSC_VER)
+#define KERNEL_ATTR
+#else
+#define KERNEL_ATTR __attribute__((target("avx2")))
+#endif
+#define V __m256
+#define VI __m256i
+#define V_WIDTH 8
+#define V_SET1 _mm256_set1_ps
+#define V_LOAD _mm256_loadu_ps
+#define V_STORE _mm256_storeu_ps
+#define V_ADD _mm256_add_ps
+#define V_SUB _mm256_sub_ps
+#define V_MUL _mm256_mul_ps
+#define V_DIV _mm256_div_ps
+#define V_SQRT _mm256_sqrt_ps
+#define V_MIN _mm256_min_ps
+#define V_MAX _mm256_max_ps
+#define V_AND _mm256_and_ps
+#define V_ANDNOT _mm256_andnot_ps
+#define V_OR _mm256_or_ps
+#define V_XOR _mm256_xor_ps
+#define V_CMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V_CMPGT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define V_CMPEQ(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define V_CMPUNORD(a, b) _mm256_cmp_ps(a, b, _CMP_UNORD_Q)
+#define V_MOVEMASK _mm256_movemask_ps
+#define V_TOI _mm256_cvttps_epi32
+#define V_CAST _mm256_castsi256_ps
+#define VI_SET1 _mm256_set1_epi32
+#define VI_TOF _mm256_cvtepi32_ps
+#define VI_CAST _mm256_castps_si256
+#define VI_ADD _mm256_add_epi32
+#define VI_SUB _mm256_sub_epi32
+#define VI_AND _mm256_and_si256
+#define VI_ANDNOT _mm256_andnot_si256
+#define VI_SLLI _mm256_slli_epi32
+#define VI_SRLI _mm256_srli_epi32
+#define VI_CMPEQ _mm256_cmpeq_epi32
+
+#include "./batch_kernels.h"
+
+#undef KERNEL
+#undef KERNEL_ATTR
+#undef V
+#undef VI
+#undef V_WIDTH
+#undef V_SET1
+#undef V_LOAD
+#undef V_STORE
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_SQRT
+#undef V_MIN
+#undef V_MAX
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_XOR
+#undef V_CMPLT
+#undef V_CMPGT
+#undef V_CMPEQ
+#undef V_CMPUNORD
+#undef V_MOVEMASK
+#undef V_TOI
+#undef V_CAST
+#undef VI_SET1
+#undef VI_TOF
+#undef VI_CAST
+#undef VI_ADD
+#undef VI_SUB
+#undef VI_AND
+#undef VI_ANDNOT
+#undef VI_SLLI
+#undef VI_SRLI
+#undef VI_CMPEQ
+
+static const BatchKernels sse2_kernels = {
+    "sse2",   AddSSE2, SubSSE2, MulSSE2,   DivSSE2, SinSSE2, CosSSE2, TanSSE2,   ExpSSE2,
+    SqrtSSE2, LogSSE2, AbsSSE2, FloorSSE2, MinSSE2, MaxSSE2, PowSSE2, Atan2SSE2, ModSSE2};
+static const BatchKernels avx2_kernels = {
+    "avx2",   AddAVX2, SubAVX2, MulAVX2,   DivAVX2, SinAVX2, CosAVX2, TanAVX2,   ExpAVX2,
+    SqrtAVX2, LogAVX2, AbsAVX2, FloorAVX2, MinAVX2, MaxAVX2, PowAVX2, Atan2AVX2, ModAVX2};
+
+static bool CpuSupportsAVX2(void)
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The os has to save the ymm registers too
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Picked by InitInterpreter before any thread evaluates, read-only afterwards. The kernels of the fast tier are indexed
+// by BuiltinIndex, builtins without one always run through the accurate batch entry of the registry.
+static const BatchKernels *batch_kernels = NULL;
+static UnaryKernel         fast_unary[BUILTIN_COUNT];
+static BinaryKernel        fast_binary[BUILTIN_COUNT];
+
+static const BatchKernels *SelectBatchKernels(void)
+{
+    if (batch_kernels)
+        return batch_kernels;
+
+    const BatchKernels *kernels = &scalar_kernels;
+#if defined(BATCH_X86)
+    kernels = CpuSupportsAVX2() ? &avx2_kernels : &sse2_kernels;
+#endif
+
+    fast_unary[BUILTIN_SIN]    = kernels->sin;
+    fast_unary[BUILTIN_COS]    = kernels->cos;
+    fast_unary[BUILTIN_TAN]    = kernels->tan;
+    fast_unary[BUILTIN_EXP]    = kernels->exp;
+    fast_unary[BUILTIN_SQRT]   = kernels->sqrt;
+    fast_unary[BUILTIN_LOG]    = kernels->log;
+    fast_unary[BUILTIN_ABS]    = kernels->abs;
+    fast_unary[BUILTIN_FLOOR]  = kernels->floor;
+    fast_binary[BUILTIN_MIN]   = kernels->min;
+    fast_binary[BUILTIN_MAX]   = kernels->max;
+    fast_binary[BUILTIN_POW]   = kernels->pow;
+    fast_binary[BUILTIN_ATAN2] = kernels->atan2;
+    fast_binary[BUILTIN_MOD]   = kernels->mod;
+    batch_kernels              = kernels;
+    return kernels;
+}
+
+const char *BatchInstructionSet(void)
+{
+    return SelectBatchKernels()->name;
+}
+
+static void Broadcast(float *out, float value)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; ++i)
+        out[i] = value;
+}
+
+// xs and ys hold BATCH_LANES samples each, registers must hold program->count rows of BATCH_LANES values.
+// Instructions before first are skipped, their rows must be filled already. Returns the row of the last instruction.
+float *ExecuteProgramBatch(Program *program, FrameStack *frames, float *registers, uint32_t first, const float *xs,
+                           const float *ys)
+{
+    const BatchKernels *kernels = SelectBatchKernels();
+    const Instruction  *code    = program->code;
+    const uint32_t      count   = program->count;
+    const bool          fast    = program->accuracy == BUILTIN_FAST;
+
+    for (uint32_t pc = first; pc < count; ++pc)
+    {
+        const Instruction ins = code[pc];
+        float            *r   = registers + pc * BATCH_LANES;
+        const float      *ra  = registers + ins.a * BATCH_LANES;
+        const float      *rb  = registers + ins.b * BATCH_LANES;
+
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+            Broadcast(r, ins.value);
+            break;
+        case OPCODE_ARG:
+            if (ins.a < 2)
+                memcpy(r, ins.a ? ys : xs, sizeof(*r) * BATCH_LANES);
+            else
+                Broadcast(r, frames->values[frames->base + ins.a]);
+            break;
+        case OPCODE_LOAD:
+            Broadcast(r, program->stack->symbol_tables[ins.a]->variables[ins.b].data.value);
+            break;
+        case OPCODE_ADD:
+            kernels->add(r, ra, rb);
+            break;
+        case OPCODE_SUB:
+            kernels->sub(r, ra, rb);
+            break;
+        case OPCODE_MUL:
+            kernels->mul(r, ra, rb);
+            break;
+        case OPCODE_DIV:
+            kernels->div(r, ra, rb);
+            break;
+        case OPCODE_BUILTIN:
+            if (fast && fast_unary[ins.b])
+                fast_unary[ins.b](r, ra);
+            else
+                builtins.functions[ins.b].batch(r, ra);
+            break;
+        case OPCODE_BUILTIN2:
+            if (fast && fast_binary[ins.c])
+                fast_binary[ins.c](r, ra, rb);
+            else
+                builtins.functions[ins.c].batch2(r, ra, rb);
+            break;
+        case OPCODE_CALL:
+            // User functions are still walked as trees, one sample at a time
+            for (uint32_t lane = 0; lane < BATCH_LANES; ++lane)
+            {
+                frames->values[frames->base]     = xs[lane];
+                frames->values[frames->base + 1] = ys[lane];
+                r[lane] = FunctionApplication(program->stack, frames, program->calls[ins.a]);
+            }
+            break;
+        default:
+            Unreachable();
+        }
+    }
+    return registers + (count - 1) * BATCH_LANES;
+}
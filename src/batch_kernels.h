@@ -0,0 +1,342 @@
+// Vector kernels used by the batch interpreter, written once against the macros below and instantiated by batch.c for
+// each instruction set. Every kernel processes exactly BATCH_LANES floats.
+//
+// The instantiating file defines :
+//   KERNEL(name)      name of the kernel for this instruction set
+//   KERNEL_ATTR       function attributes that enable the instruction set
+//   V, VI, V_WIDTH    float vector, int32 vector and lanes per vector
+//   and the V_* / VI_* operations used below.
+//
+// sin, cos, exp, log and atan2 follow the Cephes single precision approximations, accurate to a couple of ulp for the
+// ranges a plot samples. Arguments of sin and cos beyond a few thousand lose precision in the range reduction, and
+// beyond about 1e9, where the octant overflows an int32, they return nan.
+// pow is exp(b * log(a)), its relative error grows with |b * log(a)| to about 1e-5 near the float range.
+// Otherwise every kernel returns nan, inf and zero where libm does, including for overflow, underflow and denormals.
+
+static KERNEL_ATTR void KERNEL(Add)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_ADD(V_LOAD(a + i), V_LOAD(b + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Sub)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_SUB(V_LOAD(a + i), V_LOAD(b + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Mul)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_MUL(V_LOAD(a + i), V_LOAD(b + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Div)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_DIV(V_LOAD(a + i), V_LOAD(b + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Sqrt)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_SQRT(V_LOAD(a + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Abs)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, V_ANDNOT(V_CAST(VI_SET1((int32_t)0x80000000)), V_LOAD(a + i)));
+}
+
+// Floats of 2^23 and above are integers already, as are nan and inf which the conversion can't represent
+static KERNEL_ATTR V KERNEL(FloorV)(V x)
+{
+    V t     = VI_TOF(V_TOI(x));
+    t       = V_SUB(t, V_AND(V_CMPGT(t, x), V_SET1(1.0f)));
+    V small = V_CMPLT(V_AND(x, V_CAST(VI_SET1(0x7fffffff))), V_SET1(8388608.0f));
+    return V_OR(V_AND(small, t), V_ANDNOT(small, x));
+}
+
+static KERNEL_ATTR void KERNEL(Floor)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, KERNEL(FloorV)(V_LOAD(a + i)));
+}
+
+// The instructions return b when either operand is nan, fmin and fmax return the other operand, so a nan b is replaced
+static KERNEL_ATTR void KERNEL(Min)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V x   = V_LOAD(a + i);
+        V y   = V_LOAD(b + i);
+        V nan = V_CMPUNORD(y, y);
+        V_STORE(out + i, V_OR(V_AND(nan, x), V_ANDNOT(nan, V_MIN(x, y))));
+    }
+}
+
+static KERNEL_ATTR void KERNEL(Max)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V x   = V_LOAD(a + i);
+        V y   = V_LOAD(b + i);
+        V nan = V_CMPUNORD(y, y);
+        V_STORE(out + i, V_OR(V_AND(nan, x), V_ANDNOT(nan, V_MAX(x, y))));
+    }
+}
+
+// Same as fmodf for operands of the same sign, otherwise the result takes the sign of b. A quotient rounded up to the
+// next integer leaves a remainder of the wrong sign, which is moved back by one b.
+static KERNEL_ATTR void KERNEL(Mod)(float *out, const float *a, const float *b)
+{
+    const V sign_mask = V_CAST(VI_SET1((int32_t)0x80000000));
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V x     = V_LOAD(a + i);
+        V y     = V_LOAD(b + i);
+        V r     = V_SUB(x, V_MUL(y, KERNEL(FloorV)(V_DIV(x, y))));
+        V wrong = V_CMPLT(V_XOR(r, V_AND(sign_mask, y)), V_SET1(0.0f));
+        V_STORE(out + i, V_ADD(r, V_AND(wrong, y)));
+    }
+}
+
+// Both polynomials are evaluated for x reduced to [-pi/4, pi/4], the octant picks one of them and the sign
+static KERNEL_ATTR V KERNEL(SinCosPoly)(V x, V poly_mask)
+{
+    V z  = V_MUL(x, x);
+
+    V yc = V_SET1(2.443315711809948E-005f);
+    yc   = V_ADD(V_MUL(yc, z), V_SET1(-1.388731625493765E-003f));
+    yc   = V_ADD(V_MUL(yc, z), V_SET1(4.166664568298827E-002f));
+    yc   = V_MUL(V_MUL(yc, z), z);
+    yc   = V_SUB(yc, V_MUL(z, V_SET1(0.5f)));
+    yc   = V_ADD(yc, V_SET1(1.0f));
+
+    V ys = V_SET1(-1.9515295891E-4f);
+    ys   = V_ADD(V_MUL(ys, z), V_SET1(8.3321608736E-3f));
+    ys   = V_ADD(V_MUL(ys, z), V_SET1(-1.6666654611E-1f));
+    ys   = V_ADD(V_MUL(V_MUL(ys, z), x), x);
+
+    return V_OR(V_AND(poly_mask, ys), V_ANDNOT(poly_mask, yc));
+}
+
+// Reduces |x| by multiples of pi/4, j receives the octant rounded up to even
+static KERNEL_ATTR V KERNEL(ReduceQuadrant)(V x, VI *j)
+{
+    V  y = V_MUL(x, V_SET1(1.27323954473516f)); // 4 / pi
+    VI q = V_TOI(y);
+    q    = VI_AND(VI_ADD(q, VI_SET1(1)), VI_SET1(~1));
+    y    = VI_TOF(q);
+    *j   = q;
+
+    // Extended precision modular arithmetic
+    x    = V_ADD(x, V_MUL(y, V_SET1(-0.78515625f)));
+    x    = V_ADD(x, V_MUL(y, V_SET1(-2.4187564849853515625e-4f)));
+    x    = V_ADD(x, V_MUL(y, V_SET1(-3.77489497744594108e-8f)));
+    return x;
+}
+
+static KERNEL_ATTR V KERNEL(SinV)(V x)
+{
+    VI j;
+    V  sign_bit  = V_AND(x, V_CAST(VI_SET1((int32_t)0x80000000)));
+    x            = V_AND(x, V_CAST(VI_SET1(0x7fffffff)));
+    x            = KERNEL(ReduceQuadrant)(x, &j);
+
+    V  swap_sign = V_CAST(VI_SLLI(VI_AND(j, VI_SET1(4)), 29));
+    V  poly_mask = V_CAST(VI_CMPEQ(VI_AND(j, VI_SET1(2)), VI_SET1(0)));
+    sign_bit     = V_XOR(sign_bit, swap_sign);
+    return V_XOR(KERNEL(SinCosPoly)(x, poly_mask), sign_bit);
+}
+
+static KERNEL_ATTR V KERNEL(CosV)(V x)
+{
+    VI j;
+    x            = V_AND(x, V_CAST(VI_SET1(0x7fffffff)));
+    x            = KERNEL(ReduceQuadrant)(x, &j);
+    j            = VI_SUB(j, VI_SET1(2));
+
+    V  sign_bit  = V_CAST(VI_SLLI(VI_ANDNOT(j, VI_SET1(4)), 29));
+    V  poly_mask = V_CAST(VI_CMPEQ(VI_AND(j, VI_SET1(2)), VI_SET1(0)));
+    return V_XOR(KERNEL(SinCosPoly)(x, poly_mask), sign_bit);
+}
+
+// The clamp keeps n within [-150, 128], where 2^n is applied in two halves so that results past the float range
+// overflow to inf and those below it round to denormals or zero, as expf does. The clamp would turn nan finite.
+static KERNEL_ATTR V KERNEL(ExpV)(V x)
+{
+    V nan = V_CMPUNORD(x, x);
+    x     = V_MIN(x, V_SET1(89.0f));
+    x     = V_MAX(x, V_SET1(-104.0f));
+
+    // exp(x) = 2^n * exp(r), n = round(x / log(2))
+    V fx = V_ADD(V_MUL(x, V_SET1(1.44269504088896341f)), V_SET1(0.5f));
+    V n  = VI_TOF(V_TOI(fx));
+    n    = V_SUB(n, V_AND(V_CMPGT(n, fx), V_SET1(1.0f))); // floor
+
+    x    = V_SUB(x, V_MUL(n, V_SET1(0.693359375f)));
+    x    = V_SUB(x, V_MUL(n, V_SET1(-2.12194440e-4f)));
+    V z  = V_MUL(x, x);
+
+    V y  = V_SET1(1.9875691500E-4f);
+    y    = V_ADD(V_MUL(y, x), V_SET1(1.3981999507E-3f));
+    y    = V_ADD(V_MUL(y, x), V_SET1(8.3334519073E-3f));
+    y    = V_ADD(V_MUL(y, x), V_SET1(4.1665795894E-2f));
+    y    = V_ADD(V_MUL(y, x), V_SET1(1.6666665459E-1f));
+    y    = V_ADD(V_MUL(y, x), V_SET1(5.0000001201E-1f));
+    y    = V_ADD(V_ADD(V_MUL(y, z), x), V_SET1(1.0f));
+
+    VI n1 = V_TOI(V_MUL(n, V_SET1(0.5f)));
+    VI n2 = VI_SUB(V_TOI(n), n1);
+    y     = V_MUL(y, V_CAST(VI_SLLI(VI_ADD(n1, VI_SET1(0x7f)), 23)));
+    y     = V_MUL(y, V_CAST(VI_SLLI(VI_ADD(n2, VI_SET1(0x7f)), 23)));
+    return V_OR(y, nan);
+}
+
+static KERNEL_ATTR V KERNEL(LogV)(V x)
+{
+    V  invalid = V_OR(V_CMPLT(x, V_SET1(0.0f)), V_CMPUNORD(x, x));
+    V  zero    = V_CMPEQ(x, V_SET1(0.0f));
+    V  inf     = V_CMPEQ(x, V_SET1(INFINITY));
+
+    // Denormals are scaled by 2^23 into the normal range first
+    V  tiny    = V_CMPLT(x, V_CAST(VI_SET1(0x00800000))); // smallest normal
+    x          = V_OR(V_AND(tiny, V_MUL(x, V_SET1(8388608.0f))), V_ANDNOT(tiny, x));
+
+    // x = m * 2^e with m in [0.5, 1)
+    VI expo    = VI_SUB(VI_SRLI(VI_CAST(x), 23), VI_SET1(0x7f));
+    x          = V_AND(x, V_CAST(VI_SET1(~0x7f800000)));
+    x          = V_OR(x, V_SET1(0.5f));
+    V e        = V_ADD(VI_TOF(expo), V_SUB(V_SET1(1.0f), V_AND(tiny, V_SET1(23.0f))));
+
+    V mask     = V_CMPLT(x, V_SET1(0.707106781186547524f));
+    V tmp      = V_AND(x, mask);
+    x          = V_SUB(x, V_SET1(1.0f));
+    e          = V_SUB(e, V_AND(V_SET1(1.0f), mask));
+    x          = V_ADD(x, tmp);
+    V z        = V_MUL(x, x);
+
+    V y        = V_SET1(7.0376836292E-2f);
+    y          = V_ADD(V_MUL(y, x), V_SET1(-1.1514610310E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(1.1676998740E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(-1.2420140846E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(1.4249322787E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(-1.6668057665E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(2.0000714765E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(-2.4999993993E-1f));
+    y          = V_ADD(V_MUL(y, x), V_SET1(3.3333331174E-1f));
+    y          = V_MUL(V_MUL(y, x), z);
+
+    y          = V_ADD(y, V_MUL(e, V_SET1(-2.12194440e-4f)));
+    y          = V_SUB(y, V_MUL(z, V_SET1(0.5f)));
+    x          = V_ADD(x, y);
+    x          = V_ADD(x, V_MUL(e, V_SET1(0.693359375f)));
+
+    // log of negative numbers and nan is nan, log(0) is -inf and log(inf) is inf, as with libm
+    x          = V_OR(V_ANDNOT(inf, x), V_AND(inf, V_SET1(INFINITY)));
+    x          = V_OR(x, invalid);
+    return V_OR(V_ANDNOT(zero, x), V_AND(zero, V_SET1(-INFINITY)));
+}
+
+static KERNEL_ATTR void KERNEL(Sin)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, KERNEL(SinV)(V_LOAD(a + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Cos)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, KERNEL(CosV)(V_LOAD(a + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Tan)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V x = V_LOAD(a + i);
+        V_STORE(out + i, V_DIV(KERNEL(SinV)(x), KERNEL(CosV)(x)));
+    }
+}
+
+static KERNEL_ATTR void KERNEL(Exp)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, KERNEL(ExpV)(V_LOAD(a + i)));
+}
+
+static KERNEL_ATTR void KERNEL(Log)(float *out, const float *a)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+        V_STORE(out + i, KERNEL(LogV)(V_LOAD(a + i)));
+}
+
+// Lanes with a <= 0, with a infinite or nan, or whose result overflows the exp kernel go through the scalar Power
+static KERNEL_ATTR void KERNEL(Pow)(float *out, const float *a, const float *b)
+{
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V x      = V_LOAD(a + i);
+        V t      = V_MUL(V_LOAD(b + i), KERNEL(LogV)(x));
+        V finite = V_AND(V_CMPGT(x, V_SET1(0.0f)), V_CMPLT(x, V_SET1(INFINITY)));
+        V normal = V_AND(finite, V_CMPLT(V_AND(t, V_CAST(VI_SET1(0x7fffffff))), V_SET1(87.0f)));
+        V_STORE(out + i, KERNEL(ExpV)(t));
+
+        int special = V_MOVEMASK(normal) ^ ((1 << V_WIDTH) - 1);
+        for (uint32_t lane = 0; special; ++lane, special >>= 1)
+        {
+            if (special & 1)
+                out[i + lane] = (float)Power(a[i + lane], b[i + lane]);
+        }
+    }
+}
+
+// atan of x in [0, 1]
+static KERNEL_ATTR V KERNEL(AtanUnitV)(V x)
+{
+    // Above tan(pi / 8) the argument is moved next to zero by atan(x) = pi / 4 + atan((x - 1) / (x + 1))
+    V mask = V_CMPGT(x, V_SET1(0.4142135623730950f));
+    V y0   = V_AND(mask, V_SET1(0.785398163397448309616f));
+    x      = V_OR(V_AND(mask, V_DIV(V_SUB(x, V_SET1(1.0f)), V_ADD(x, V_SET1(1.0f)))), V_ANDNOT(mask, x));
+    V z    = V_MUL(x, x);
+
+    V y    = V_SET1(8.05374449538e-2f);
+    y      = V_ADD(V_MUL(y, z), V_SET1(-1.38776856032E-1f));
+    y      = V_ADD(V_MUL(y, z), V_SET1(1.99777106478E-1f));
+    y      = V_ADD(V_MUL(y, z), V_SET1(-3.33329491539E-1f));
+    y      = V_ADD(V_MUL(V_MUL(y, z), x), x);
+    return V_ADD(y, y0);
+}
+
+// The octant is folded into [0, 1] by the ratio of the smaller to the larger magnitude. Lanes where both are zero or
+// both infinite, where that ratio means nothing, and lanes with a nan go through atan2f.
+static KERNEL_ATTR void KERNEL(Atan2)(float *out, const float *a, const float *b)
+{
+    const V sign_mask = V_CAST(VI_SET1((int32_t)0x80000000));
+    for (uint32_t i = 0; i < BATCH_LANES; i += V_WIDTH)
+    {
+        V y      = V_LOAD(a + i);
+        V x      = V_LOAD(b + i);
+        V ay     = V_ANDNOT(sign_mask, y);
+        V ax     = V_ANDNOT(sign_mask, x);
+        V hi     = V_MAX(ax, ay);
+        V angle  = KERNEL(AtanUnitV)(V_DIV(V_MIN(ax, ay), hi));
+
+        V steep  = V_CMPGT(ay, ax);
+        angle    = V_OR(V_AND(steep, V_SUB(V_SET1(1.57079632679489661923f), angle)), V_ANDNOT(steep, angle));
+        V behind = V_CMPLT(x, V_SET1(0.0f));
+        angle    = V_OR(V_AND(behind, V_SUB(V_SET1(3.14159265358979323846f), angle)), V_ANDNOT(behind, angle));
+        V_STORE(out + i, V_XOR(angle, V_AND(sign_mask, y)));
+
+        V   degenerate = V_OR(V_CMPEQ(hi, V_SET1(0.0f)), V_CMPEQ(V_MIN(ax, ay), V_SET1(INFINITY)));
+        degenerate     = V_OR(degenerate, V_CMPUNORD(x, y));
+        int special    = V_MOVEMASK(degenerate);
+        for (uint32_t lane = 0; special; ++lane, special >>= 1)
+        {
+            if (special & 1)
+                out[i + lane] = atan2f(a[i + lane], b[i + lane]);
+        }
+    }
+}
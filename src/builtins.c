@@ -0,0 +1,248 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Builtin library
+// Each builtin is described once here : its arity, the scalar entry point used by the tree walker, the bytecode
+// interpreter and the jit, the batch entry point of the accurate tier, its interval extension and its partial
+// derivatives. The vector kernels of the fast tier are picked by batch.c for the instruction set of the cpu.
+//
+// Partial derivatives are builtins themselves, taking the same arguments as the builtin they differentiate, so that the
+// forward mode interpreter and symbolic differentiation both reach them by index. Those are hidden from the parser.
+
+// mod follows the sign of the divisor, so mod(x, 1) stays in [0, 1) for negative x too
+static double Mod(double a, double b)
+{
+    return a - b * floor(a / b);
+}
+
+// x ^ y and pow(x, y). A third is taken as the real cube root, so x ^ (1 / 3) is defined for negative x as the notation
+// suggests, where libm gives nan. Every evaluator raises powers through here or through the same rewrites.
+double Power(double base, double exponent)
+{
+    if (exponent == (float)(1.0 / 3.0))
+        return cbrt(base);
+    if (exponent == (float)(-1.0 / 3.0))
+        return 1.0 / cbrt(base);
+    return pow(base, exponent);
+}
+
+static double CubeRootSlope(double x)
+{
+    double c = cbrt(x);
+    return 1.0 / (3.0 * c * c);
+}
+
+static double NegatedSin(double x)
+{
+    return -sin(x);
+}
+
+static double SquaredSec(double x)
+{
+    double c = cos(x);
+    return 1.0 / (c * c);
+}
+
+static double HalfInverseSqrt(double x)
+{
+    return 0.5 / sqrt(x);
+}
+
+static double Reciprocal(double x)
+{
+    return 1.0 / x;
+}
+
+static double Sign(double x)
+{
+    return x > 0.0 ? 1.0 : x < 0.0 ? -1.0 : 0.0;
+}
+
+static double PowDa(double a, double b)
+{
+    if (b == (float)(1.0 / 3.0))
+        return CubeRootSlope(a);
+    return b == 0.0 ? 0.0 : b * pow(a, b - 1.0);
+}
+
+// A negative base only has a power for integer exponents, which can't move off them : the slope is taken as 0
+static double PowDb(double a, double b)
+{
+    if (a < 0.0 && b == floor(b))
+        return 0.0;
+    double power = pow(a, b);
+    return power == 0.0 ? 0.0 : power * log(a);
+}
+
+// Ties go to the first argument, as fmin and fmax return it
+static double MinDa(double a, double b)
+{
+    return a <= b ? 1.0 : 0.0;
+}
+
+static double MinDb(double a, double b)
+{
+    return a <= b ? 0.0 : 1.0;
+}
+
+static double MaxDa(double a, double b)
+{
+    return a >= b ? 1.0 : 0.0;
+}
+
+static double MaxDb(double a, double b)
+{
+    return a >= b ? 0.0 : 1.0;
+}
+
+static double Atan2Dy(double y, double x)
+{
+    return x / (x * x + y * y);
+}
+
+static double Atan2Dx(double y, double x)
+{
+    return -y / (x * x + y * y);
+}
+
+static double ModDb(double a, double b)
+{
+    return -floor(a / b);
+}
+
+
+// Accurate tier of the batch interpreter, every lane goes through the scalar function
+#define BATCH_UNARY(fn)                                                                                                \
+    static void Batch_##fn(float *out, const float *a)                                                                 \
+    {                                                                                                                  \
+        for (uint32_t i = 0; i < BATCH_LANES; ++i)                                                                     \
+            out[i] = (float)fn(a[i]);                                                                                  \
+    }
+
+#define BATCH_BINARY(fn)                                                                                               \
+    static void Batch_##fn(float *out, const float *a, const float *b)                                                 \
+    {                                                                                                                  \
+        for (uint32_t i = 0; i < BATCH_LANES; ++i)                                                                     \
+            out[i] = (float)fn(a[i], b[i]);                                                                            \
+    }
+
+BATCH_UNARY(sin)
+BATCH_UNARY(cos)
+BATCH_UNARY(tan)
+BATCH_UNARY(exp)
+BATCH_UNARY(sqrt)
+BATCH_UNARY(log)
+BATCH_UNARY(fabs)
+BATCH_UNARY(floor)
+BATCH_BINARY(Power)
+BATCH_BINARY(fmin)
+BATCH_BINARY(fmax)
+BATCH_BINARY(atan2)
+BATCH_BINARY(Mod)
+BATCH_UNARY(cbrt)
+BATCH_UNARY(NegatedSin)
+BATCH_UNARY(SquaredSec)
+BATCH_UNARY(HalfInverseSqrt)
+BATCH_UNARY(Reciprocal)
+BATCH_UNARY(Sign)
+BATCH_BINARY(PowDa)
+BATCH_BINARY(PowDb)
+BATCH_BINARY(MinDa)
+BATCH_BINARY(MinDb)
+BATCH_BINARY(MaxDa)
+BATCH_BINARY(MaxDb)
+BATCH_BINARY(Atan2Dy)
+BATCH_BINARY(Atan2Dx)
+BATCH_BINARY(ModDb)
+BATCH_UNARY(CubeRootSlope)
+
+#define UNARY(name, fn, interval, partial)                                                                             \
+    {                                                                                                                  \
+        name, 1, false, fn, NULL, Batch_##fn, NULL, interval, NULL, { partial, PARTIAL_NONE }                         \
+    }
+#define BINARY(name, fn, interval, partial_a, partial_b)                                                               \
+    {                                                                                                                  \
+        name, 2, false, NULL, fn, NULL, Batch_##fn, NULL, interval, { partial_a, partial_b }                           \
+    }
+#define HIDDEN_UNARY(name, fn, partial)                                                                                \
+    {                                                                                                                  \
+        name, 1, true, fn, NULL, Batch_##fn, NULL, NULL, NULL, { partial, PARTIAL_NONE }                               \
+    }
+#define HIDDEN_BINARY(name, fn, partial)                                                                               \
+    {                                                                                                                  \
+        name, 2, true, NULL, fn, NULL, Batch_##fn, NULL, NULL, { partial, partial }                                    \
+    }
+
+const BuiltinFunctions builtins = {
+    .count     = BUILTIN_COUNT,
+    .functions = {
+        [BUILTIN_SIN]           = UNARY("sin", sin, IntervalSin, BUILTIN_COS),
+        [BUILTIN_COS]           = UNARY("cos", cos, IntervalCos, BUILTIN_NEG_SIN),
+        [BUILTIN_TAN]           = UNARY("tan", tan, IntervalTan, BUILTIN_SQUARED_SEC),
+        [BUILTIN_EXP]           = UNARY("exp", exp, IntervalExp, BUILTIN_EXP),
+        [BUILTIN_SQRT]          = UNARY("sqrt", sqrt, IntervalSqrt, BUILTIN_HALF_INV_SQRT),
+        [BUILTIN_LOG]           = UNARY("log", log, IntervalLog, BUILTIN_RECIPROCAL),
+        [BUILTIN_ABS]           = UNARY("abs", fabs, IntervalAbs, BUILTIN_SIGN),
+        [BUILTIN_FLOOR]         = UNARY("floor", floor, IntervalFloor, PARTIAL_ZERO),
+        [BUILTIN_POW]           = BINARY("pow", Power, IntervalPow, BUILTIN_POW_DA, BUILTIN_POW_DB),
+        [BUILTIN_MIN]           = BINARY("min", fmin, IntervalMin, BUILTIN_MIN_DA, BUILTIN_MIN_DB),
+        [BUILTIN_MAX]           = BINARY("max", fmax, IntervalMax, BUILTIN_MAX_DA, BUILTIN_MAX_DB),
+        [BUILTIN_ATAN2]         = BINARY("atan2", atan2, IntervalAtan2, BUILTIN_ATAN2_DY, BUILTIN_ATAN2_DX),
+        [BUILTIN_MOD]           = BINARY("mod", Mod, IntervalMod, PARTIAL_ONE, BUILTIN_MOD_DB),
+        [BUILTIN_CBRT]          = UNARY("cbrt", cbrt, IntervalCbrt, BUILTIN_CBRT_SLOPE),
+
+        // Piecewise constant partials differentiate to zero. The others are only evaluated by the forward mode :
+        // symbolic differentiation writes them out in arithmetic, so they never appear in a tree to differentiate.
+        [BUILTIN_NEG_SIN]       = HIDDEN_UNARY("-sin", NegatedSin, PARTIAL_NONE),
+        [BUILTIN_SQUARED_SEC]   = HIDDEN_UNARY("sec^2", SquaredSec, PARTIAL_NONE),
+        [BUILTIN_HALF_INV_SQRT] = HIDDEN_UNARY("0.5/sqrt", HalfInverseSqrt, PARTIAL_NONE),
+        [BUILTIN_RECIPROCAL]    = HIDDEN_UNARY("1/x", Reciprocal, PARTIAL_NONE),
+        [BUILTIN_SIGN]          = HIDDEN_UNARY("sign", Sign, PARTIAL_ZERO),
+        [BUILTIN_POW_DA]        = HIDDEN_BINARY("dpow/da", PowDa, PARTIAL_NONE),
+        [BUILTIN_POW_DB]        = HIDDEN_BINARY("dpow/db", PowDb, PARTIAL_NONE),
+        [BUILTIN_MIN_DA]        = HIDDEN_BINARY("dmin/da", MinDa, PARTIAL_ZERO),
+        [BUILTIN_MIN_DB]        = HIDDEN_BINARY("dmin/db", MinDb, PARTIAL_ZERO),
+        [BUILTIN_MAX_DA]        = HIDDEN_BINARY("dmax/da", MaxDa, PARTIAL_ZERO),
+        [BUILTIN_MAX_DB]        = HIDDEN_BINARY("dmax/db", MaxDb, PARTIAL_ZERO),
+        [BUILTIN_ATAN2_DY]      = HIDDEN_BINARY("datan2/dy", Atan2Dy, PARTIAL_NONE),
+        [BUILTIN_ATAN2_DX]      = HIDDEN_BINARY("datan2/dx", Atan2Dx, PARTIAL_NONE),
+        [BUILTIN_MOD_DB]        = HIDDEN_BINARY("dmod/db", ModDb, PARTIAL_ZERO),
+        [BUILTIN_CBRT_SLOPE]    = HIDDEN_UNARY("1/(3cbrt^2)", CubeRootSlope, PARTIAL_NONE),
+    },
+};
+
+// Names of the builtins the parser may call, interned by each interpreter
+void RegisterBuiltins(Interpreter *interpreter)
+{
+    for (uint32_t fn = 0; fn < builtins.count; ++fn)
+    {
+        const char *name = builtins.functions[fn].name;
+        if (builtins.functions[fn].hidden)
+            continue;
+        NameMapInsert(&interpreter->builtin_names, InternString(&interpreter->interner, name, (uint32_t)strlen(name)),
+                      NAME_BUILTIN, fn);
+    }
+}
+
+// Index of the builtin named id, -1 if there is none
+int32_t FindBuiltin(Interpreter *interpreter, const char *id)
+{
+    uint32_t    slot;
+    const char *name = FindInternedString(&interpreter->interner, id, (uint32_t)strlen(id));
+    if (NameMapFind(&interpreter->builtin_names, name, NAME_BUILTIN, &slot))
+        return (int32_t)slot;
+    return -1;
+}
+
+void SetBuiltinAccuracy(Interpreter *interpreter, BuiltinAccuracy accuracy)
+{
+    interpreter->accuracy = accuracy;
+}
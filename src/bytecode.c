@@ -0,0 +1,550 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Compiles the ExprTree of a parsed function into a flat array of instructions.
+// The tree walker recurses through every node for every sample, while the compiled program is a straight line of
+// register operations that a tight loop runs once per sample.
+// Instructions are hash-consed while emitting : an instruction identical to an earlier one reuses its register, so
+// repeated subexpressions of the tree form a DAG and are computed once per sample.
+
+typedef struct Compiler
+{
+    Program  *program;
+    uint32_t  slots_max; // power of two
+    uint32_t *slots;     // register + 1 of every distinct instruction, 0 for an empty slot
+} Compiler;
+
+static Program *CreateProgram(uint32_t max)
+{
+    Program *program = malloc(sizeof(*program));
+    Assert(program != NULL);
+    memset(program, 0, sizeof(*program));
+
+    program->max  = max;
+    program->code = malloc(sizeof(*program->code) * program->max);
+    Assert(program->code != NULL);
+    return program;
+}
+
+// Contexts on several threads share the programs of a function tier, so references are counted atomically
+Program *RetainProgram(Program *program)
+{
+    AtomicAdd32(&program->references, 1);
+    return program;
+}
+
+// Drops a reference, the last one frees the program
+void DestroyProgram(Program *program)
+{
+    if (!program || AtomicAdd32(&program->references, (uint32_t)-1))
+        return;
+    free(program->code);
+    free(program->calls);
+    DestroyExprArena(program->arena);
+    free(program);
+}
+
+static uint16_t AppendInstruction(Program *program, Instruction ins)
+{
+    if (program->count == program->max)
+    {
+        program->max  = program->max * 2;
+        program->code = realloc(program->code, sizeof(*program->code) * program->max);
+        Assert(program->code != NULL);
+    }
+    Assert(program->count < UINT16_MAX);
+    program->code[program->count] = ins;
+    return (uint16_t)program->count++;
+}
+
+static uint32_t HashInstruction(Instruction ins)
+{
+    uint32_t value;
+    memcpy(&value, &ins.value, sizeof(value));
+
+    uint32_t hash = 2166136261u;
+    hash          = (hash ^ ins.opcode) * 16777619u;
+    hash          = (hash ^ ins.a) * 16777619u;
+    hash          = (hash ^ ins.b) * 16777619u;
+    hash          = (hash ^ ins.c) * 16777619u;
+    hash          = (hash ^ value) * 16777619u;
+    return hash;
+}
+
+static bool SameInstruction(Instruction lhs, Instruction rhs)
+{
+    // Constants are compared bitwise, so 0 and -0 stay apart
+    return lhs.opcode == rhs.opcode && lhs.a == rhs.a && lhs.b == rhs.b && lhs.c == rhs.c &&
+           !memcmp(&lhs.value, &rhs.value, sizeof(lhs.value));
+}
+
+static void GrowValueTable(Compiler *compiler)
+{
+    uint32_t  old_max   = compiler->slots_max;
+    uint32_t *old_slots = compiler->slots;
+
+    compiler->slots_max = old_max ? old_max * 2 : 64;
+    compiler->slots     = calloc(compiler->slots_max, sizeof(*compiler->slots));
+    Assert(compiler->slots != NULL);
+
+    for (uint32_t slot = 0; slot < old_max; ++slot)
+    {
+        if (!old_slots[slot])
+            continue;
+        uint32_t index = HashInstruction(compiler->program->code[old_slots[slot] - 1]) & (compiler->slots_max - 1);
+        while (compiler->slots[index])
+            index = (index + 1) & (compiler->slots_max - 1);
+        compiler->slots[index] = old_slots[slot];
+    }
+    free(old_slots);
+}
+
+static uint16_t EmitInstruction(Compiler *compiler, Instruction ins)
+{
+    Program *program = compiler->program;
+
+    // User function calls are not shared, every call site keeps its own arguments
+    if (ins.opcode == OPCODE_CALL)
+        return AppendInstruction(program, ins);
+
+    // Both operands commute exactly, ordering them lets a * b and b * a share a register
+    if ((ins.opcode == OPCODE_ADD || ins.opcode == OPCODE_MUL) && ins.a > ins.b)
+    {
+        uint16_t tmp = ins.a;
+        ins.a        = ins.b;
+        ins.b        = tmp;
+    }
+
+    if (2 * (program->count + 1) > compiler->slots_max)
+        GrowValueTable(compiler);
+
+    uint32_t index = HashInstruction(ins) & (compiler->slots_max - 1);
+    while (compiler->slots[index])
+    {
+        uint16_t reg = (uint16_t)(compiler->slots[index] - 1);
+        if (SameInstruction(program->code[reg], ins))
+            return reg;
+        index = (index + 1) & (compiler->slots_max - 1);
+    }
+
+    uint16_t reg           = AppendInstruction(program, ins);
+    compiler->slots[index] = reg + 1u;
+    return reg;
+}
+
+static uint16_t AddCallSite(Program *program, FuncData *fn_data)
+{
+    if (program->calls_count == program->calls_max)
+    {
+        program->calls_max = program->calls_max ? program->calls_max * 2 : 4;
+        program->calls     = realloc(program->calls, sizeof(*program->calls) * program->calls_max);
+        Assert(program->calls != NULL);
+    }
+    program->calls[program->calls_count] = fn_data;
+    return (uint16_t)program->calls_count++;
+}
+
+// Identifiers were bound by the parser, only their locations are compiled in
+static uint16_t CompileSymbolVar(Compiler *compiler, SymbolVar *var)
+{
+    switch (var->var_type)
+    {
+    case VAR_VALUE:
+        return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_CONST, .value = var->data.value});
+    case VAR_ARG:
+        return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_ARG, .a = var->binding.slot});
+    case VAR_SLOT:
+        return EmitInstruction(compiler,
+                               (Instruction){.opcode = OPCODE_LOAD, .a = var->binding.depth, .b = var->binding.slot});
+    default:
+        Assert(!"Unbound identifier");
+        Unreachable();
+    }
+}
+
+static uint16_t CompileExprTree(Compiler *compiler, ExprTree *expr);
+
+static uint16_t EmitBuiltin(Compiler *compiler, uint16_t arg, BuiltinIndex index)
+{
+    return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_BUILTIN, .a = arg, .b = (uint16_t)index});
+}
+
+static uint16_t EmitReciprocal(Compiler *compiler, uint16_t reg)
+{
+    uint16_t one = EmitInstruction(compiler, (Instruction){.opcode = OPCODE_CONST, .value = 1.0f});
+    return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_DIV, .a = one, .b = reg});
+}
+
+// Integer powers were multiplied out by SimplifyExprTree. Of the rest, x ^ (k + 1/2) becomes x ^ k * sqrt(x) and a
+// third the cube root, anything else calls pow. The results match pow except for the sign of sqrt(-0) and at -inf.
+static uint16_t CompilePower(Compiler *compiler, ExprTree *expr)
+{
+    uint16_t  base     = CompileExprTree(compiler, expr->left);
+    ExprTree *exponent = expr->right;
+    if (exponent->node_type == LEAF && exponent->data.term.type == TERM_VALUE)
+    {
+        float n = exponent->data.term.value.value;
+        if (n == (float)(1.0 / 3.0))
+            return EmitBuiltin(compiler, base, BUILTIN_CBRT);
+        if (n == (float)(-1.0 / 3.0))
+            return EmitReciprocal(compiler, EmitBuiltin(compiler, base, BUILTIN_CBRT));
+
+        float k = fabsf(n) - 0.5f;
+        if (k == floorf(k) && k <= 4.0f)
+        {
+            uint16_t power = EmitBuiltin(compiler, base, BUILTIN_SQRT);
+            for (uint32_t i = 0; i < (uint32_t)k; ++i)
+                power = EmitInstruction(compiler, (Instruction){.opcode = OPCODE_MUL, .a = power, .b = base});
+            return n > 0.0f ? power : EmitReciprocal(compiler, power);
+        }
+    }
+    uint16_t power = CompileExprTree(compiler, exponent);
+    return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_BUILTIN2, .a = base, .b = power, .c = BUILTIN_POW});
+}
+
+static uint16_t CompileExprTree(Compiler *compiler, ExprTree *expr)
+{
+    if (expr->node_type == LEAF)
+    {
+        if (expr->data.term.type == TERM_VALUE)
+            return EmitInstruction(compiler,
+                                   (Instruction){.opcode = OPCODE_CONST, .value = expr->data.term.value.value});
+
+        Binding binding = expr->data.term.value.binding;
+        if (expr->data.term.type == TERM_ARG)
+            return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_ARG, .a = binding.slot});
+
+        Assert(expr->data.term.type == TERM_SLOT);
+        return EmitInstruction(compiler,
+                               (Instruction){.opcode = OPCODE_LOAD, .a = binding.depth, .b = binding.slot});
+    }
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        if (fn_data->is_builtin)
+        {
+            uint16_t index = (uint16_t)fn_data->builtin_index;
+            uint16_t arg   = CompileSymbolVar(compiler, &fn_data->args[0]);
+            if (builtins.functions[index].arity == 1)
+                return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_BUILTIN, .a = arg, .b = index});
+            uint16_t second = CompileSymbolVar(compiler, &fn_data->args[1]);
+            return EmitInstruction(compiler,
+                                   (Instruction){.opcode = OPCODE_BUILTIN2, .a = arg, .b = second, .c = index});
+        }
+        uint16_t call = AddCallSite(compiler->program, fn_data);
+        return EmitInstruction(compiler, (Instruction){.opcode = OPCODE_CALL, .a = call});
+    }
+
+    if (expr->data.operation == OP_EXP)
+        return CompilePower(compiler, expr);
+
+    uint16_t left  = CompileExprTree(compiler, expr->left);
+    uint16_t right = CompileExprTree(compiler, expr->right);
+
+    OpCode   opcode;
+    switch (expr->data.operation)
+    {
+    case OP_ADD:
+        opcode = OPCODE_ADD;
+        break;
+    case OP_SUB:
+        opcode = OPCODE_SUB;
+        break;
+    case OP_MUL:
+        opcode = OPCODE_MUL;
+        break;
+    case OP_DIV:
+        opcode = OPCODE_DIV;
+        break;
+    default:
+        Assert(!"Unsupported Operation ....");
+        Unreachable();
+    }
+    return EmitInstruction(compiler, (Instruction){.opcode = opcode, .a = left, .b = right});
+}
+
+Program *CompileSymbolFn(SymbolFn *fn)
+{
+    Assert(fn != NULL);
+    return CompileSymbolFnWithBudget(fn, fn->interpreter->inline_budget);
+}
+
+static bool IsVaryingCall(FuncData *call)
+{
+    for (uint32_t arg = 0; arg < call->args_used; ++arg)
+    {
+        if (call->args[arg].var_type == VAR_ARG)
+            return true;
+    }
+    return false;
+}
+
+// Registers read by ins, in a and b
+static uint32_t Operands(Instruction ins)
+{
+    switch (ins.opcode)
+    {
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_DIV:
+    case OPCODE_BUILTIN2:
+        return 2;
+    case OPCODE_BUILTIN:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Loop invariant hoisting : instructions reading no argument, directly or through their operands, are moved ahead of
+// the others, keeping their order. Those only depend on constants and globals, so they are evaluated once for a whole
+// sweep over x and y, and again only when a global changes. Every instruction feeds the result, so the result stays
+// in the last register.
+static void HoistInvariants(Program *program)
+{
+    const uint32_t count    = program->count;
+    bool          *varying  = malloc(sizeof(*varying) * count);
+    uint16_t      *renumber = malloc(sizeof(*renumber) * count);
+    Instruction   *code     = malloc(sizeof(*code) * program->max);
+    Assert(varying != NULL && renumber != NULL && code != NULL);
+
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        Instruction ins        = program->code[pc];
+        uint32_t    ops        = Operands(ins);
+        bool        reads_args = ins.opcode == OPCODE_ARG;
+        reads_args             = reads_args || (ins.opcode == OPCODE_CALL && IsVaryingCall(program->calls[ins.a]));
+        varying[pc]            = reads_args || (ops > 0 && varying[ins.a]) || (ops > 1 && varying[ins.b]);
+    }
+
+    uint16_t next = 0;
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        if (!varying[pc])
+            renumber[pc] = next++;
+    }
+    program->invariant_count = next;
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        if (varying[pc])
+            renumber[pc] = next++;
+    }
+    Assert(renumber[count - 1] == count - 1);
+
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        Instruction ins = program->code[pc];
+        uint32_t    ops = Operands(ins);
+        if (ops > 0)
+            ins.a = renumber[ins.a];
+        if (ops > 1)
+            ins.b = renumber[ins.b];
+        code[renumber[pc]] = ins;
+    }
+    free(program->code);
+    program->code = code;
+    free(varying);
+    free(renumber);
+}
+
+// A budget of UINT32_MAX inlines every call, leaving no OPCODE_CALL in the program
+Program *CompileSymbolFnWithBudget(SymbolFn *fn, uint32_t inline_budget)
+{
+    Assert(fn != NULL && fn->expr_tree != NULL);
+    Program *program                    = CreateProgram(32);
+
+    // The program keeps the optimized copy alive, its call sites point into it
+    ExprArena *arena                    = CreateExprArena();
+    program->arena                      = arena;
+    program->stack                      = &fn->interpreter->stack;
+    program->references                 = 1;
+    program->accuracy                   = fn->interpreter->accuracy;
+    program->tree                       = CloneExprTree(arena, fn->expr_tree);
+    program->report.nodes_before        = CountExprTree(program->tree);
+    program->tree                       = InlineExprTree(arena, program->tree, inline_budget,
+                                                         &program->report.calls_inlined);
+    program->tree                       = SimplifyExprTree(arena, program->tree);
+    program->report.nodes_after_folding = CountExprTree(program->tree);
+
+    Compiler compiler                   = {.program = program};
+    CompileExprTree(&compiler, program->tree);
+    free(compiler.slots);
+    program->report.nodes_after_sharing = program->count;
+
+    HoistInvariants(program);
+    program->report.hoisted             = program->invariant_count;
+    return program;
+}
+
+// registers must hold at least program->count values, arguments are read from the innermost frame
+float ExecuteProgram(Program *program, FrameStack *frames, float *registers)
+{
+    return ExecuteProgramRange(program, frames, registers, 0, program->count);
+}
+
+// Runs the instructions first to last - 1 only, with last > 0. The registers they read must be filled already. Returns
+// the register of the last one.
+float ExecuteProgramRange(Program *program, FrameStack *frames, float *registers, uint32_t first, uint32_t last)
+{
+    const Instruction *code   = program->code;
+    const float       *args   = frames->values + frames->base;
+    SymbolTable      **tables = program->stack->symbol_tables;
+
+    for (uint32_t pc = first; pc < last; ++pc)
+    {
+        const Instruction ins = code[pc];
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+            registers[pc] = ins.value;
+            break;
+        case OPCODE_ARG:
+            registers[pc] = args[ins.a];
+            break;
+        case OPCODE_LOAD:
+            // Read on every run so redefined globals show up without recompiling
+            registers[pc] = tables[ins.a]->variables[ins.b].data.value;
+            break;
+        case OPCODE_ADD:
+            registers[pc] = registers[ins.a] + registers[ins.b];
+            break;
+        case OPCODE_SUB:
+            registers[pc] = registers[ins.a] - registers[ins.b];
+            break;
+        case OPCODE_MUL:
+            registers[pc] = registers[ins.a] * registers[ins.b];
+            break;
+        case OPCODE_DIV:
+            registers[pc] = registers[ins.a] / registers[ins.b];
+            break;
+        case OPCODE_BUILTIN:
+            registers[pc] = builtins.functions[ins.b].fn(registers[ins.a]);
+            break;
+        case OPCODE_BUILTIN2:
+            registers[pc] = builtins.functions[ins.c].fn2(registers[ins.a], registers[ins.b]);
+            break;
+        case OPCODE_CALL:
+            registers[pc] = FunctionApplication(program->stack, frames, program->calls[ins.a]);
+            break;
+        default:
+            Unreachable();
+        }
+    }
+    return registers[last - 1];
+}
+
+// Derivative of the builtin index in its argument arg, at a or at (a, b)
+static float PartialDerivative(uint32_t index, uint32_t arg, float a, float b)
+{
+    int32_t partial = builtins.functions[index].partials[arg];
+    if (partial == PARTIAL_ZERO)
+        return 0.0f;
+    if (partial == PARTIAL_ONE)
+        return 1.0f;
+    Assert(partial != PARTIAL_NONE);
+
+    const Builtin *builtin = &builtins.functions[partial];
+    return (float)(builtin->arity == 1 ? builtin->fn(a) : builtin->fn2(a, b));
+}
+
+// A partial times the tangent of its input. Inputs that don't vary add nothing, even where the partial is nan or
+// infinite like the one of pow in its exponent for a negative base.
+static float ChainTerm(float partial, float tangent)
+{
+    return tangent != 0.0f ? partial * tangent : 0.0f;
+}
+
+// Forward mode differentiation in x and y : registers hold the value and both partial derivatives of every instruction,
+// three floats each. Returns the value and writes the gradient, the program must not contain calls.
+float ExecuteProgramDual(Program *program, FrameStack *frames, float *registers, float gradient[2])
+{
+    const Instruction *code   = program->code;
+    const uint32_t     count  = program->count;
+    const float       *args   = frames->values + frames->base;
+    SymbolTable      **tables = program->stack->symbol_tables;
+
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        const Instruction ins = code[pc];
+        float            *r   = registers + 3 * pc;
+        const float      *ra  = registers + 3 * ins.a;
+        const float      *rb  = registers + 3 * ins.b;
+
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+            r[0] = ins.value;
+            r[1] = 0.0f;
+            r[2] = 0.0f;
+            break;
+        case OPCODE_ARG:
+            r[0] = args[ins.a];
+            r[1] = ins.a == 0 ? 1.0f : 0.0f;
+            r[2] = ins.a == 1 ? 1.0f : 0.0f;
+            break;
+        case OPCODE_LOAD:
+            r[0] = tables[ins.a]->variables[ins.b].data.value;
+            r[1] = 0.0f;
+            r[2] = 0.0f;
+            break;
+        case OPCODE_ADD:
+            r[0] = ra[0] + rb[0];
+            r[1] = ra[1] + rb[1];
+            r[2] = ra[2] + rb[2];
+            break;
+        case OPCODE_SUB:
+            r[0] = ra[0] - rb[0];
+            r[1] = ra[1] - rb[1];
+            r[2] = ra[2] - rb[2];
+            break;
+        case OPCODE_MUL:
+            r[0] = ra[0] * rb[0];
+            r[1] = ChainTerm(rb[0], ra[1]) + ChainTerm(ra[0], rb[1]);
+            r[2] = ChainTerm(rb[0], ra[2]) + ChainTerm(ra[0], rb[2]);
+            break;
+        case OPCODE_DIV:
+        {
+            // (a / b)' = (a' - (a / b) * b') / b
+            float quotient = ra[0] / rb[0];
+            r[0]           = quotient;
+            r[1]           = (ra[1] - ChainTerm(quotient, rb[1])) / rb[0];
+            r[2]           = (ra[2] - ChainTerm(quotient, rb[2])) / rb[0];
+            break;
+        }
+        case OPCODE_BUILTIN:
+        {
+            float slope = PartialDerivative(ins.b, 0, ra[0], 0.0f);
+            r[0]        = (float)builtins.functions[ins.b].fn(ra[0]);
+            r[1]        = ChainTerm(slope, ra[1]);
+            r[2]        = ChainTerm(slope, ra[2]);
+            break;
+        }
+        case OPCODE_BUILTIN2:
+        {
+            float da = PartialDerivative(ins.c, 0, ra[0], rb[0]);
+            float db = PartialDerivative(ins.c, 1, ra[0], rb[0]);
+            r[0]     = (float)builtins.functions[ins.c].fn2(ra[0], rb[0]);
+            r[1]     = ChainTerm(da, ra[1]) + ChainTerm(db, rb[1]);
+            r[2]     = ChainTerm(da, ra[2]) + ChainTerm(db, rb[2]);
+            break;
+        }
+        default:
+            Assert(!"Calls must be inlined before differentiating");
+            Unreachable();
+        }
+    }
+    gradient[0] = registers[3 * (count - 1) + 1];
+    gradient[1] = registers[3 * (count - 1) + 2];
+    return registers[3 * (count - 1)];
+}
@@ -0,0 +1,417 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./Morph.h"
+
+// Chebyshev proxies
+// A costly callback is replaced over a fixed domain by a piecewise polynomial, each piece interpolating it at the
+// Chebyshev points of its interval. A piece is accepted once the tail of its Chebyshev coefficients falls under the
+// tolerance, which for smooth functions bounds the error of the whole piece, and split in halves otherwise. Plots, hit
+// tests and root finding then evaluate the proxy, a few dozen multiplications, and the callback is only called while
+// building or refining it.
+//
+// The domain is cut into slices built by their own threads, so the callback must be safe to call concurrently.
+// Subdivision stops at a fixed depth, pieces over poles or jumps are kept as they are and never count as converged.
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define PROXY_DEGREE    32 // of the interpolant of a piece, before the tail is dropped
+#define PROXY_SLICES    8  // of the domain, built in parallel
+#define PROXY_MAX_DEPTH 24 // halvings of a slice
+
+typedef struct ProxyPiece
+{
+    double   lo, hi;
+    double   error; // dropped coefficients over max(1, |f|), infinite when the piece didn't converge
+    uint32_t depth;
+    uint32_t degree;
+    double   coefficients[PROXY_DEGREE + 1]; // of T0 .. T(degree) over [lo, hi] mapped to [-1, 1]
+} ProxyPiece;
+
+typedef struct ProxyPieces
+{
+    ProxyPiece *pieces;
+    uint32_t    count;
+    uint32_t    max;
+} ProxyPieces;
+
+struct MChebyshevProxy
+{
+    ParametricFn1D      fn;
+    ParametricBatchFn1D batch; // called instead of fn when given, with all the points of a piece at once
+    void               *user;
+    double              lo, hi;
+    double              tolerance;
+    ProxyPieces         pieces;                   // sorted, covering [lo, hi] without gaps
+    double              cosines[2 * PROXY_DEGREE]; // cos(pi * m / PROXY_DEGREE), the only cosines the transform needs
+};
+
+// Builds or refines the pieces of one slice
+typedef struct ProxyTask
+{
+    MChebyshevProxy  *proxy;
+    const ProxyPiece *inputs;
+    uint32_t          inputs_count;
+    ProxyPieces       outputs;
+} ProxyTask;
+
+static void PushPiece(ProxyPieces *list, const ProxyPiece *piece)
+{
+    if (list->count == list->max)
+    {
+        list->max    = list->max ? list->max * 2 : 16;
+        list->pieces = realloc(list->pieces, sizeof(*list->pieces) * list->max);
+        assert(list->pieces != NULL);
+    }
+    list->pieces[list->count++] = *piece;
+}
+
+// Interpolates fn at the Chebyshev points of [lo, hi], then keeps the shortest prefix of coefficients whose dropped
+// tail stays under the tolerance. Tolerance is relative to the magnitude of fn on the piece when that is above 1. False
+// when the piece needs to be split.
+static bool FitPiece(MChebyshevProxy *proxy, ProxyPiece *piece)
+{
+    const uint32_t n       = PROXY_DEGREE;
+    const double  *cosines = proxy->cosines;
+    double         points[PROXY_DEGREE + 1];
+    double         values[PROXY_DEGREE + 1];
+    double         magnitude = 1.0;
+    double         middle    = 0.5 * (piece->lo + piece->hi);
+    double         radius    = 0.5 * (piece->hi - piece->lo);
+
+    for (uint32_t k = 0; k <= n; ++k)
+        points[k] = middle + radius * cosines[k];
+    if (proxy->batch)
+        proxy->batch(points, values, n + 1, proxy->user);
+    else
+    {
+        for (uint32_t k = 0; k <= n; ++k)
+            values[k] = proxy->fn(points[k]);
+    }
+
+    for (uint32_t k = 0; k <= n; ++k)
+    {
+        if (!isfinite(values[k]))
+        {
+            piece->error  = INFINITY;
+            piece->degree = 0;
+            memset(piece->coefficients, 0, sizeof(piece->coefficients));
+            piece->coefficients[0] = NAN;
+            return false;
+        }
+        magnitude = fmax(magnitude, fabs(values[k]));
+    }
+
+    // c(j) = 2 / n * sum'' f(k) cos(pi j k / n), halved at both ends so that f = sum c(j) T(j)
+    for (uint32_t j = 0; j <= n; ++j)
+    {
+        double sum = 0.5 * (values[0] + values[n] * cosines[(j * n) % (2 * n)]);
+        for (uint32_t k = 1; k < n; ++k)
+            sum += values[k] * cosines[(j * k) % (2 * n)];
+        piece->coefficients[j] = sum * 2.0 / n;
+    }
+    piece->coefficients[0] *= 0.5;
+    piece->coefficients[n] *= 0.5;
+
+    double tolerance = proxy->tolerance * magnitude;
+    double tail      = 0.0;
+    piece->degree    = n;
+    while (piece->degree > 0 && tail + fabs(piece->coefficients[piece->degree]) <= tolerance)
+    {
+        tail = tail + fabs(piece->coefficients[piece->degree]);
+        piece->degree--;
+    }
+
+    // The last coefficients of an interpolant that hasn't converged are never all small, three of them are enough to
+    // not be fooled by a function that happens to be even or odd
+    piece->error = tail / magnitude;
+    return piece->degree + 3 <= n;
+}
+
+static void Subdivide(MChebyshevProxy *proxy, ProxyPieces *list, double lo, double hi, uint32_t depth)
+{
+    ProxyPiece piece     = {.lo = lo, .hi = hi, .depth = depth};
+    bool       converged = FitPiece(proxy, &piece);
+    if (converged || depth == PROXY_MAX_DEPTH)
+    {
+        if (!converged)
+            piece.error = INFINITY;
+        PushPiece(list, &piece);
+        return;
+    }
+
+    double middle = 0.5 * (lo + hi);
+    Subdivide(proxy, list, lo, middle, depth + 1);
+    Subdivide(proxy, list, middle, hi, depth + 1);
+}
+
+// Pieces within the tolerance are kept, the others fitted again from where they were
+static void RunTask(ProxyTask *task)
+{
+    for (uint32_t input = 0; input < task->inputs_count; ++input)
+    {
+        const ProxyPiece *piece = &task->inputs[input];
+        if (piece->error <= task->proxy->tolerance || piece->depth == PROXY_MAX_DEPTH)
+            PushPiece(&task->outputs, piece);
+        else
+            Subdivide(task->proxy, &task->outputs, piece->lo, piece->hi, piece->depth);
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI ProxyWorker(void *arg)
+#else
+static void *ProxyWorker(void *arg)
+#endif
+{
+    RunTask(arg);
+    return 0;
+}
+
+// Spreads inputs over PROXY_SLICES threads and replaces the pieces of proxy with what they made, in order
+static void BuildPieces(MChebyshevProxy *proxy, const ProxyPiece *inputs, uint32_t count)
+{
+    ProxyTask tasks[PROXY_SLICES] = {0};
+#if defined(_WIN32)
+    HANDLE threads[PROXY_SLICES] = {0};
+#else
+    pthread_t threads[PROXY_SLICES];
+    bool      started[PROXY_SLICES] = {0};
+#endif
+
+    for (uint32_t slice = 0; slice < PROXY_SLICES; ++slice)
+    {
+        uint32_t first            = (uint32_t)((uint64_t)count * slice / PROXY_SLICES);
+        uint32_t last             = (uint32_t)((uint64_t)count * (slice + 1) / PROXY_SLICES);
+        tasks[slice].proxy        = proxy;
+        tasks[slice].inputs       = inputs + first;
+        tasks[slice].inputs_count = last - first;
+        if (!tasks[slice].inputs_count)
+            continue;
+
+        // A slice that gets no thread is built by this one
+#if defined(_WIN32)
+        threads[slice] = CreateThread(NULL, 0, ProxyWorker, &tasks[slice], 0, NULL);
+        if (!threads[slice])
+            RunTask(&tasks[slice]);
+#else
+        started[slice] = !pthread_create(&threads[slice], NULL, ProxyWorker, &tasks[slice]);
+        if (!started[slice])
+            RunTask(&tasks[slice]);
+#endif
+    }
+
+    ProxyPieces pieces = {0};
+    for (uint32_t slice = 0; slice < PROXY_SLICES; ++slice)
+    {
+#if defined(_WIN32)
+        if (threads[slice])
+        {
+            WaitForSingleObject(threads[slice], INFINITE);
+            CloseHandle(threads[slice]);
+        }
+#else
+        if (started[slice])
+            pthread_join(threads[slice], NULL);
+#endif
+        for (uint32_t piece = 0; piece < tasks[slice].outputs.count; ++piece)
+            PushPiece(&pieces, &tasks[slice].outputs.pieces[piece]);
+        free(tasks[slice].outputs.pieces);
+    }
+
+    free(proxy->pieces.pieces);
+    proxy->pieces = pieces;
+}
+
+static MChebyshevProxy *CreateProxy(ParametricFn1D fn, ParametricBatchFn1D batch, void *user, double xinit,
+                                    double xend, double tolerance)
+{
+    assert((fn != NULL || batch != NULL) && xinit < xend && tolerance > 0.0);
+
+    MChebyshevProxy *proxy = malloc(sizeof(*proxy));
+    assert(proxy != NULL);
+    memset(proxy, 0, sizeof(*proxy));
+    proxy->fn        = fn;
+    proxy->batch     = batch;
+    proxy->user      = user;
+    proxy->lo        = xinit;
+    proxy->hi        = xend;
+    proxy->tolerance = tolerance;
+    for (uint32_t m = 0; m < 2 * PROXY_DEGREE; ++m)
+        proxy->cosines[m] = cos(3.14159265358979323846 * m / PROXY_DEGREE);
+
+    // Slices start out unfitted, every one of them is subdivided by its worker
+    ProxyPiece slices[PROXY_SLICES];
+    for (uint32_t slice = 0; slice < PROXY_SLICES; ++slice)
+    {
+        double lo     = xinit + (xend - xinit) * slice / PROXY_SLICES;
+        double hi     = slice + 1 == PROXY_SLICES ? xend : xinit + (xend - xinit) * (slice + 1) / PROXY_SLICES;
+        slices[slice] = (ProxyPiece){.lo = lo, .hi = hi, .error = INFINITY};
+    }
+    BuildPieces(proxy, slices, PROXY_SLICES);
+    return proxy;
+}
+
+MChebyshevProxy *MorphCreateProxy(ParametricFn1D fn, double xinit, double xend, double tolerance)
+{
+    assert(fn != NULL);
+    return CreateProxy(fn, NULL, NULL, xinit, xend, tolerance);
+}
+
+// Every piece is fitted with a single call of fn, taking all of its nodes
+MChebyshevProxy *MorphCreateProxyBatched(ParametricBatchFn1D fn, void *user, double xinit, double xend, double tolerance)
+{
+    assert(fn != NULL);
+    return CreateProxy(NULL, fn, user, xinit, xend, tolerance);
+}
+
+// Tightens the tolerance, the pieces already within it are kept and only the others call the callback again
+void MorphRefineProxy(MChebyshevProxy *proxy, double tolerance)
+{
+    assert(proxy != NULL && tolerance > 0.0);
+    if (tolerance >= proxy->tolerance)
+        return;
+
+    proxy->tolerance   = tolerance;
+    ProxyPieces pieces = proxy->pieces;
+    proxy->pieces      = (ProxyPieces){0};
+    BuildPieces(proxy, pieces.pieces, pieces.count);
+    free(pieces.pieces);
+}
+
+static double EvalPiece(const ProxyPiece *piece, double x)
+{
+    // Clenshaw recurrence
+    double t  = (2.0 * x - piece->lo - piece->hi) / (piece->hi - piece->lo);
+    double b1 = 0.0, b2 = 0.0;
+    for (uint32_t j = piece->degree; j > 0; --j)
+    {
+        double b = piece->coefficients[j] + 2.0 * t * b1 - b2;
+        b2       = b1;
+        b1       = b;
+    }
+    return piece->coefficients[0] + t * b1 - b2;
+}
+
+static const ProxyPiece *FindPiece(const MChebyshevProxy *proxy, double x)
+{
+    uint32_t lo = 0, hi = proxy->pieces.count;
+    while (hi - lo > 1)
+    {
+        uint32_t middle = lo + (hi - lo) / 2;
+        if (x < proxy->pieces.pieces[middle].lo)
+            hi = middle;
+        else
+            lo = middle;
+    }
+    return &proxy->pieces.pieces[lo];
+}
+
+// NAN outside of the domain the proxy was built over
+double MorphEvalProxy(const MChebyshevProxy *proxy, double x)
+{
+    if (!(x >= proxy->lo && x <= proxy->hi))
+        return NAN;
+    return EvalPiece(FindPiece(proxy, x), x);
+}
+
+// Appends root, unless it is the one found last. Neighbouring pieces only agree within the tolerance, so a root next to
+// the end they share may show up in both, a little apart.
+static void AddRoot(const MChebyshevProxy *proxy, double *roots, uint32_t *found, double root)
+{
+    double resolution = (proxy->hi - proxy->lo) * 1e-6;
+    if (*found && root - roots[*found - 1] <= resolution)
+    {
+        roots[*found - 1] = 0.5 * (roots[*found - 1] + root);
+        return;
+    }
+    roots[(*found)++] = root;
+}
+
+// Roots of each converged piece are bracketed by sign changes over a grid finer than its degree, then bisected on the
+// polynomial. Roots of even multiplicity touch zero without crossing it and are missed, roots closer than a millionth
+// of the domain are taken as one.
+uint32_t MorphProxyRoots(const MChebyshevProxy *proxy, double *roots, uint32_t max)
+{
+    uint32_t found = 0;
+    for (uint32_t index = 0; index < proxy->pieces.count && found < max; ++index)
+    {
+        const ProxyPiece *piece = &proxy->pieces.pieces[index];
+        if (!isfinite(piece->error))
+            continue;
+
+        uint32_t steps = 2 * piece->degree + 2;
+        double   x0    = piece->lo;
+        double   f0    = EvalPiece(piece, x0);
+        for (uint32_t step = 1; step <= steps && found < max; ++step)
+        {
+            double x1 = piece->lo + (piece->hi - piece->lo) * step / steps;
+            double f1 = EvalPiece(piece, x1);
+            // Zeros on a grid point are taken once, as the left end of the next step
+            if (f0 == 0.0)
+                AddRoot(proxy, roots, &found, x0);
+            else if ((f0 < 0.0) != (f1 < 0.0) && f1 != 0.0)
+            {
+                double lo = x0, hi = x1, flo = f0;
+                for (uint32_t iteration = 0; iteration < 64; ++iteration)
+                {
+                    double middle = 0.5 * (lo + hi);
+                    if (middle <= lo || middle >= hi)
+                        break;
+                    double fm = EvalPiece(piece, middle);
+                    if ((fm < 0.0) == (flo < 0.0))
+                    {
+                        lo  = middle;
+                        flo = fm;
+                    }
+                    else
+                        hi = middle;
+                }
+                AddRoot(proxy, roots, &found, 0.5 * (lo + hi));
+            }
+            x0 = x1;
+            f0 = f1;
+        }
+    }
+
+    // The right end of the domain is never the left end of a step
+    const ProxyPiece *last = proxy->pieces.count ? &proxy->pieces.pieces[proxy->pieces.count - 1] : NULL;
+    if (last && found < max && isfinite(last->error) && EvalPiece(last, last->hi) == 0.0)
+        AddRoot(proxy, roots, &found, last->hi);
+    return found;
+}
+
+MChebyshevProxyReport MorphGetProxyReport(const MChebyshevProxy *proxy)
+{
+    MChebyshevProxyReport report = {0};
+    for (uint32_t index = 0; index < proxy->pieces.count; ++index)
+    {
+        const ProxyPiece *piece = &proxy->pieces.pieces[index];
+        report.pieces++;
+        report.coefficients += piece->degree + 1;
+        if (!isfinite(piece->error))
+            report.unresolved++;
+        else if (piece->error > report.error)
+            report.error = piece->error;
+    }
+    return report;
+}
+
+void MorphDestroyProxy(MChebyshevProxy *proxy)
+{
+    if (!proxy)
+        return;
+    free(proxy->pieces.pieces);
+    free(proxy);
+}
@@ -0,0 +1,194 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Dependency graph
+// Every function records the global variables and the user functions its body reads, once each, when it is bound.
+// Those are the edges of the graph, and what a function depends on transitively is found by following them through
+// the callees. Definitions never move, a redefinition overwrites the slot of a variable and replaces the function in
+// its slot, so nothing but these edges and the generation stamps has to be maintained.
+//
+// Each definition parsed bumps the generation of the interpreter and stamps what it replaced with it. A program
+// compiled at some generation is stale when anything reachable from its function carries a later stamp.
+//
+// Callers hold a reference on each of their callees, so a replaced function lives on exactly as long as a context or
+// another function still reaches it.
+
+static void AddVar(ExprArena *arena, Dependencies *dependencies, Binding binding)
+{
+    for (uint32_t var = 0; var < dependencies->vars_count; ++var)
+    {
+        if (dependencies->vars[var].depth == binding.depth && dependencies->vars[var].slot == binding.slot)
+            return;
+    }
+
+    // Outgrown arrays are left in the arena, they go away with the function
+    if (dependencies->vars_count == dependencies->vars_max)
+    {
+        dependencies->vars_max = dependencies->vars_max ? dependencies->vars_max * 2 : 4;
+        Binding *vars          = ArenaAlloc(arena, sizeof(*vars) * dependencies->vars_max);
+        if (dependencies->vars_count)
+            memcpy(vars, dependencies->vars, sizeof(*vars) * dependencies->vars_count);
+        dependencies->vars = vars;
+    }
+    dependencies->vars[dependencies->vars_count++] = binding;
+}
+
+static void AddFn(ExprArena *arena, Dependencies *dependencies, SymbolFn *fn)
+{
+    for (uint32_t callee = 0; callee < dependencies->fns_count; ++callee)
+    {
+        if (dependencies->fns[callee] == fn)
+            return;
+    }
+
+    if (dependencies->fns_count == dependencies->fns_max)
+    {
+        dependencies->fns_max = dependencies->fns_max ? dependencies->fns_max * 2 : 4;
+        SymbolFn **fns        = ArenaAlloc(arena, sizeof(*fns) * dependencies->fns_max);
+        if (dependencies->fns_count)
+            memcpy(fns, dependencies->fns, sizeof(*fns) * dependencies->fns_count);
+        dependencies->fns = fns;
+    }
+    dependencies->fns[dependencies->fns_count++] = RetainSymbolFn(fn);
+}
+
+static void Collect(ExprArena *arena, Dependencies *dependencies, ExprTree *expr)
+{
+    if (!expr)
+        return;
+
+    if (expr->node_type == LEAF)
+    {
+        if (expr->data.term.type == TERM_SLOT)
+            AddVar(arena, dependencies, expr->data.term.value.binding);
+        return;
+    }
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        for (uint32_t arg = 0; arg < fn_data->args_used; ++arg)
+        {
+            if (fn_data->args[arg].var_type == VAR_SLOT)
+                AddVar(arena, dependencies, fn_data->args[arg].binding);
+        }
+        if (!fn_data->is_builtin)
+            AddFn(arena, dependencies, fn_data->fn);
+        return;
+    }
+
+    Collect(arena, dependencies, expr->left);
+    Collect(arena, dependencies, expr->right);
+}
+
+// Fills the dependencies of fn from its bound tree, whatever it held before isn't released
+void CollectDependencies(SymbolFn *fn)
+{
+    fn->dependencies = (Dependencies){0};
+    Collect(fn->arena, &fn->dependencies, fn->expr_tree);
+}
+
+static bool Reaches(SymbolFn *fn, SymbolFn *target)
+{
+    if (fn == target)
+        return true;
+    for (uint32_t callee = 0; callee < fn->dependencies.fns_count; ++callee)
+    {
+        if (Reaches(fn->dependencies.fns[callee], target))
+            return true;
+    }
+    return false;
+}
+
+static void RebindCalls(ExprTree *expr, SymbolFn *old_fn, SymbolFn *new_fn)
+{
+    if (!expr || expr->node_type == LEAF)
+        return;
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        if (!fn_data->is_builtin && fn_data->fn == old_fn)
+            fn_data->fn = new_fn;
+        return;
+    }
+
+    RebindCalls(expr->left, old_fn, new_fn);
+    RebindCalls(expr->right, old_fn, new_fn);
+}
+
+static bool Calls(SymbolFn *fn, SymbolFn *target)
+{
+    for (uint32_t callee = 0; callee < fn->dependencies.fns_count; ++callee)
+    {
+        if (fn->dependencies.fns[callee] == target)
+            return true;
+    }
+    return false;
+}
+
+// Copy of fn calling new_fn where it called old_fn, stamped with the generation of new_fn. fn itself is left as it
+// was : contexts made from it may be walking its tree, and the frames they have are sized for the calls it makes.
+static SymbolFn *ReboundCopy(SymbolFn *fn, SymbolFn *old_fn, SymbolFn *new_fn)
+{
+    SymbolFn *copy = malloc(sizeof(*copy));
+    Assert(copy != NULL);
+    *copy            = *fn;
+    copy->tier_state = (TierState){0};
+    copy->references = 1;
+    copy->arena      = CreateExprArena();
+    copy->expr_tree  = CloneExprTree(copy->arena, fn->expr_tree);
+    copy->generation = new_fn->generation;
+    RebindCalls(copy->expr_tree, old_fn, new_fn);
+    CollectDependencies(copy);
+    return copy;
+}
+
+// Functions of table calling old_fn are replaced in their slots by copies calling new_fn, and the functions calling
+// those follow the copies in turn. The table drops its reference on the functions replaced, like on old_fn, which go
+// away once the contexts running them are refreshed onto the copies. Those are left with the old definition when the
+// new one takes another count of arguments, or when it calls them back : following it would make the calls recursive.
+void RebindCallers(SymbolTable *table, SymbolFn *old_fn, SymbolFn *new_fn)
+{
+    if (old_fn->args_count != new_fn->args_count)
+        return;
+
+    for (uint32_t slot = 0; slot < table->fn_count; ++slot)
+    {
+        SymbolFn *fn = table->functions[slot];
+        if (fn == new_fn || Reaches(new_fn, fn) || !Calls(fn, old_fn))
+            continue;
+
+        SymbolFn *copy         = ReboundCopy(fn, old_fn, new_fn);
+        table->functions[slot] = copy;
+        RebindCallers(table, fn, copy);
+        ReleaseReplacedFn(fn);
+    }
+}
+
+// Latest generation at which the code of fn or of a function it calls changed, and at which a variable read by any of
+// them was assigned. Both are raised, never lowered, so start them at 0.
+void LatestChanges(SymbolFn *fn, uint32_t *code, uint32_t *values)
+{
+    SymbolTableStack *stack        = &fn->interpreter->stack;
+    Dependencies     *dependencies = &fn->dependencies;
+
+    if (fn->generation > *code)
+        *code = fn->generation;
+    for (uint32_t var = 0; var < dependencies->vars_count; ++var)
+    {
+        Binding    binding = dependencies->vars[var];
+        SymbolVar *entry   = &stack->symbol_tables[binding.depth]->variables[binding.slot];
+        if (entry->generation > *values)
+            *values = entry->generation;
+    }
+    for (uint32_t callee = 0; callee < dependencies->fns_count; ++callee)
+        LatestChanges(dependencies->fns[callee], code, values);
+}
@@ -0,0 +1,348 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Symbolic differentiation
+// The derivative of a function is built as a new tree in the arena of the derivative, then simplified and compiled like
+// any other function. The source is fully inlined first, so only arithmetic and builtins are ever differentiated.
+// A derivative that is identically zero is represented by NULL while building, so that terms like x * 0 never appear
+// in the result : folding them away afterwards would be wrong for infinite x.
+// A part that has no derivative in this form, such as a varying power of a compound base, makes the whole result
+// underivable. Callers fall back to numerical slopes then.
+
+static ExprTree underivable_node;
+#define UNDERIVABLE (&underivable_node)
+
+static ExprTree *NewLeaf(ExprArena *arena, TermType type)
+{
+    ExprTree *leaf       = ArenaAlloc(arena, sizeof(*leaf));
+    leaf->node_type      = LEAF;
+    leaf->left           = NULL;
+    leaf->right          = NULL;
+    leaf->data.term.type = type;
+    return leaf;
+}
+
+static ExprTree *NewConstant(ExprArena *arena, float value)
+{
+    ExprTree *leaf              = NewLeaf(arena, TERM_VALUE);
+    leaf->data.term.value.value = value;
+    return leaf;
+}
+
+static ExprTree *NewNode(ExprArena *arena, Op operation, ExprTree *left, ExprTree *right)
+{
+    ExprTree *node       = ArenaAlloc(arena, sizeof(*node));
+    node->node_type      = NODE;
+    node->data.operation = operation;
+    node->left           = left;
+    node->right          = right;
+    return node;
+}
+
+// -1 * expr, like a parsed unary minus : 0 - expr would turn -0 into +0
+static ExprTree *Negate(ExprArena *arena, ExprTree *expr)
+{
+    return NewNode(arena, OP_MUL, NewConstant(arena, -1.0f), expr);
+}
+
+// Leaf reading the same value as an argument of a call
+static ExprTree *LeafFromVar(ExprArena *arena, SymbolVar *var)
+{
+    switch (var->var_type)
+    {
+    case VAR_VALUE:
+        return NewConstant(arena, var->data.value);
+    case VAR_ARG:
+    case VAR_SLOT:
+    {
+        ExprTree *leaf                = NewLeaf(arena, var->var_type == VAR_ARG ? TERM_ARG : TERM_SLOT);
+        leaf->data.term.value.binding = var->binding;
+        return leaf;
+    }
+    default:
+        Assert(!"Unbound function argument");
+        Unreachable();
+    }
+}
+
+// Variable read by a leaf, the reverse of LeafFromVar. Fails on anything but a leaf.
+static bool VarFromLeaf(ExprTree *leaf, SymbolVar *var)
+{
+    if (leaf->node_type != LEAF)
+        return false;
+    switch (leaf->data.term.type)
+    {
+    case TERM_VALUE:
+        *var = (SymbolVar){.var_type = VAR_VALUE, .data.value = leaf->data.term.value.value};
+        return true;
+    case TERM_ARG:
+    case TERM_SLOT:
+        *var = (SymbolVar){.var_type = leaf->data.term.type == TERM_ARG ? VAR_ARG : VAR_SLOT,
+                           .binding  = leaf->data.term.value.binding};
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Call of the builtin index on args
+static ExprTree *NewBuiltinCall(ExprArena *arena, uint32_t index, SymbolVar *args)
+{
+    Assert(index < builtins.count);
+    uint32_t  arity                 = builtins.functions[index].arity;
+
+    FuncData *fn_data               = ArenaAlloc(arena, sizeof(*fn_data));
+    *fn_data                        = (FuncData){.is_builtin = true, .builtin_index = index, .args_used = arity};
+    fn_data->args                   = ArenaAlloc(arena, sizeof(*fn_data->args) * arity);
+    memcpy(fn_data->args, args, sizeof(*fn_data->args) * arity);
+
+    ExprTree *node                  = NewNode(arena, OP_FUNC_APPLY, NULL, NULL);
+    node->data.term.value.func_data = fn_data;
+    return node;
+}
+
+static bool IsConstantLeaf(ExprTree *expr, float *value)
+{
+    if (expr->node_type != LEAF || expr->data.term.type != TERM_VALUE)
+        return false;
+    *value = expr->data.term.value.value;
+    return true;
+}
+
+// Slope r * l ^ (r - 1) of l ^ r in l, for trees that aren't used elsewhere
+static ExprTree *PowerSlope(ExprArena *arena, ExprTree *left, ExprTree *right)
+{
+    // l ^ (r - 1) is nan for negative l next to a real cube root, l ^ r / l isn't
+    float     n;
+    bool      third = IsConstantLeaf(right, &n) && (n == (float)(1.0 / 3.0) || n == (float)(-1.0 / 3.0));
+    ExprTree *power = NewNode(arena, OP_EXP, left, CloneExprTree(arena, right));
+    if (third)
+        power = NewNode(arena, OP_DIV, power, CloneExprTree(arena, left));
+    else
+        power->right = NewNode(arena, OP_SUB, power->right, NewConstant(arena, 1.0f));
+    return NewNode(arena, OP_MUL, right, power);
+}
+
+// Partial derivative of the builtin applied by call in its argument i, NULL when it is zero everywhere
+static ExprTree *BuiltinPartial(ExprArena *arena, FuncData *call, uint32_t i)
+{
+    const Builtin *builtin = &builtins.functions[call->builtin_index];
+    int32_t        partial = builtin->partials[i];
+
+    // Derivatives with a closed form in arithmetic are written out, they simplify and share registers with the rest.
+    // Every partial that isn't piecewise constant is, so the hidden builtins never end up in a tree and derivatives
+    // can be taken again to any order.
+    switch (call->builtin_index)
+    {
+    case BUILTIN_COS:
+        return Negate(arena, NewBuiltinCall(arena, BUILTIN_SIN, call->args));
+    case BUILTIN_TAN:
+    {
+        ExprTree *cos    = NewBuiltinCall(arena, BUILTIN_COS, call->args);
+        ExprTree *square = NewNode(arena, OP_MUL, cos, CloneExprTree(arena, cos));
+        return NewNode(arena, OP_DIV, NewConstant(arena, 1.0f), square);
+    }
+    case BUILTIN_SQRT:
+        return NewNode(arena, OP_DIV, NewConstant(arena, 0.5f), NewBuiltinCall(arena, BUILTIN_SQRT, call->args));
+    case BUILTIN_LOG:
+        return NewNode(arena, OP_DIV, NewConstant(arena, 1.0f), LeafFromVar(arena, &call->args[0]));
+    case BUILTIN_CBRT:
+    {
+        ExprTree *cbrt   = NewBuiltinCall(arena, BUILTIN_CBRT, call->args);
+        ExprTree *square = NewNode(arena, OP_MUL, NewNode(arena, OP_MUL, NewConstant(arena, 3.0f), cbrt),
+                                   CloneExprTree(arena, cbrt));
+        return NewNode(arena, OP_DIV, NewConstant(arena, 1.0f), square);
+    }
+    case BUILTIN_ATAN2:
+    {
+        // atan2(y, x) : x / (x * x + y * y) in y and -y / (x * x + y * y) in x
+        ExprTree *y      = LeafFromVar(arena, &call->args[0]);
+        ExprTree *x      = LeafFromVar(arena, &call->args[1]);
+        ExprTree *radius = NewNode(arena, OP_ADD, NewNode(arena, OP_MUL, x, CloneExprTree(arena, x)),
+                                   NewNode(arena, OP_MUL, y, CloneExprTree(arena, y)));
+        if (i == 0)
+            return NewNode(arena, OP_DIV, CloneExprTree(arena, x), radius);
+        return NewNode(arena, OP_DIV, Negate(arena, CloneExprTree(arena, y)), radius);
+    }
+    case BUILTIN_POW:
+    {
+        // As for a ^ b, so both spellings have the same derivatives
+        ExprTree *a = LeafFromVar(arena, &call->args[0]);
+        ExprTree *b = LeafFromVar(arena, &call->args[1]);
+        if (i == 0)
+            return PowerSlope(arena, a, b);
+        return NewNode(arena, OP_MUL, NewNode(arena, OP_EXP, a, b), NewBuiltinCall(arena, BUILTIN_LOG, call->args));
+    }
+    default:
+        break;
+    }
+
+    if (partial == PARTIAL_ZERO)
+        return NULL;
+    if (partial == PARTIAL_ONE)
+        return NewConstant(arena, 1.0f);
+    if (partial == PARTIAL_NONE)
+        return UNDERIVABLE;
+    return NewBuiltinCall(arena, (uint32_t)partial, call->args);
+}
+
+static bool IsArgument(SymbolVar *var, uint32_t arg)
+{
+    return var->var_type == VAR_ARG && var->binding.slot == arg;
+}
+
+// Derivative of expr with respect to the argument arg, NULL when it is zero everywhere
+static ExprTree *Differentiate(ExprArena *arena, ExprTree *expr, uint32_t arg)
+{
+    if (expr->node_type == LEAF)
+    {
+        if (expr->data.term.type == TERM_ARG && expr->data.term.value.binding.slot == arg)
+            return NewConstant(arena, 1.0f);
+        return NULL;
+    }
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        Assert(fn_data->is_builtin); // user functions are inlined before differentiating
+
+        // Arguments are plain variables, so the chain rule ends here. f(x, x) sums both partials.
+        ExprTree *derivative = NULL;
+        for (uint32_t i = 0; i < builtins.functions[fn_data->builtin_index].arity; ++i)
+        {
+            if (!IsArgument(&fn_data->args[i], arg))
+                continue;
+            ExprTree *partial = BuiltinPartial(arena, fn_data, i);
+            if (partial == UNDERIVABLE)
+                return UNDERIVABLE;
+            if (partial)
+                derivative = derivative ? NewNode(arena, OP_ADD, derivative, partial) : partial;
+        }
+        return derivative;
+    }
+
+    ExprTree *left   = expr->left;
+    ExprTree *right  = expr->right;
+    ExprTree *dleft  = Differentiate(arena, left, arg);
+    ExprTree *dright = Differentiate(arena, right, arg);
+    if (dleft == UNDERIVABLE || dright == UNDERIVABLE)
+        return UNDERIVABLE;
+    if (!dleft && !dright)
+        return NULL;
+
+    switch (expr->data.operation)
+    {
+    case OP_ADD:
+        if (!dleft)
+            return dright;
+        if (!dright)
+            return dleft;
+        return NewNode(arena, OP_ADD, dleft, dright);
+    case OP_SUB:
+        if (!dright)
+            return dleft;
+        return dleft ? NewNode(arena, OP_SUB, dleft, dright) : Negate(arena, dright);
+    case OP_MUL:
+    {
+        // l' * r + l * r'
+        ExprTree *lhs = dleft ? NewNode(arena, OP_MUL, dleft, CloneExprTree(arena, right)) : NULL;
+        ExprTree *rhs = dright ? NewNode(arena, OP_MUL, CloneExprTree(arena, left), dright) : NULL;
+        if (!lhs)
+            return rhs;
+        if (!rhs)
+            return lhs;
+        return NewNode(arena, OP_ADD, lhs, rhs);
+    }
+    case OP_DIV:
+    {
+        // l' / r - l * r' / (r * r)
+        ExprTree *lhs = dleft ? NewNode(arena, OP_DIV, dleft, CloneExprTree(arena, right)) : NULL;
+        if (!dright)
+            return lhs;
+        ExprTree *square = NewNode(arena, OP_MUL, CloneExprTree(arena, right), CloneExprTree(arena, right));
+        ExprTree *rhs    = NewNode(arena, OP_DIV, NewNode(arena, OP_MUL, CloneExprTree(arena, left), dright), square);
+        return lhs ? NewNode(arena, OP_SUB, lhs, rhs) : Negate(arena, rhs);
+    }
+    case OP_EXP:
+    {
+        // r * l ^ (r - 1) * l' + l ^ r * log(l) * r'
+        ExprTree *lhs = NULL, *rhs = NULL;
+        if (dleft)
+        {
+            ExprTree *slope = PowerSlope(arena, CloneExprTree(arena, left), CloneExprTree(arena, right));
+            lhs             = NewNode(arena, OP_MUL, slope, dleft);
+        }
+        if (dright)
+        {
+            // log takes a plain variable like every builtin, so only such bases can have a varying exponent
+            SymbolVar base;
+            if (!VarFromLeaf(left, &base))
+                return UNDERIVABLE;
+            ExprTree *power     = NewNode(arena, OP_EXP, CloneExprTree(arena, left), CloneExprTree(arena, right));
+            ExprTree *logarithm = NewBuiltinCall(arena, BUILTIN_LOG, &base);
+            rhs                 = NewNode(arena, OP_MUL, NewNode(arena, OP_MUL, power, logarithm), dright);
+        }
+        if (!lhs)
+            return rhs;
+        if (!rhs)
+            return lhs;
+        return NewNode(arena, OP_ADD, lhs, rhs);
+    }
+    default:
+        Assert(!"Unsupported Operation ....");
+        Unreachable();
+    }
+}
+
+// NULL when some part of expr can't be differentiated
+ExprTree *DifferentiateExprTree(ExprArena *arena, ExprTree *expr, uint32_t arg)
+{
+    ExprTree *derivative = Differentiate(arena, expr, arg);
+    if (derivative == UNDERIVABLE)
+        return NULL;
+    return derivative ? derivative : NewConstant(arena, 0.0f);
+}
+
+SymbolFn *DifferentiateSymbolFn(SymbolFn *fn, uint32_t arg)
+{
+    Assert(fn != NULL && arg < fn->args_count);
+
+    SymbolFn *derivative = malloc(sizeof(*derivative));
+    Assert(derivative != NULL);
+    *derivative            = *fn;
+    derivative->tier_state = (TierState){0};
+    // Long names are cut, half the id for each
+    const int half         = (MAX_ID_LEN - 4) / 2;
+    snprintf(derivative->id, sizeof(derivative->id), "d%.*s/d%.*s", half, fn->id, half, fn->args[arg].data.id);
+
+    // Every call is inlined regardless of the budget, the chain rule can't see through calls
+    uint32_t   inlined;
+    ExprArena *arena      = CreateExprArena();
+    ExprTree  *body       = InlineExprTree(arena, CloneExprTree(arena, fn->expr_tree), UINT32_MAX, &inlined);
+    body                  = SimplifyExprTree(arena, body);
+
+    body                  = DifferentiateExprTree(arena, body, arg);
+    if (!body)
+    {
+        DestroyExprArena(arena);
+        free(derivative);
+        return NULL;
+    }
+    derivative->arena      = arena;
+    derivative->expr_tree  = SimplifyExprTree(arena, body);
+    derivative->references = 1;
+    derivative->source     = RetainSymbolFn(fn);
+    derivative->source_arg = arg;
+    // The body has no calls left, it depends on every global the callees of fn read as they are now. Redefinitions of
+    // those callees are followed through source instead, see RefreshComputation.
+    CollectDependencies(derivative);
+    return derivative;
+}
@@ -0,0 +1,160 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Identifier interning
+// Every identifier is stored once per interpreter, so two names are equal exactly when their interned pointers are.
+// Scopes and the builtin registry then hash and compare pointers instead of strings.
+
+static uint32_t HashString(const char *str, uint32_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; ++i)
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+    return hash;
+}
+
+static InternedString *FindInternSlot(Interner *interner, const char *str, uint32_t len, uint32_t hash)
+{
+    uint32_t index = hash & (interner->max - 1);
+    while (interner->strings[index].str)
+    {
+        InternedString *entry = &interner->strings[index];
+        if (entry->hash == hash && entry->len == len && !memcmp(entry->str, str, len))
+            return entry;
+        index = (index + 1) & (interner->max - 1);
+    }
+    return &interner->strings[index];
+}
+
+static void GrowInterner(Interner *interner)
+{
+    uint32_t        old_max     = interner->max;
+    InternedString *old_strings = interner->strings;
+
+    interner->max               = old_max ? old_max * 2 : 256;
+    interner->strings           = calloc(interner->max, sizeof(*interner->strings));
+    Assert(interner->strings != NULL);
+
+    for (uint32_t i = 0; i < old_max; ++i)
+    {
+        if (old_strings[i].str)
+            *FindInternSlot(interner, old_strings[i].str, old_strings[i].len, old_strings[i].hash) = old_strings[i];
+    }
+    free(old_strings);
+}
+
+// str need not be null terminated, the interned copy is
+const char *InternString(Interner *interner, const char *str, uint32_t len)
+{
+    if (2 * (interner->count + 1) > interner->max)
+        GrowInterner(interner);
+
+    uint32_t        hash  = HashString(str, len);
+    InternedString *entry = FindInternSlot(interner, str, len, hash);
+    if (entry->str)
+        return entry->str;
+
+    char *copy = malloc(len + 1);
+    Assert(copy != NULL);
+    memcpy(copy, str, len);
+    copy[len]   = '\0';
+
+    entry->hash = hash;
+    entry->len  = len;
+    entry->str  = copy;
+    interner->count++;
+    return copy;
+}
+
+// NULL when the identifier was never interned, which also means no scope can hold it
+const char *FindInternedString(Interner *interner, const char *str, uint32_t len)
+{
+    if (!interner->max)
+        return NULL;
+    return FindInternSlot(interner, str, len, HashString(str, len))->str;
+}
+
+void DestroyInterner(Interner *interner)
+{
+    for (uint32_t i = 0; i < interner->max; ++i)
+        free((char *)interner->strings[i].str);
+    free(interner->strings);
+    *interner = (Interner){0};
+}
+
+// Name maps
+// Open addressing with linear probing, keyed by (interned name, kind).
+
+static uint32_t HashName(const char *name, uint32_t kind)
+{
+    uintptr_t bits = (uintptr_t)name;
+    uint64_t  hash = ((uint64_t)bits ^ kind) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(hash >> 32);
+}
+
+static NameEntry *FindNameSlot(NameMap *map, const char *name, uint32_t kind)
+{
+    uint32_t index = HashName(name, kind) & (map->max - 1);
+    while (map->entries[index].name)
+    {
+        NameEntry *entry = &map->entries[index];
+        if (entry->name == name && entry->kind == kind)
+            return entry;
+        index = (index + 1) & (map->max - 1);
+    }
+    return &map->entries[index];
+}
+
+static void GrowNameMap(NameMap *map)
+{
+    uint32_t   old_max     = map->max;
+    NameEntry *old_entries = map->entries;
+
+    map->max               = old_max ? old_max * 2 : 16;
+    map->entries           = calloc(map->max, sizeof(*map->entries));
+    Assert(map->entries != NULL);
+
+    for (uint32_t i = 0; i < old_max; ++i)
+    {
+        if (old_entries[i].name)
+            *FindNameSlot(map, old_entries[i].name, old_entries[i].kind) = old_entries[i];
+    }
+    free(old_entries);
+}
+
+// Adds or replaces the slot of name
+void NameMapInsert(NameMap *map, const char *name, uint32_t kind, uint32_t slot)
+{
+    if (2 * (map->count + 1) > map->max)
+        GrowNameMap(map);
+
+    NameEntry *entry = FindNameSlot(map, name, kind);
+    if (!entry->name)
+        map->count++;
+    *entry = (NameEntry){.name = name, .kind = kind, .slot = slot};
+}
+
+bool NameMapFind(NameMap *map, const char *name, uint32_t kind, uint32_t *slot)
+{
+    if (!name || !map->max)
+        return false;
+
+    NameEntry *entry = FindNameSlot(map, name, kind);
+    if (!entry->name)
+        return false;
+    *slot = entry->slot;
+    return true;
+}
+
+void DestroyNameMap(NameMap *map)
+{
+    free(map->entries);
+    *map = (NameMap){0};
+}
@@ -0,0 +1,358 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Interval interpreter
+// Runs a compiled program over a box of arguments instead of a point. Every register holds a range that contains the
+// value of the instruction for every point of the box, so a range of the result that excludes zero proves the function
+// has no root anywhere in the box. Bounds are computed in double and rounded outward to float, the enclosure may be
+// wider than the true range but never narrower.
+//
+// A range is empty when lo > hi, that is the result of sqrt or log over negative numbers only. Empty ranges propagate
+// through every operation, a box where the function is undefined holds no root either.
+
+#define PI 3.14159265358979323846
+
+static const Interval empty  = {INFINITY, -INFINITY};
+static const Interval entire = {-INFINITY, INFINITY};
+
+static bool IsEmpty(Interval a)
+{
+    return a.lo > a.hi;
+}
+
+// Rounds outward by one float ulp, that also covers the error of the double computation and of libm.
+// nan bounds come from inf - inf and the like, the bound could be anything there.
+static Interval Outward(double lo, double hi)
+{
+    Interval result;
+    result.lo = isnan(lo) ? -INFINITY : nextafterf((float)lo, -INFINITY);
+    result.hi = isnan(hi) ? INFINITY : nextafterf((float)hi, INFINITY);
+    return result;
+}
+
+static Interval Point(float value)
+{
+    return (Interval){value, value};
+}
+
+static Interval Clamp(Interval a, float lo, float hi)
+{
+    a.lo = a.lo < lo ? lo : a.lo;
+    a.hi = a.hi > hi ? hi : a.hi;
+    return a;
+}
+
+static Interval IntervalAdd(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    return Outward((double)a.lo + b.lo, (double)a.hi + b.hi);
+}
+
+static Interval IntervalSub(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    return Outward((double)a.lo - b.hi, (double)a.hi - b.lo);
+}
+
+// 0 * inf is taken as 0, the bound it stands for is the product of a zero and a finite number
+static double BoundProduct(double a, double b)
+{
+    return (a == 0.0 || b == 0.0) ? 0.0 : a * b;
+}
+
+static Interval MulBounds(double alo, double ahi, double blo, double bhi)
+{
+    double p[] = {BoundProduct(alo, blo), BoundProduct(alo, bhi), BoundProduct(ahi, blo), BoundProduct(ahi, bhi)};
+    return Outward(fmin(fmin(p[0], p[1]), fmin(p[2], p[3])), fmax(fmax(p[0], p[1]), fmax(p[2], p[3])));
+}
+
+static Interval IntervalMul(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    return MulBounds(a.lo, a.hi, b.lo, b.hi);
+}
+
+static Interval IntervalSquare(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    double lo = fabs((double)a.lo), hi = fabs((double)a.hi);
+    if (a.lo <= 0.0f && a.hi >= 0.0f)
+        return Clamp(Outward(0.0, fmax(lo, hi) * fmax(lo, hi)), 0.0f, INFINITY);
+    return Outward(fmin(lo, hi) * fmin(lo, hi), fmax(lo, hi) * fmax(lo, hi));
+}
+
+static Interval IntervalDiv(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    if (b.lo > 0.0f || b.hi < 0.0f)
+        return MulBounds(a.lo, a.hi, 1.0 / b.hi, 1.0 / b.lo);
+
+    // The divisor holds zero. One sided divisors still bound the quotient on one side, the others would need a union
+    // of two ranges, so they give up on it.
+    if (b.lo == 0.0f && b.hi == 0.0f)
+        return empty;
+    if (b.lo == 0.0f)
+        return MulBounds(a.lo, a.hi, 1.0 / b.hi, INFINITY);
+    if (b.hi == 0.0f)
+        return MulBounds(a.lo, a.hi, -INFINITY, 1.0 / b.lo);
+    return entire;
+}
+
+// True when offset + k * period lies in [lo, hi] for some integer k
+static bool ContainsPeriodic(double lo, double hi, double offset, double period)
+{
+    return offset + ceil((lo - offset) / period) * period <= hi;
+}
+
+Interval IntervalSin(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    if (!isfinite(a.lo) || !isfinite(a.hi) || (double)a.hi - a.lo >= 2 * PI)
+        return (Interval){-1.0f, 1.0f};
+
+    double   s0 = sin(a.lo), s1 = sin(a.hi);
+    Interval r  = Outward(fmin(s0, s1), fmax(s0, s1));
+    if (ContainsPeriodic(a.lo, a.hi, PI / 2, 2 * PI))
+        r.hi = 1.0f;
+    if (ContainsPeriodic(a.lo, a.hi, -PI / 2, 2 * PI))
+        r.lo = -1.0f;
+    return Clamp(r, -1.0f, 1.0f);
+}
+
+Interval IntervalCos(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    if (!isfinite(a.lo) || !isfinite(a.hi) || (double)a.hi - a.lo >= 2 * PI)
+        return (Interval){-1.0f, 1.0f};
+
+    double   c0 = cos(a.lo), c1 = cos(a.hi);
+    Interval r  = Outward(fmin(c0, c1), fmax(c0, c1));
+    if (ContainsPeriodic(a.lo, a.hi, 0.0, 2 * PI))
+        r.hi = 1.0f;
+    if (ContainsPeriodic(a.lo, a.hi, PI, 2 * PI))
+        r.lo = -1.0f;
+    return Clamp(r, -1.0f, 1.0f);
+}
+
+// Increasing between the poles at pi / 2 + k pi, anything spanning one is unbounded
+Interval IntervalTan(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    if (!isfinite(a.lo) || !isfinite(a.hi) || ContainsPeriodic(a.lo, a.hi, PI / 2, PI))
+        return entire;
+    return Outward(tan(a.lo), tan(a.hi));
+}
+
+Interval IntervalExp(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    return Outward(exp(a.lo), exp(a.hi));
+}
+
+// Defined for x >= 0 only, the negative part of the range is dropped
+Interval IntervalSqrt(Interval a)
+{
+    if (IsEmpty(a) || a.hi < 0.0f)
+        return empty;
+    Interval r = Outward(a.lo > 0.0f ? sqrt(a.lo) : 0.0, sqrt(a.hi));
+    return Clamp(r, 0.0f, INFINITY);
+}
+
+// Defined for x > 0 only, log 0 is -inf
+Interval IntervalLog(Interval a)
+{
+    if (IsEmpty(a) || a.hi < 0.0f)
+        return empty;
+    return Outward(a.lo > 0.0f ? log(a.lo) : -INFINITY, log(a.hi));
+}
+
+Interval IntervalAbs(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    if (a.lo >= 0.0f)
+        return a;
+    if (a.hi <= 0.0f)
+        return (Interval){-a.hi, -a.lo};
+    return (Interval){0.0f, fmaxf(-a.lo, a.hi)};
+}
+
+// Monotonic, and exact on floats
+Interval IntervalFloor(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    return (Interval){floorf(a.lo), floorf(a.hi)};
+}
+
+Interval IntervalMin(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    return (Interval){fminf(a.lo, b.lo), fminf(a.hi, b.hi)};
+}
+
+Interval IntervalMax(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    return (Interval){fmaxf(a.lo, b.lo), fmaxf(a.hi, b.hi)};
+}
+
+// Over positive bases pow is exp(b * log(a)). A single constant exponent also covers negative bases, where pow is
+// monotonic on each side of zero. Other exponents over bases reaching zero give up on bounds.
+Interval IntervalPow(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    if (a.lo > 0.0f)
+        return IntervalExp(IntervalMul(b, IntervalLog(a)));
+    if (b.lo != b.hi)
+        return entire;
+
+    double n = b.lo;
+    if (n == 0.0)
+        return Point(1.0f);
+    // Real cube roots, as Power takes them
+    if (b.lo == (float)(1.0 / 3.0))
+        return IntervalCbrt(a);
+    if (b.lo == (float)(-1.0 / 3.0))
+        return IntervalDiv(Point(1.0f), IntervalCbrt(a));
+    if (n != floor(n))
+    {
+        // Not an integer, defined for a >= 0 only
+        if (a.hi < 0.0f)
+            return empty;
+        double lo = a.lo > 0.0f ? a.lo : 0.0, hi = a.hi;
+        double p0 = pow(lo, n), p1 = pow(hi, n);
+        return Clamp(Outward(fmin(p0, p1), fmax(p0, p1)), 0.0f, INFINITY);
+    }
+
+    double p0 = pow(a.lo, n), p1 = pow(a.hi, n);
+    bool   even = fmod(n, 2.0) == 0.0;
+    if (a.lo <= 0.0f && a.hi >= 0.0f)
+    {
+        // Negative powers have a pole at zero
+        if (n < 0.0)
+            return even ? Clamp(Outward(fmin(p0, p1), INFINITY), 0.0f, INFINITY) : entire;
+        if (even)
+            return Clamp(Outward(0.0, fmax(p0, p1)), 0.0f, INFINITY);
+    }
+    return Outward(fmin(p0, p1), fmax(p0, p1));
+}
+
+// Exact over boxes inside one of the half planes where atan2 is continuous, each bound is reached at a corner
+Interval IntervalAtan2(Interval y, Interval x)
+{
+    if (IsEmpty(y) || IsEmpty(x))
+        return empty;
+    // The branch cut runs along negative x
+    if (x.lo > 0.0f || y.lo > 0.0f || y.hi < 0.0f)
+    {
+        double c[] = {atan2(y.lo, x.lo), atan2(y.lo, x.hi), atan2(y.hi, x.lo), atan2(y.hi, x.hi)};
+        return Clamp(Outward(fmin(fmin(c[0], c[1]), fmin(c[2], c[3])), fmax(fmax(c[0], c[1]), fmax(c[2], c[3]))),
+                     (float)-PI, (float)PI);
+    }
+    return Outward(-PI, PI);
+}
+
+// Within one period of the divisor the result is a shifted copy of the dividend, otherwise it is [0, b) or (b, 0]
+Interval IntervalMod(Interval a, Interval b)
+{
+    if (IsEmpty(a) || IsEmpty(b))
+        return empty;
+    if (b.lo == b.hi && b.lo != 0.0f && isfinite(b.lo))
+    {
+        double n = floor((double)a.lo / b.lo);
+        if (n == floor((double)a.hi / b.lo))
+            return Outward(a.lo - n * b.lo, a.hi - n * b.lo);
+    }
+    if (b.lo > 0.0f)
+        return Outward(0.0, b.hi);
+    if (b.hi < 0.0f)
+        return Outward(b.lo, 0.0);
+    return entire;
+}
+
+Interval IntervalCbrt(Interval a)
+{
+    if (IsEmpty(a))
+        return empty;
+    return Outward(cbrt(a.lo), cbrt(a.hi));
+}
+
+// registers must hold program->count ranges. Arguments past y are read as points from frames.
+Interval ExecuteProgramInterval(Program *program, FrameStack *frames, Interval *registers, Interval x, Interval y)
+{
+    const Instruction *code   = program->code;
+    const uint32_t     count  = program->count;
+    const float       *args   = frames->values + frames->base;
+    SymbolTable      **tables = program->stack->symbol_tables;
+
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        const Instruction ins = code[pc];
+        Interval         *r   = registers + pc;
+
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+            *r = Point(ins.value);
+            break;
+        case OPCODE_ARG:
+            *r = ins.a == 0 ? x : ins.a == 1 ? y : Point(args[ins.a]);
+            break;
+        case OPCODE_LOAD:
+            *r = Point(tables[ins.a]->variables[ins.b].data.value);
+            break;
+        case OPCODE_ADD:
+            *r = IntervalAdd(registers[ins.a], registers[ins.b]);
+            break;
+        case OPCODE_SUB:
+            *r = IntervalSub(registers[ins.a], registers[ins.b]);
+            break;
+        case OPCODE_MUL:
+            // Both operands are the same value when the compiler shared them, x * x is never negative
+            if (ins.a == ins.b)
+            {
+                *r = IntervalSquare(registers[ins.a]);
+                break;
+            }
+            *r = IntervalMul(registers[ins.a], registers[ins.b]);
+            break;
+        case OPCODE_DIV:
+            *r = IntervalDiv(registers[ins.a], registers[ins.b]);
+            break;
+        case OPCODE_BUILTIN:
+            *r = builtins.functions[ins.b].interval ? builtins.functions[ins.b].interval(registers[ins.a]) : entire;
+            break;
+        case OPCODE_BUILTIN2:
+        {
+            interval2_fn fn = builtins.functions[ins.c].interval2;
+            *r              = fn ? fn(registers[ins.a], registers[ins.b]) : entire;
+            break;
+        }
+        default:
+            Assert(!"Calls must be inlined before evaluating over intervals");
+            Unreachable();
+        }
+    }
+    return registers[count - 1];
+}
@@ -0,0 +1,345 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS under -std=c11
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// x86-64 JIT
+// Translates a compiled program into native code computing in double precision with scalar SSE2. Every register of
+// the program gets a stack slot and each instruction becomes a load, the operation and a store, with the last result
+// kept in xmm0 when the next instruction consumes it. Globals are read from their symbol table slot on every call, so
+// redefinitions are seen without recompiling. Builtins are called through their C function pointers. The code keeps no
+// state of its own, so any number of threads may run it at once.
+//
+// The generated function takes x in xmm0 and y in xmm1 and returns in xmm0, which is the same on System V and on
+// Windows, so it is a plain double (*)(double, double). A second entry four bytes earlier clears y for the
+// double (*)(double) signature.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X86_64
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
+
+struct JitFunction
+{
+    uint8_t *memory;
+    size_t   size;
+    JitFn1D  entry_1d;
+    JitFn2D  entry_2d;
+};
+
+#if defined(JIT_X86_64)
+
+typedef struct CodeBuffer
+{
+    uint32_t count;
+    uint32_t max;
+    uint8_t *bytes;
+} CodeBuffer;
+
+static void EmitBytes(CodeBuffer *code, const uint8_t *bytes, uint32_t len)
+{
+    while (code->count + len > code->max)
+    {
+        code->max   = code->max ? code->max * 2 : 256;
+        code->bytes = realloc(code->bytes, code->max);
+        Assert(code->bytes != NULL);
+    }
+    memcpy(code->bytes + code->count, bytes, len);
+    code->count = code->count + len;
+}
+
+static void EmitImm32(CodeBuffer *code, int32_t value)
+{
+    uint8_t bytes[4];
+    memcpy(bytes, &value, sizeof(bytes)); // x86 is little endian, so is every host running this code
+    EmitBytes(code, bytes, sizeof(bytes));
+}
+
+static void EmitImm64(CodeBuffer *code, uint64_t value)
+{
+    uint8_t bytes[8];
+    memcpy(bytes, &value, sizeof(bytes));
+    EmitBytes(code, bytes, sizeof(bytes));
+}
+
+// <prefix> 0F <op> xmm, [rbp + disp32]
+static void EmitSSEFrame(CodeBuffer *code, uint8_t prefix, uint8_t op, uint8_t xmm, int32_t disp)
+{
+    uint8_t bytes[] = {prefix, 0x0F, op, (uint8_t)(0x85 | (xmm << 3))};
+    EmitBytes(code, bytes, sizeof(bytes));
+    EmitImm32(code, disp);
+}
+
+// mov rax, imm64
+static void EmitMovRax(CodeBuffer *code, uint64_t value)
+{
+    uint8_t bytes[] = {0x48, 0xB8};
+    EmitBytes(code, bytes, sizeof(bytes));
+    EmitImm64(code, value);
+}
+
+#define SSE_MOVSD_LOAD  0x10
+#define SSE_MOVSD_STORE 0x11
+#define SSE_SQRTSD      0x51
+#define SSE_ADDSD       0x58
+#define SSE_MULSD       0x59
+#define SSE_SUBSD       0x5C
+#define SSE_DIVSD       0x5E
+
+#define JIT_STACK_PAGE  4096
+
+static int32_t RegisterSlot(uint32_t reg)
+{
+    return -8 * (int32_t)(reg + 1);
+}
+
+static bool TranslateProgram(Program *program, CodeBuffer *code)
+{
+    const uint32_t count  = program->count;
+    const int32_t  slot_x = RegisterSlot(count);
+    const int32_t  slot_y = RegisterSlot(count + 1);
+
+    // Slots for every register and both arguments, plus the 32 bytes of shadow space Windows wants below calls
+    uint32_t       frame  = 8 * (count + 2) + 32;
+    frame                 = (frame + 15) & ~15u;
+
+    // entry_1d : xorpd xmm1, xmm1
+    const uint8_t clear_y[] = {0x66, 0x0F, 0x57, 0xC9};
+    EmitBytes(code, clear_y, sizeof(clear_y));
+
+    // entry_2d : push rbp; mov rbp, rsp; sub rsp, frame
+    const uint8_t prologue[] = {0x55, 0x48, 0x89, 0xE5};
+    EmitBytes(code, prologue, sizeof(prologue));
+    const uint8_t sub_rsp[] = {0x48, 0x81, 0xEC};
+#if defined(_WIN32)
+    // Windows commits the stack one guard page at a time, so a frame of a page or more is touched page by page on the
+    // way down, as __chkstk would : sub rsp, 4096; test [rsp], rsp
+    for (; frame >= JIT_STACK_PAGE; frame -= JIT_STACK_PAGE)
+    {
+        EmitBytes(code, sub_rsp, sizeof(sub_rsp));
+        EmitImm32(code, JIT_STACK_PAGE);
+        const uint8_t probe[] = {0x48, 0x85, 0x24, 0x24};
+        EmitBytes(code, probe, sizeof(probe));
+    }
+#endif
+    EmitBytes(code, sub_rsp, sizeof(sub_rsp));
+    EmitImm32(code, (int32_t)frame);
+    EmitSSEFrame(code, 0xF2, SSE_MOVSD_STORE, 0, slot_x);
+    EmitSSEFrame(code, 0xF2, SSE_MOVSD_STORE, 1, slot_y);
+
+    // Register whose value is currently in xmm0, if any
+    int64_t live = -1;
+
+    for (uint32_t pc = 0; pc < count; ++pc)
+    {
+        const Instruction ins = program->code[pc];
+        switch (ins.opcode)
+        {
+        case OPCODE_CONST:
+        {
+            // mov rax, bits; movq xmm0, rax
+            double   value = ins.value;
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            EmitMovRax(code, bits);
+            const uint8_t movq[] = {0x66, 0x48, 0x0F, 0x6E, 0xC0};
+            EmitBytes(code, movq, sizeof(movq));
+            break;
+        }
+        case OPCODE_ARG:
+            if (ins.a < 2)
+                EmitSSEFrame(code, 0xF2, SSE_MOVSD_LOAD, 0, ins.a ? slot_y : slot_x);
+            else
+            {
+                // Only x and y are passed, the remaining arguments read as 0 like the interpreters
+                const uint8_t xorpd[] = {0x66, 0x0F, 0x57, 0xC0};
+                EmitBytes(code, xorpd, sizeof(xorpd));
+            }
+            break;
+        case OPCODE_LOAD:
+        {
+            // The variables array of a scope moves when it grows, so it is reloaded from the table on every call.
+            // mov rax, &table->variables; mov rax, [rax]; cvtss2sd xmm0, [rax + offset]
+            SymbolTable *table = program->stack->symbol_tables[ins.a];
+            EmitMovRax(code, (uint64_t)(uintptr_t)&table->variables);
+            const uint8_t load_variables[] = {0x48, 0x8B, 0x00, 0xF3, 0x0F, 0x5A, 0x80};
+            EmitBytes(code, load_variables, sizeof(load_variables));
+            EmitImm32(code, (int32_t)(ins.b * sizeof(SymbolVar) + offsetof(SymbolVar, data.value)));
+            break;
+        }
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        {
+            uint8_t op       = ins.opcode == OPCODE_ADD   ? SSE_ADDSD
+                               : ins.opcode == OPCODE_SUB ? SSE_SUBSD
+                               : ins.opcode == OPCODE_MUL ? SSE_MULSD
+                                                          : SSE_DIVSD;
+            bool    commutes = ins.opcode == OPCODE_ADD || ins.opcode == OPCODE_MUL;
+            if (commutes && live == ins.b && live != ins.a)
+            {
+                EmitSSEFrame(code, 0xF2, op, 0, RegisterSlot(ins.a));
+                break;
+            }
+            if (live != ins.a)
+                EmitSSEFrame(code, 0xF2, SSE_MOVSD_LOAD, 0, RegisterSlot(ins.a));
+            EmitSSEFrame(code, 0xF2, op, 0, RegisterSlot(ins.b));
+            break;
+        }
+        case OPCODE_BUILTIN:
+        {
+            fn_ptr fn = builtins.functions[ins.b].fn;
+            if (ins.b == BUILTIN_SQRT)
+            {
+                EmitSSEFrame(code, 0xF2, SSE_SQRTSD, 0, RegisterSlot(ins.a));
+                break;
+            }
+            if (live != ins.a)
+                EmitSSEFrame(code, 0xF2, SSE_MOVSD_LOAD, 0, RegisterSlot(ins.a));
+            // mov rax, fn; call rax
+            EmitMovRax(code, (uint64_t)(uintptr_t)fn);
+            const uint8_t call[] = {0xFF, 0xD0};
+            EmitBytes(code, call, sizeof(call));
+            break;
+        }
+        case OPCODE_BUILTIN2:
+        {
+            // Arguments in xmm0 and xmm1, on both calling conventions
+            if (live != ins.a)
+                EmitSSEFrame(code, 0xF2, SSE_MOVSD_LOAD, 0, RegisterSlot(ins.a));
+            EmitSSEFrame(code, 0xF2, SSE_MOVSD_LOAD, 1, RegisterSlot(ins.b));
+            EmitMovRax(code, (uint64_t)(uintptr_t)builtins.functions[ins.c].fn2);
+            const uint8_t call[] = {0xFF, 0xD0};
+            EmitBytes(code, call, sizeof(call));
+            break;
+        }
+        default:
+            // Calls that were not inlined need the interpreter's frame stack
+            return false;
+        }
+        EmitSSEFrame(code, 0xF2, SSE_MOVSD_STORE, 0, RegisterSlot(pc));
+        live = pc;
+    }
+
+    // The result is in xmm0 already. mov rsp, rbp; pop rbp; ret
+    const uint8_t epilogue[] = {0x48, 0x89, 0xEC, 0x5D, 0xC3};
+    EmitBytes(code, epilogue, sizeof(epilogue));
+    return true;
+}
+
+static uint8_t *AllocateExecutable(const uint8_t *bytes, size_t len, size_t *size)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t   page   = info.dwPageSize;
+    *size           = (len + page - 1) / page * page;
+    uint8_t *memory = VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!memory)
+        return NULL;
+    memcpy(memory, bytes, len);
+    DWORD old;
+    if (!VirtualProtect(memory, *size, PAGE_EXECUTE_READ, &old))
+    {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        return NULL;
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, *size);
+#else
+    size_t   page   = (size_t)sysconf(_SC_PAGESIZE);
+    *size           = (len + page - 1) / page * page;
+    uint8_t *memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return NULL;
+    memcpy(memory, bytes, len);
+    // Never writable and executable at once
+    if (mprotect(memory, *size, PROT_READ | PROT_EXEC))
+    {
+        munmap(memory, *size);
+        return NULL;
+    }
+#endif
+    return memory;
+}
+
+static void FreeExecutable(uint8_t *memory, size_t size)
+{
+#if defined(_WIN32)
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+#endif
+
+JitFunction *JitCompile(ComputationContext *context)
+{
+    Assert(context != NULL);
+    return JitCompileProgram(ComputationProgram(context));
+}
+
+JitFunction *JitCompileProgram(Program *program)
+{
+#if defined(JIT_X86_64)
+    CodeBuffer code = {0};
+    if (!TranslateProgram(program, &code))
+    {
+        free(code.bytes);
+        return NULL;
+    }
+
+    size_t   size;
+    uint8_t *memory = AllocateExecutable(code.bytes, code.count, &size);
+    free(code.bytes);
+    if (!memory)
+        return NULL;
+
+    JitFunction *jit = malloc(sizeof(*jit));
+    Assert(jit != NULL);
+    jit->memory   = memory;
+    jit->size     = size;
+    // Converting between data and function pointers is fine on every platform this code is generated for
+    jit->entry_1d = (JitFn1D)(uintptr_t)memory;
+    jit->entry_2d = (JitFn2D)(uintptr_t)(memory + 4);
+    return jit;
+#else
+    (void)program;
+    return NULL;
+#endif
+}
+
+JitFn1D JitEntry1D(JitFunction *jit)
+{
+    return jit ? jit->entry_1d : NULL;
+}
+
+JitFn2D JitEntry2D(JitFunction *jit)
+{
+    return jit ? jit->entry_2d : NULL;
+}
+
+void JitDestroy(JitFunction *jit)
+{
+    if (!jit)
+        return;
+#if defined(JIT_X86_64)
+    FreeExecutable(jit->memory, jit->size);
+#endif
+    free(jit);
+}
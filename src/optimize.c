@@ -0,0 +1,302 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Tree level optimizations, run on a private copy of the tree right before it is compiled.
+// The tree owned by the SymbolFn is left as parsed, the tree walker and other functions calling into it still use it.
+
+// Call sites are copied along with the nodes, the inliner rewrites the arguments of the copy
+ExprTree *CloneExprTree(ExprArena *arena, ExprTree *expr)
+{
+    if (!expr)
+        return NULL;
+
+    ExprTree *clone = ArenaAlloc(arena, sizeof(*clone));
+    *clone          = *expr;
+    if (expr->node_type == NODE && expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        FuncData *copy    = ArenaAlloc(arena, sizeof(*copy));
+        *copy             = *fn_data;
+        copy->args        = ArenaAlloc(arena, sizeof(*copy->args) * (fn_data->args_used ? fn_data->args_used : 1));
+        memcpy(copy->args, fn_data->args, sizeof(*copy->args) * fn_data->args_used);
+        clone->data.term.value.func_data = copy;
+        return clone;
+    }
+    clone->left  = CloneExprTree(arena, expr->left);
+    clone->right = CloneExprTree(arena, expr->right);
+    return clone;
+}
+
+// Count of instructions a straight compilation of the tree would emit
+uint32_t CountExprTree(ExprTree *expr)
+{
+    if (!expr)
+        return 0;
+    if (expr->node_type == LEAF)
+        return 1;
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        return fn_data->is_builtin ? fn_data->args_used + 1 : 1;
+    }
+    return 1 + CountExprTree(expr->left) + CountExprTree(expr->right);
+}
+
+// Inlining
+// A call to a user function is replaced by a copy of the callee's tree whose parameters are replaced by the arguments
+// of the call. Calls inside the inlined body are inlined in turn, as long as the budget lasts.
+
+void SetInlineBudget(Interpreter *interpreter, uint32_t budget)
+{
+    interpreter->inline_budget = budget;
+}
+
+// Arguments of the call site, read by the callee's parameter slot
+static SymbolVar SubstituteVar(SymbolVar var, FuncData *call)
+{
+    if (var.var_type == VAR_ARG)
+        return call->args[var.binding.slot];
+    return var;
+}
+
+// Rewrites a copy of the callee's body so that it reads the caller's values instead of its own parameters
+static void SubstituteArgs(ExprTree *expr, FuncData *call)
+{
+    if (!expr)
+        return;
+
+    if (expr->node_type == LEAF)
+    {
+        if (expr->data.term.type != TERM_ARG)
+            return;
+
+        SymbolVar arg = call->args[expr->data.term.value.binding.slot];
+        switch (arg.var_type)
+        {
+        case VAR_VALUE:
+            expr->data.term.type        = TERM_VALUE;
+            expr->data.term.value.value = arg.data.value;
+            break;
+        case VAR_ARG:
+            expr->data.term.type          = TERM_ARG;
+            expr->data.term.value.binding = arg.binding;
+            break;
+        case VAR_SLOT:
+            expr->data.term.type          = TERM_SLOT;
+            expr->data.term.value.binding = arg.binding;
+            break;
+        default:
+            Assert(!"Unbound function argument");
+        }
+        return;
+    }
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        for (uint32_t arg = 0; arg < fn_data->args_used; ++arg)
+            fn_data->args[arg] = SubstituteVar(fn_data->args[arg], call);
+        return;
+    }
+
+    SubstituteArgs(expr->left, call);
+    SubstituteArgs(expr->right, call);
+}
+
+static ExprTree *InlineCalls(ExprArena *arena, ExprTree *expr, uint32_t *budget, uint32_t *inlined)
+{
+    if (!expr || expr->node_type == LEAF)
+        return expr;
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        if (fn_data->is_builtin)
+            return expr;
+
+        uint32_t size = CountExprTree(fn_data->fn->expr_tree);
+        if (size > *budget)
+            return expr;
+        *budget = *budget - size;
+
+        // The call node is left behind in the arena, it goes away with the rest of the tree
+        ExprTree *body = CloneExprTree(arena, fn_data->fn->expr_tree);
+        SubstituteArgs(body, fn_data);
+        *inlined = *inlined + 1;
+        return InlineCalls(arena, body, budget, inlined);
+    }
+
+    expr->left  = InlineCalls(arena, expr->left, budget, inlined);
+    expr->right = InlineCalls(arena, expr->right, budget, inlined);
+    return expr;
+}
+
+// Returns the tree with calls inlined, inlined receives the count of call sites replaced. Inlined bodies are copied into
+// arena, which must be the arena of expr, until budget nodes have been inlined.
+ExprTree *InlineExprTree(ExprArena *arena, ExprTree *expr, uint32_t budget, uint32_t *inlined)
+{
+    *inlined = 0;
+    return InlineCalls(arena, expr, &budget, inlined);
+}
+
+// Simplification
+
+static bool IsConstant(ExprTree *expr, float *value)
+{
+    if (expr->node_type != LEAF || expr->data.term.type != TERM_VALUE)
+        return false;
+    if (value)
+        *value = expr->data.term.value.value;
+    return true;
+}
+
+static bool IsConstantValue(ExprTree *expr, float value)
+{
+    float constant;
+    return IsConstant(expr, &constant) && constant == value;
+}
+
+// Turns the node into a constant leaf, dropped children stay in the arena until the tree is released
+static ExprTree *MakeConstant(ExprTree *expr, float value)
+{
+    expr->node_type             = LEAF;
+    expr->left                  = NULL;
+    expr->right                 = NULL;
+    expr->data.term.type        = TERM_VALUE;
+    expr->data.term.value.value = value;
+    return expr;
+}
+
+// Keeps one child of the node in its place
+static ExprTree *KeepChild(ExprTree *expr, bool keep_left)
+{
+    return keep_left ? expr->left : expr->right;
+}
+
+static ExprTree *NewOperation(ExprArena *arena, Op operation, ExprTree *left, ExprTree *right)
+{
+    ExprTree *node       = ArenaAlloc(arena, sizeof(*node));
+    node->node_type      = NODE;
+    node->data.operation = operation;
+    node->left           = left;
+    node->right          = right;
+    return node;
+}
+
+// Largest integer exponent multiplied out, past it the error of the chain grows beyond a few ulp
+#define MAX_CHAIN_POWER 16
+
+// base ^ n by squaring. The copies of a subtree compile to one register, so it costs about 2 log2(n) multiplications.
+static ExprTree *PowerChain(ExprArena *arena, ExprTree *base, uint32_t n)
+{
+    if (n == 1)
+        return base;
+    ExprTree *half   = PowerChain(arena, base, n / 2);
+    ExprTree *square = NewOperation(arena, OP_MUL, half, CloneExprTree(arena, half));
+    if (n % 2)
+        return NewOperation(arena, OP_MUL, square, CloneExprTree(arena, base));
+    return square;
+}
+
+// Powers with a constant exponent. Small integers become multiplications : polynomials are most of what gets plotted
+// and pow is several times slower than the few multiplications they need. Fractional exponents are left to the
+// compiler, which has sqrt and cbrt for the common ones.
+static ExprTree *ReducePower(ExprArena *arena, ExprTree *expr, float n)
+{
+    if (n == 0.0f)
+        return MakeConstant(expr, 1.0f); // pow(x, 0) is 1 even for nan
+    if (n != floorf(n) || fabsf(n) > MAX_CHAIN_POWER)
+        return expr;
+
+    ExprTree *chain = PowerChain(arena, expr->left, (uint32_t)fabsf(n));
+    if (n > 0.0f)
+        return chain;
+    ExprTree *one = MakeConstant(ArenaAlloc(arena, sizeof(*one)), 1.0f);
+    return NewOperation(arena, OP_DIV, one, chain);
+}
+
+// Folds constant subtrees and applies identities that hold for every float :
+// x * 1, 1 * x, x / 1, x - 0, x ^ 0 and x ^ 1.
+// x * 0 is left alone, it is nan for infinite x, and so is x + 0, which turns -0 into +0. Small integer powers are
+// multiplied out.
+ExprTree *SimplifyExprTree(ExprArena *arena, ExprTree *expr)
+{
+    if (!expr || expr->node_type == LEAF)
+        return expr;
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        if (!fn_data->is_builtin)
+            return expr;
+
+        const Builtin *builtin = &builtins.functions[fn_data->builtin_index];
+        for (uint32_t arg = 0; arg < builtin->arity; ++arg)
+        {
+            if (fn_data->args[arg].var_type != VAR_VALUE)
+                return expr;
+        }
+        float a = fn_data->args[0].data.value;
+        if (builtin->arity == 1)
+            return MakeConstant(expr, (float)builtin->fn(a));
+        return MakeConstant(expr, (float)builtin->fn2(a, fn_data->args[1].data.value));
+    }
+
+    expr->left  = SimplifyExprTree(arena, expr->left);
+    expr->right = SimplifyExprTree(arena, expr->right);
+
+    float left, right;
+    if (IsConstant(expr->left, &left) && IsConstant(expr->right, &right))
+    {
+        // Computed in float, as the interpreters would
+        switch (expr->data.operation)
+        {
+        case OP_ADD:
+            return MakeConstant(expr, left + right);
+        case OP_SUB:
+            return MakeConstant(expr, left - right);
+        case OP_MUL:
+            return MakeConstant(expr, left * right);
+        case OP_DIV:
+            return MakeConstant(expr, left / right);
+        case OP_EXP:
+            return MakeConstant(expr, (float)Power(left, right));
+        default:
+            return expr;
+        }
+    }
+
+    switch (expr->data.operation)
+    {
+    case OP_SUB:
+        // Only +0 : x - (-0) is x + 0
+        if (IsConstantValue(expr->right, 0.0f) && !signbit(expr->right->data.term.value.value))
+            return KeepChild(expr, true);
+        break;
+    case OP_MUL:
+        if (IsConstantValue(expr->right, 1.0f))
+            return KeepChild(expr, true);
+        if (IsConstantValue(expr->left, 1.0f))
+            return KeepChild(expr, false);
+        break;
+    case OP_DIV:
+        if (IsConstantValue(expr->right, 1.0f))
+            return KeepChild(expr, true);
+        break;
+    case OP_EXP:
+        if (IsConstant(expr->right, &right))
+            return ReducePower(arena, expr, right);
+        break;
+    default:
+        break;
+    }
+    return expr;
+}
@@ -9,7 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "./parser.h"
+#include "./parser_common.h"
 
 // A Tokenizer for the expression that could be drawn in the plotter
 
@@ -24,26 +24,6 @@
  * stmt :- var | stmt * stmt | stmt + stmt | stmt - stmt | stmt / stmt
  */
 
-#if defined(__GNUC__)
-#define Unreachable() __builtin_unreachable()
-#elif defined(_MSC_VER)
-#define Unreachable() __assume(false);
-#endif
-
-#define Unimplemented()                                                                                                \
-    {                                                                                                                  \
-        fprintf(stderr, "Function %s() not implemented : %d.", __func__, __LINE__);                                    \
-        abort();                                                                                                       \
-    }
-#define Assert(str)                                                                                                    \
-    {                                                                                                                  \
-        if (!(str))                                                                                                    \
-        {                                                                                                              \
-            fprintf(stderr, "Function : %s() Line : %d Assertion Failed : %s.\n", __func__, __LINE__, #str);           \
-            abort();                                                                                                   \
-        }                                                                                                              \
-    }
-
 void print_dummy(int a, ...)
 {
     fprintf(stderr, "Can't format");
@@ -65,7 +45,8 @@ void print_str(const char *name, const char *str)
 }
 // Generic print function
 #define print_generic(x)                                                                                               \
-    _Generic((x), int : print_int, float : print_float, char * : print_str, default : unknown_print)(#x, x)
+    _Generic((x), int : print_int, float : print_float, char * : print_str, const char * : print_str,                 \
+             default : unknown_print)(#x, x)
 
 #define GEN_PRINT(TYPE, SPECIFIER)                                                                                     \
     void print_##TYPE(const char *str, TYPE x)                                                                         \
@@ -88,8 +69,6 @@ GEN_PRINT(unsigned, "%u");
 GEN_PRINT(float, "%f");
 GEN_PRINT(char, "%c");
 
-#define MAX_ID_LEN 64
-
 typedef enum TokenType
 {
     TOKEN_COMMA,
@@ -109,113 +88,16 @@ typedef enum TokenType
     TOKEN_END
 } TokenType;
 
-typedef struct TokenVar
-{
-    char     id[50];
-
-    uint32_t param_len;
-    // Need recursive data types here
-    struct TokenVar *params; // not much than this, its bad, look at this
-} TokenVar;
-
+// Tokens are views into the source buffer, nothing is copied while tokenizing. Numbers are decoded once by the
+// tokenizer, identifiers are read from the buffer by whoever needs their name.
 typedef struct Token
 {
     TokenType type;
-    union {
-        struct
-        {
-            uint16_t len;
-            char     name[MAX_ID_LEN];
-        } token_id;
-
-        TokenVar token_var;
-
-        struct
-        {
-            uint32_t value;
-        } token_num;
-    };
+    uint32_t  offset; // of the first byte in the buffer
+    uint32_t  len;
+    float     value;  // TOKEN_NUM only
 } Token;
 
-typedef enum
-{
-    OP_ADD,
-    OP_SUB,
-    OP_DIV,
-    OP_MUL,
-    OP_EXP,
-    OP_EQUAL,
-    OP_FUNC_APPLY,
-    OP_NONE
-} Op;
-
-typedef enum
-{
-    NODE,
-    LEAF
-} NodeType;
-
-typedef enum TermType
-{
-    TERM_FUNC, // for function definitions and calling
-    TERM_ID,   // for simple variables with values
-    TERM_VALUE
-} TermType;
-
-typedef enum
-{
-    VAR_ID,
-    VAR_VALUE
-} SymbolVarType;
-
-typedef struct SymbolVar
-{
-    SymbolVarType var_type;
-    struct
-    {
-        char  id_len;
-        char  id[MAX_ID_LEN];
-        float value;
-    } data; // named just for convenience
-} SymbolVar;
-
-typedef struct SymbolFn SymbolFn;
-
-typedef struct
-{
-    bool      is_builtin;
-    uint32_t  builtin_index;
-    uint32_t  args_used; // count of arguments used in calling the functions
-    SymbolVar args[10];  // arguments passed to the function
-    SymbolFn *fn;        // Reference to actual function being invoked
-} FuncData;
-
-typedef struct
-{
-    // could be num or variable or function invocation too
-    // handle all these cases
-    TermType type;
-    union {
-        float value;
-        char  id[MAX_ID_LEN];
-        // func not declared as of now
-        FuncData func_data;
-    } value;
-} Terminal;
-
-typedef struct ExprTree
-{
-    NodeType node_type;
-
-    union {
-        Op       operation;
-        Terminal term;
-    } data;
-
-    struct ExprTree *left;
-    struct ExprTree *right;
-} ExprTree;
-
 typedef struct
 {
     struct
@@ -224,32 +106,11 @@ typedef struct
         uint32_t len;
         uint32_t pos;
     } buffer;
-} Tokenizer;
-
-typedef double (*fn_ptr)(double f);
-typedef struct BuiltinFunctions
-{
-    struct
-    {
-        const char *name;
-        fn_ptr      fn;
-    } functions[10];
-} BuiltinFunctions;
 
-BuiltinFunctions builtins;
-
-void             InitBuiltinFunctions()
-{
-    memset(builtins.functions, 0, sizeof(builtins.functions));
+    bool  has_lookahead; // lookahead was scanned already and is the next token
+    Token lookahead;
+} Tokenizer;
 
-    const char *fn_name[] = {"sin", "cos", "tan", "exp", "sqrt", "log"};
-    fn_ptr      fn_ptrs[] = {sin, cos, tan, exp, sqrt, log};
-    for (uint32_t fn = 0; fn < sizeof(fn_ptrs) / sizeof(*fn_ptrs); ++fn)
-    {
-        builtins.functions[fn].name = fn_name[fn];
-        builtins.functions[fn].fn   = fn_ptrs[fn];
-    }
-}
 // EResult
 float EvalExprTree(ExprTree *expr)
 {
@@ -282,6 +143,8 @@ float EvalExprTree(ExprTree *expr)
         return EvalExprTree(expr->left) * EvalExprTree(expr->right);
     case OP_DIV:
         return EvalExprTree(expr->left) / EvalExprTree(expr->right);
+    case OP_EXP:
+        return (float)Power(EvalExprTree(expr->left), EvalExprTree(expr->right));
     case OP_FUNC_APPLY:
         Unimplemented();
     default:
@@ -308,101 +171,141 @@ bool IsWhiteSpace(char ch)
 {
     return ch == '\t' || ch == ' ' || ch == '\n';
 }
-Token TokenizeNext(Tokenizer *tokenizer);
-
-// Lets try simple parsing for now
-// Try to lookahead token without actually consuming it
-Token TokenizerLookahead(Tokenizer *tokenizer)
+// Digits with an optional fraction. Up to 19 significant digits are gathered in an integer, so the usual literals are
+// a single division by an exact power of ten.
+static float ScanNumber(Tokenizer *tokenizer)
 {
-    uint32_t pos          = tokenizer->buffer.pos;
+    const uint8_t *data     = tokenizer->buffer.data;
+    const uint32_t len      = tokenizer->buffer.len;
+    uint32_t       pos      = tokenizer->buffer.pos;
 
-    Token    tok          = TokenizeNext(tokenizer);
+    uint64_t       mantissa = 0;
+    uint32_t       digits   = 0;
+    int32_t        scale    = 0;
+
+    for (; pos < len && IsDigit(data[pos]); ++pos)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (data[pos] - '0');
+            digits   = digits + (mantissa != 0);
+        }
+        else
+            scale++;
+    }
+    if (pos < len && data[pos] == '.')
+    {
+        for (++pos; pos < len && IsDigit(data[pos]); ++pos)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (data[pos] - '0');
+                digits   = digits + (mantissa != 0);
+                scale--;
+            }
+        }
+    }
     tokenizer->buffer.pos = pos;
 
-    return tok;
+    double value          = (double)mantissa;
+    return (float)(scale < 0 ? value / pow(10.0, -scale) : value * pow(10.0, scale));
 }
 
-Token TokenizeNext(Tokenizer *tokenizer)
+static Token ScanToken(Tokenizer *tokenizer)
 {
-    // try parsing as number, the simplest ones
-    // might need a lookahead somewhere
-    Token token;
-    token.type = TOKEN_NONE;
+    const uint8_t *data = tokenizer->buffer.data;
+    const uint32_t len  = tokenizer->buffer.len;
 
     // consume whitespace and new lines
-    while (tokenizer->buffer.pos < tokenizer->buffer.len && IsWhiteSpace(tokenizer->buffer.data[tokenizer->buffer.pos]))
-    {
-        /*if (tokenizer->buffer.data[tokenizer->buffer.pos] == '\n')
-        {
-            token.type = TOKEN_NEWLINE;
-            return token;
-        }*/
+    while (tokenizer->buffer.pos < len && IsWhiteSpace(data[tokenizer->buffer.pos]))
         tokenizer->buffer.pos = tokenizer->buffer.pos + 1;
-    }
 
-    if (tokenizer->buffer.pos < tokenizer->buffer.len)
-    {
-        // Parse simple numbers
-        if (IsDigit(tokenizer->buffer.data[tokenizer->buffer.pos]))
-        {
-            uint32_t value = tokenizer->buffer.data[tokenizer->buffer.pos++] - '0';
-            while (IsDigit(tokenizer->buffer.data[tokenizer->buffer.pos]))
-                value = value * 10 + (tokenizer->buffer.data[tokenizer->buffer.pos++]) - '0';
+    Token token = {.type = TOKEN_NONE, .offset = tokenizer->buffer.pos};
+    if (tokenizer->buffer.pos >= len)
+        return token;
 
-            token.type            = TOKEN_NUM;
-            token.token_num.value = value;
-            return token;
-        }
+    uint8_t ch = data[tokenizer->buffer.pos];
+    if (IsDigit(ch) || (ch == '.' && tokenizer->buffer.pos + 1 < len && IsDigit(data[tokenizer->buffer.pos + 1])))
+    {
+        token.type  = TOKEN_NUM;
+        token.value = ScanNumber(tokenizer);
+        token.len   = tokenizer->buffer.pos - token.offset;
+        return token;
+    }
 
-        switch (tokenizer->buffer.data[tokenizer->buffer.pos++])
+    tokenizer->buffer.pos = tokenizer->buffer.pos + 1;
+    token.len             = 1;
+    switch (ch)
+    {
+    case '=':
+        token.type = TOKEN_EQUAL;
+        break;
+    case '(':
+        token.type = TOKEN_OPAREN;
+        break;
+    case ')':
+        token.type = TOKEN_CPAREN;
+        break;
+    case ',':
+        token.type = TOKEN_COMMA;
+        break;
+    case '*':
+        token.type = TOKEN_MUL;
+        break;
+    case '/':
+        token.type = TOKEN_DIV;
+        break;
+    case '+':
+        token.type = TOKEN_PLUS;
+        break;
+    case '-':
+        token.type = TOKEN_MINUS;
+        break;
+    case '^':
+        token.type = TOKEN_EXP;
+        break;
+    default:
+        // parse as identifier
+        if (!IsAlpha(ch))
         {
-        case '=':
-            token.type = TOKEN_EQUAL;
+            token.type = TOKEN_INVALID;
             break;
-        case '(':
-            token.type = TOKEN_OPAREN;
-            break;
-        case ')':
-            token.type = TOKEN_CPAREN;
-            break;
-        case ',':
-            token.type = TOKEN_COMMA;
-            break;
-        case '*':
-            token.type = TOKEN_MUL;
-            break;
-        case '/':
-            token.type = TOKEN_DIV;
-            break;
-        case '+':
-            token.type = TOKEN_PLUS;
-            break;
-        case '-':
-            token.type = TOKEN_MINUS;
-            break;
-        case '^':
-            token.type = TOKEN_EXP;
-            break;
-        default:
-            // parse as identifier
-            {
-                token.type         = TOKEN_ID;
-                token.token_id.len = 0;
-                tokenizer->buffer.pos--;
-
-                while ((tokenizer->buffer.pos < tokenizer->buffer.len) &&
-                       IsAlphaNumeric(tokenizer->buffer.data[tokenizer->buffer.pos]))
-                {
-                    token.token_id.name[token.token_id.len++] = tokenizer->buffer.data[tokenizer->buffer.pos];
-                    tokenizer->buffer.pos                     = tokenizer->buffer.pos + 1;
-                }
-                token.token_id.name[token.token_id.len] = '\0';
-            }
         }
+        while (tokenizer->buffer.pos < len && IsAlphaNumeric(data[tokenizer->buffer.pos]))
+            tokenizer->buffer.pos = tokenizer->buffer.pos + 1;
+        token.type = TOKEN_ID;
+        token.len  = tokenizer->buffer.pos - token.offset;
     }
     return token;
 }
 
+// Next token without consuming it, it is scanned once and handed out by the following TokenizeNext
+Token TokenizerLookahead(Tokenizer *tokenizer)
+{
+    if (!tokenizer->has_lookahead)
+    {
+        tokenizer->lookahead     = ScanToken(tokenizer);
+        tokenizer->has_lookahead = true;
+    }
+    return tokenizer->lookahead;
+}
+
+Token TokenizeNext(Tokenizer *tokenizer)
+{
+    if (tokenizer->has_lookahead)
+    {
+        tokenizer->has_lookahead = false;
+        return tokenizer->lookahead;
+    }
+    return ScanToken(tokenizer);
+}
+
+// Characters of the token, not null terminated
+static const char *TokenText(Tokenizer *tokenizer, Token token)
+{
+    return (const char *)tokenizer->buffer.data + token.offset;
+}
+
 Tokenizer *CreateTokenizer(uint8_t *buffer, uint32_t len)
 {
     Tokenizer *tokenizer = malloc(sizeof(*tokenizer));
@@ -413,14 +316,16 @@ Tokenizer *CreateTokenizer(uint8_t *buffer, uint32_t len)
     // Shallow copy for now
     tokenizer->buffer.data = buffer;
     tokenizer->buffer.len  = len;
+    return tokenizer;
 }
 
 void TokenizerSetBuffer(Tokenizer *tokenizer, uint8_t *buffer, uint32_t len)
 {
     // Reset the tokenizer for new phase
-    tokenizer->buffer.data = buffer;
-    tokenizer->buffer.len  = len;
-    tokenizer->buffer.pos  = 0;
+    tokenizer->buffer.data   = buffer;
+    tokenizer->buffer.len    = len;
+    tokenizer->buffer.pos    = 0;
+    tokenizer->has_lookahead = false;
 }
 
 void PrintToken(Token *token)
@@ -428,61 +333,44 @@ void PrintToken(Token *token)
     switch (token->type)
     {
     case TOKEN_NUM:
-        fprintf(stderr, "Token Num : Value -> %u.", token->token_num.value);
+        fprintf(stderr, "Token Num : Value -> %g.", token->value);
+        break;
     case TOKEN_ID:
-        fprintf(stderr, "Token ID  : Name  -> %s.", token->token_id.name);
+        fprintf(stderr, "Token ID  : Offset -> %u, Length -> %u.", token->offset, token->len);
+        break;
+    default:
+        break;
     }
 }
 
 // Implementation for interactive graph plotting
 
-typedef struct SymbolFn
-{
-    uint32_t  type; // implicit 1D, 2D or HD
-    char      id[MAX_ID_LEN];
-    uint32_t  args_count;
-    SymbolVar args[10];
-    ExprTree *expr_tree;
-} SymbolFn;
-
-// TODO :: Upgrade symbol table to use stack based implementation
-// TODO :: Use hash map for symbol table
-typedef struct SymbolTable
-{
-    uint32_t   var_count;
-    uint32_t   var_max;
-    uint32_t   fn_count;
-    uint32_t   fn_max;
-
-    SymbolVar *variables;
-    SymbolFn **functions;
-
-    bool       should_evaluate;
-} SymbolTable;
-
-typedef struct SymbolTableStack
-{
-    uint32_t      count;
-    uint32_t      max;
-    SymbolTable **symbol_tables;
-} SymbolTableStack;
-
-// This stack is going to be global
-SymbolTableStack symbol_table_stack;
-
 // Now start working on parser
 // Using LL(1) grammar, with left recursion elimination
-SymbolTable *CheckVarInScope(SymbolTableStack *stable_stack, const char *id);
-SymbolVar   *FindSymbolTableEntryVar(SymbolTable *symbol_table, const char *id);
-SymbolFn    *FindSymbolTableEntryFn(SymbolTable *symbol_table, const char *id);
 
 typedef struct Parser
 {
-    Tokenizer *tokenizer;
-    Token      current_token;
+    Interpreter *interpreter; // scopes the parsed definitions go into
+    Tokenizer   *tokenizer;
+    Token        current_token;
+    ExprArena   *arena; // receives the nodes of the tree being parsed
     // its not going to be generic, so working for this specific case only, we have
 } Parser;
 
+// Interned name of an identifier token
+static const char *TokenName(Parser *parser, Token token)
+{
+    return InternString(&parser->interpreter->interner, TokenText(parser->tokenizer, token), token.len);
+}
+
+// Name of an identifier token, for the fixed size ids of symbols
+static void CopyTokenName(Parser *parser, Token token, char id[MAX_ID_LEN])
+{
+    Assert(token.len < MAX_ID_LEN);
+    memcpy(id, TokenText(parser->tokenizer, token), token.len);
+    id[token.len] = '\0';
+}
+
 ExprTree *ParseS_(Parser *parser, ExprTree *inherited_tree);
 ExprTree *ParseS(Parser *parser);
 
@@ -491,8 +379,7 @@ ExprTree *ParseF(Parser *parser)
     TokenType type = parser->current_token.type;
     if (type == TOKEN_ID || type == TOKEN_NUM)
     {
-        ExprTree *expr_tree = malloc(sizeof(*expr_tree));
-        Assert(expr_tree != NULL);
+        ExprTree *expr_tree       = ArenaAlloc(parser->arena, sizeof(*expr_tree));
         expr_tree->left           = NULL;
         expr_tree->right          = NULL;
 
@@ -500,7 +387,7 @@ ExprTree *ParseF(Parser *parser)
         expr_tree->data.term.type = type == TOKEN_NUM ? TERM_VALUE : TERM_ID;
 
         if (type == TOKEN_NUM)
-            expr_tree->data.term.value.value = parser->current_token.token_num.value;
+            expr_tree->data.term.value.value = parser->current_token.value;
         else
         // TODO :: Update when string type is updated
         // Check if the variable is in scope, but don't try to evaluate it here??
@@ -520,32 +407,32 @@ ExprTree *ParseF(Parser *parser)
                 // I guess actual calculation should be deferred.
                 // But its hard to represent function both way.
 
-                FuncData fn_data    = {0};
-                uint32_t args_count = 0;
+                FuncData    fn_data    = {0};
+                SymbolVar   args[10];
+                uint32_t    args_count = 0;
                 // First check if the function is builtin
-                for (uint32_t built = 0; built < 7; ++built)
+                const char *name       = TokenName(parser, parser->current_token);
+                int32_t     built      = FindBuiltin(parser->interpreter, name);
+                if (built >= 0)
                 {
-                    if (!strcmp(builtins.functions[built].name, parser->current_token.token_id.name))
-                    {
-                        // Builtin function detected
-                        fn_data.is_builtin    = true;
-                        fn_data.builtin_index = built;
-                        break;
-                    }
+                    // Builtin function detected
+                    fn_data.is_builtin    = true;
+                    fn_data.builtin_index = (uint32_t)built;
                 }
 
                 if (fn_data.is_builtin)
-                    args_count = 1; // Restricted
+                    args_count = builtins.functions[built].arity;
                 else
                 {
 
-                    SymbolFn *fn = FindSymbolTableEntryFn(symbol_table_stack.symbol_tables[0],
-                                                          parser->current_token.token_id.name);
+                    SymbolFn *fn =
+                        FindSymbolTableEntryFn(parser->interpreter, parser->interpreter->stack.symbol_tables[0], name);
                     Assert(fn != NULL);
                     // At the evaluation process, function can only be evaluated. Not defined.
                     fn_data.fn = fn;
                     args_count = fn->args_count;
                 }
+                Assert(args_count <= 10);
                 Assert(TokenizeNext(parser->tokenizer).type == TOKEN_OPAREN);
 
                 for (uint32_t arg = 0; arg < args_count; ++arg)
@@ -554,30 +441,14 @@ ExprTree *ParseF(Parser *parser)
 
                     if (token.type == TOKEN_NUM)
                     {
-                        fn_data.args[fn_data.args_used] =
-                            (SymbolVar){.var_type = VAR_VALUE, .data.value = token.token_num.value};
+                        args[fn_data.args_used] =
+                            (SymbolVar){.var_type = VAR_VALUE, .data.value = token.value};
                     }
                     else if (token.type == TOKEN_ID)
                     {
-                        // Look up in the current scope, if its value is to be evaluated use it right here, right now
-                        SymbolTable *table = CheckVarInScope(&symbol_table_stack, token.token_id.name);
-                        // if (!table)
-                        //{
-                        //     fn_data.args[fn_data.args_used].var_type = VAR_ID;
-                        //     strcpy(fn_data.args[fn_data.args_used].data.id, token.token_id.name);
-                        // }
-                        Assert(table != NULL);
-                        if (table->should_evaluate)
-                        {
-                            SymbolVar *var = FindSymbolTableEntryVar(table, token.token_id.name);
-                            fn_data.args[fn_data.args_used] =
-                                (SymbolVar){.var_type = VAR_VALUE, .data.value = var->data.value};
-                        }
-                        else
-                        {
-                            fn_data.args[fn_data.args_used].var_type = VAR_ID;
-                            strcpy(fn_data.args[fn_data.args_used].data.id, token.token_id.name);
-                        }
+                        // Resolved to an argument or a variable slot by the binding pass
+                        args[fn_data.args_used].var_type = VAR_ID;
+                        CopyTokenName(parser, token, args[fn_data.args_used].data.id);
                     }
                     else
                         Assert(!"Invalid Token");
@@ -589,26 +460,19 @@ ExprTree *ParseF(Parser *parser)
 
                 Assert(parser->current_token.type == TOKEN_CPAREN);
                 // parser->current_token = TokenizeNext(parser->tokenizer);
-                expr_tree->node_type                 = NODE;
-                expr_tree->data.operation            = OP_FUNC_APPLY;
-                expr_tree->data.term.value.func_data = fn_data;
+                // Only the arguments actually passed are kept
+                fn_data.args = ArenaAlloc(parser->arena, sizeof(*fn_data.args) * (args_count ? args_count : 1));
+                memcpy(fn_data.args, args, sizeof(*args) * fn_data.args_used);
+
+                expr_tree->node_type                  = NODE;
+                expr_tree->data.operation             = OP_FUNC_APPLY;
+                expr_tree->data.term.value.func_data  = ArenaAlloc(parser->arena, sizeof(fn_data));
+                *expr_tree->data.term.value.func_data = fn_data;
             }
             else
             {
-                // Its a usual variable
-                SymbolTable *table = CheckVarInScope(&symbol_table_stack, parser->current_token.token_id.name);
-                Assert(table != NULL);
-                if (!table->should_evaluate)
-                {
-                    strcpy(expr_tree->data.term.value.id, parser->current_token.token_id.name);
-                }
-                else
-                {
-                    SymbolVar *var = FindSymbolTableEntryVar(table, parser->current_token.token_id.name);
-                    NamedAssert(var != NULL, parser->current_token.token_id.name);
-                    expr_tree->data.term.type        = TERM_VALUE;
-                    expr_tree->data.term.value.value = var->data.value;
-                }
+                // Its a usual variable, resolved by the binding pass once the whole body is parsed
+                expr_tree->data.term.value.id = TokenName(parser, parser->current_token);
             }
         }
         parser->current_token = TokenizeNext(parser->tokenizer);
@@ -627,20 +491,66 @@ ExprTree *ParseF(Parser *parser)
     Unreachable();
 }
 
+ExprTree *ParseU(Parser *parser);
+
+// Power, right associative : x ^ y ^ z is x ^ (y ^ z). The exponent may be negated, as in x ^ -2.
+ExprTree *ParseP(Parser *parser)
+{
+    ExprTree *base = ParseF(parser);
+    if (parser->current_token.type != TOKEN_EXP)
+        return base;
+
+    ExprTree *expr_tree       = ArenaAlloc(parser->arena, sizeof(*expr_tree));
+    expr_tree->node_type      = NODE;
+    expr_tree->data.operation = OP_EXP;
+    expr_tree->left           = base;
+
+    parser->current_token     = TokenizeNext(parser->tokenizer);
+    expr_tree->right          = ParseU(parser);
+    return expr_tree;
+}
+
+// Unary minus, looser than ^ so that -x ^ 2 is -(x ^ 2). Parsed as -1 * x, which unlike 0 - x keeps the sign of zero.
+ExprTree *ParseU(Parser *parser)
+{
+    if (parser->current_token.type != TOKEN_MINUS)
+        return ParseP(parser);
+
+    ExprTree *minus_one              = ArenaAlloc(parser->arena, sizeof(*minus_one));
+    minus_one->node_type             = LEAF;
+    minus_one->left                  = NULL;
+    minus_one->right                 = NULL;
+    minus_one->data.term.type        = TERM_VALUE;
+    minus_one->data.term.value.value = -1.0f;
+
+    ExprTree *expr_tree              = ArenaAlloc(parser->arena, sizeof(*expr_tree));
+    expr_tree->node_type             = NODE;
+    expr_tree->data.operation        = OP_MUL;
+    expr_tree->left                  = minus_one;
+
+    parser->current_token            = TokenizeNext(parser->tokenizer);
+    expr_tree->right                 = ParseU(parser);
+    return expr_tree;
+}
+
+static bool StartsTerm(TokenType type)
+{
+    return type == TOKEN_NUM || type == TOKEN_ID || type == TOKEN_OPAREN || type == TOKEN_MINUS;
+}
+
 ExprTree *ParseT_(Parser *parser, ExprTree *inherited_tree) // Takes the inherited attributes
 {
     TokenType type = parser->current_token.type;
     if (type == TOKEN_MUL || type == TOKEN_DIV)
     {
-        ExprTree *expr_tree = malloc(sizeof(*expr_tree));
-        Assert(expr_tree != NULL);
+        ExprTree *expr_tree       = ArenaAlloc(parser->arena, sizeof(*expr_tree));
         expr_tree->node_type      = NODE;
         expr_tree->data.operation = type == TOKEN_MUL ? OP_MUL : OP_DIV;
         expr_tree->left           = inherited_tree;
 
         // Order of parsing matters here
         parser->current_token = TokenizeNext(parser->tokenizer);
-        expr_tree->right      = ParseF(parser);
+        expr_tree->right      = ParseU(parser);
 
         return ParseT_(parser, expr_tree);
     }
@@ -650,10 +560,9 @@ ExprTree *ParseT_(Parser *parser, ExprTree *inherited_tree) // Takes the inherit
 ExprTree *ParseT(Parser *parser)
 {
 
-    if (parser->current_token.type == TOKEN_NUM || parser->current_token.type == TOKEN_ID ||
-        parser->current_token.type == TOKEN_OPAREN)
+    if (StartsTerm(parser->current_token.type))
     {
-        ExprTree *termtree = ParseF(parser);
+        ExprTree *termtree = ParseU(parser);
         return ParseT_(parser, termtree);
     }
     else
@@ -670,8 +579,7 @@ ExprTree *ParseS_(Parser *parser, ExprTree *inherited_tree) // token_plus and to
     if (type == TOKEN_PLUS || type == TOKEN_MINUS)
     {
         // Allocate a new tree with node
-        ExprTree *expr_tree = malloc(sizeof(*expr_tree));
-        Assert(expr_tree != NULL);
+        ExprTree *expr_tree       = ArenaAlloc(parser->arena, sizeof(*expr_tree));
         expr_tree->node_type      = NODE;
         expr_tree->data.operation = type == TOKEN_PLUS ? OP_ADD : OP_SUB;
         expr_tree->left           = inherited_tree;
@@ -687,8 +595,7 @@ ExprTree *ParseS_(Parser *parser, ExprTree *inherited_tree) // token_plus and to
 
 ExprTree *ParseS(Parser *parser)
 {
-    if (parser->current_token.type == TOKEN_NUM || parser->current_token.type == TOKEN_ID ||
-        parser->current_token.type == TOKEN_OPAREN)
+    if (StartsTerm(parser->current_token.type))
     {
         ExprTree *termtree = ParseT(parser);
         return ParseS_(parser, termtree);
@@ -709,13 +616,52 @@ ExprTree *CreateExprTree(Parser *parser)
     return ParseS(parser);
 }
 
-void DestroyExprTree(ExprTree *expr_tree)
+// Expression arenas
+// A tree is only ever released as a whole, so its nodes are bumped out of large blocks instead of being allocated one
+// by one. Nodes parsed together sit next to each other in memory, which keeps a whole expression in a few cache lines.
+
+#define ARENA_BLOCK_SIZE 4096
+
+ExprArena *CreateExprArena(void)
+{
+    ExprArena *arena = malloc(sizeof(*arena));
+    Assert(arena != NULL);
+    arena->blocks = NULL;
+    return arena;
+}
+
+void *ArenaAlloc(ExprArena *arena, size_t size)
+{
+    // Keep every allocation aligned for any type
+    size              = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (!block || block->used + size > block->size)
+    {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block           = malloc(sizeof(*block) + capacity);
+        Assert(block != NULL);
+        block->next   = arena->blocks;
+        block->used   = 0;
+        block->size   = capacity;
+        arena->blocks = block;
+    }
+
+    void *memory = (uint8_t *)block->data + block->used;
+    block->used  = block->used + size;
+    return memory;
+}
+
+void DestroyExprArena(ExprArena *arena)
 {
-    if (!expr_tree)
+    if (!arena)
         return;
-    DestroyExprTree(expr_tree->left);
-    DestroyExprTree(expr_tree->right);
-    free(expr_tree);
+    for (ArenaBlock *block = arena->blocks, *next; block; block = next)
+    {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
 }
 
 SymbolTable *CreateSymbolTable(bool should_evaluate);
@@ -753,29 +699,21 @@ void InitSymbolTableStack(SymbolTableStack *stable_stack)
     PushToSymbolTableStack(stable_stack, CreateSymbolTable(true));
 }
 
-SymbolTable *CheckVarInScope(SymbolTableStack *stable_stack, const char *id)
+SymbolTable *CheckVarInScope(Interpreter *interpreter, const char *id)
 {
+    const char *name = FindInternedString(&interpreter->interner, id, (uint32_t)strlen(id));
+    if (!name)
+        return NULL;
+
+    SymbolTableStack *stable_stack = &interpreter->stack;
+
+    uint32_t slot;
     for (int32_t scope = stable_stack->count - 1; scope >= 0; --scope)
     {
         SymbolTable *table = stable_stack->symbol_tables[scope];
         // Find symbol table entry first in var segment and then in fn segment
-
-        for (uint32_t var = 0; var < table->var_count; ++var)
-        {
-            if (!strcmp(id, table->variables[var].data.id))
-            {
-                // return symbol_table->variables->data.value;
-                return table;
-            }
-        }
-        for (uint32_t fn = 0; fn < table->fn_count; ++fn)
-        {
-            if (!strcmp(id, table->functions[fn]->id))
-            {
-                // return symbol_table->variables->data.value;
-                return table;
-            }
-        }
+        if (NameMapFind(&table->names, name, NAME_VAR, &slot) || NameMapFind(&table->names, name, NAME_FN, &slot))
+            return table;
     }
     return NULL;
 }
@@ -805,50 +743,161 @@ SymbolTable *CreateSymbolTable(bool should_evaluate)
     return symbol_table;
 }
 
-bool InsertSymbolVar(SymbolTable *table, SymbolVar *symbol)
+// The functions of the table are left alone
+void DestroySymbolTable(SymbolTable *symbol_table)
 {
-    NamedAssert(table->var_count < table->var_max, table->var_count);
-    if (table->var_count >= table->var_max)
-        return false;
+    free(symbol_table->variables);
+    free(symbol_table->functions);
+    DestroyNameMap(&symbol_table->names);
+    free(symbol_table);
+}
+
+// Redefinitions overwrite the existing slot, so everything bound to it sees the new value
+bool InsertSymbolVar(Interpreter *interpreter, SymbolTable *table, SymbolVar *symbol)
+{
+    const char *name = InternString(&interpreter->interner, symbol->data.id, (uint32_t)strlen(symbol->data.id));
+    uint32_t    slot;
+    if (NameMapFind(&table->names, name, NAME_VAR, &slot))
+    {
+        table->variables[slot] = *symbol;
+        return true;
+    }
+
+    if (table->var_count == table->var_max)
+    {
+        table->var_max   = table->var_max * 2;
+        table->variables = realloc(table->variables, sizeof(*table->variables) * table->var_max);
+        Assert(table->variables != NULL);
+    }
+    NameMapInsert(&table->names, name, NAME_VAR, table->var_count);
     table->variables[table->var_count++] = *symbol;
     return true;
 }
 
-bool InsertSymbolFn(SymbolTable *table, SymbolFn *fn)
+bool SetVariable(Interpreter *interpreter, const char *id, float value)
 {
-    // Its quite a complicated case
-    NamedAssert(table->fn_count < table->fn_max, table->fn_count);
-    if (table->var_count >= table->var_max)
+    SymbolTable *table = CheckVarInScope(interpreter, id);
+    SymbolVar   *var   = table ? FindSymbolTableEntryVar(interpreter, table, id) : NULL;
+    if (!var)
         return false;
+    AcquireInterpreterLock(interpreter->lock);
+    var->data.value = value;
+    var->generation = ++interpreter->generation;
+    ReleaseInterpreterLock(interpreter->lock);
+    return true;
+}
+
+bool InsertSymbolFn(Interpreter *interpreter, SymbolTable *table, SymbolFn *fn)
+{
+    // Functions calling the old definition are replaced by copies calling the new one where they can, see
+    // RebindCallers. Contexts keep running the definitions they were made from, tree or compiled, until refreshed.
+    // The table takes over the reference fn is created with.
+    const char *name = InternString(&interpreter->interner, fn->id, (uint32_t)strlen(fn->id));
+    uint32_t    slot;
+    if (NameMapFind(&table->names, name, NAME_FN, &slot))
+    {
+        SymbolFn *old_fn       = table->functions[slot];
+        table->functions[slot] = fn;
+        RebindCallers(table, old_fn, fn);
+        ReleaseReplacedFn(old_fn);
+        return true;
+    }
 
+    if (table->fn_count == table->fn_max)
+    {
+        table->fn_max    = table->fn_max * 2;
+        table->functions = realloc(table->functions, sizeof(*table->functions) * table->fn_max);
+        Assert(table->functions != NULL);
+    }
+    NameMapInsert(&table->names, name, NAME_FN, table->fn_count);
     table->functions[table->fn_count++] = fn;
     return true;
 }
 
 // (LResult, bool)
-SymbolVar *FindSymbolTableEntryVar(SymbolTable *symbol_table, const char *id)
+SymbolVar *FindSymbolTableEntryVar(Interpreter *interpreter, SymbolTable *symbol_table, const char *id)
 {
-    // Only look into the entries of var for now
-    for (uint32_t var = 0; var < symbol_table->var_count; ++var)
+    uint32_t    slot;
+    const char *name = FindInternedString(&interpreter->interner, id, (uint32_t)strlen(id));
+    if (NameMapFind(&symbol_table->names, name, NAME_VAR, &slot))
+        return symbol_table->variables + slot;
+    // Assert("Symbol not in scope");
+    return NULL;
+}
+
+SymbolFn *FindSymbolTableEntryFn(Interpreter *interpreter, SymbolTable *symbol_table, const char *id)
+{
+    uint32_t    slot;
+    const char *name = FindInternedString(&interpreter->interner, id, (uint32_t)strlen(id));
+    if (NameMapFind(&symbol_table->names, name, NAME_FN, &slot))
+        return symbol_table->functions[slot];
+    return NULL;
+}
+
+// Arguments of fn shadow the variables of every enclosing scope
+static Binding ResolveIdentifier(Interpreter *interpreter, SymbolFn *fn, const char *id, bool *is_arg)
+{
+    *is_arg = false;
+    if (fn)
     {
-        if (!strcmp(id, symbol_table->variables[var].data.id))
+        for (uint32_t arg = 0; arg < fn->args_count; ++arg)
         {
-            // return symbol_table->variables->data.value;
-            return symbol_table->variables + var;
+            if (!strcmp(fn->args[arg].data.id, id))
+            {
+                *is_arg = true;
+                return (Binding){.depth = 0, .slot = arg};
+            }
         }
     }
-    // Assert("Symbol not in scope");
-    return NULL;
+
+    SymbolTableStack *stable_stack = &interpreter->stack;
+    const char       *name         = FindInternedString(&interpreter->interner, id, (uint32_t)strlen(id));
+    uint32_t          slot;
+    for (int32_t scope = stable_stack->count - 1; scope >= 0; --scope)
+    {
+        if (NameMapFind(&stable_stack->symbol_tables[scope]->names, name, NAME_VAR, &slot))
+            return (Binding){.depth = scope, .slot = slot};
+    }
+    fprintf(stderr, "Identifier %s is not in scope.\n", id);
+    Assert(!"Unresolved identifier");
+    Unreachable();
 }
 
-SymbolFn *FindSymbolTableEntryFn(SymbolTable *symbol_table, const char *id)
+// Binding pass : rewrites every identifier of the tree, including the arguments of function calls, to the argument
+// index or the (scope depth, slot) pair it refers to. fn is NULL for plain variable definitions.
+void BindExprTree(Interpreter *interpreter, SymbolFn *fn, ExprTree *expr)
 {
-    for (uint32_t fn = 0; fn < symbol_table->fn_count; ++fn)
+    if (!expr)
+        return;
+
+    bool is_arg;
+    if (expr->node_type == LEAF)
     {
-        if (!strcmp(id, symbol_table->functions[fn]->id))
-            return symbol_table->functions[fn];
+        if (expr->data.term.type == TERM_ID)
+        {
+            Binding binding               = ResolveIdentifier(interpreter, fn, expr->data.term.value.id, &is_arg);
+            expr->data.term.type          = is_arg ? TERM_ARG : TERM_SLOT;
+            expr->data.term.value.binding = binding;
+        }
+        return;
     }
-    return NULL;
+
+    if (expr->data.operation == OP_FUNC_APPLY)
+    {
+        FuncData *fn_data = expr->data.term.value.func_data;
+        for (uint32_t arg = 0; arg < fn_data->args_used; ++arg)
+        {
+            SymbolVar *var = &fn_data->args[arg];
+            if (var->var_type != VAR_ID)
+                continue;
+            var->binding  = ResolveIdentifier(interpreter, fn, var->data.id, &is_arg);
+            var->var_type = is_arg ? VAR_ARG : VAR_SLOT;
+        }
+        return;
+    }
+
+    BindExprTree(interpreter, fn, expr->left);
+    BindExprTree(interpreter, fn, expr->right);
 }
 
 bool ParseVarBody(Parser *parser, SymbolTable *symbol_table, SymbolVar *symbol)
@@ -860,81 +909,111 @@ bool ParseVarBody(Parser *parser, SymbolTable *symbol_table, SymbolVar *symbol)
     return false;
 }
 
-float EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, ExprTree *expr);
 
 
-float FunctionApplication(SymbolTableStack *stable_stack, FuncData *fn_data)
+// Value of an argument of a function call, read from the caller's frame
+static float BoundArgument(SymbolTableStack *stable_stack, FrameStack *frames, SymbolVar *arg)
 {
-    // If it is builtin, argument could be applied directly
-    SymbolTable *table = CreateSymbolTable(true);
+    switch (arg->var_type)
+    {
+    case VAR_VALUE:
+        return arg->data.value;
+    case VAR_ARG:
+        return frames->values[frames->base + arg->binding.slot];
+    case VAR_SLOT:
+        return stable_stack->symbol_tables[arg->binding.depth]->variables[arg->binding.slot].data.value;
+    default:
+        Assert(!"Unbound function argument");
+        Unreachable();
+    }
+}
 
-    // Assert(fn_data->args_used == fn_data->fn->args_count);
+FrameStack *CreateFrameStack(uint32_t max)
+{
+    FrameStack *frames = malloc(sizeof(*frames));
+    Assert(frames != NULL);
+    frames->base   = 0;
+    frames->top    = 0;
+    frames->max    = max ? max : 1;
+    frames->values = malloc(sizeof(*frames->values) * frames->max);
+    Assert(frames->values != NULL);
+    return frames;
+}
 
-    for (uint32_t arg = 0; arg < fn_data->args_used; ++arg)
+void DestroyFrameStack(FrameStack *frames)
+{
+    if (!frames)
+        return;
+    free(frames->values);
+    free(frames);
+}
+
+// Count of frame values needed by the deepest chain of calls made from expr
+uint32_t FrameStackSize(ExprTree *expr)
+{
+    if (!expr || expr->node_type == LEAF)
+        return 0;
+
+    if (expr->data.operation == OP_FUNC_APPLY)
     {
-        table->variables[arg].var_type = VAR_ID;
-        if (fn_data->args[arg].var_type == VAR_VALUE)
-        {
-            strcpy(table->variables[arg].data.id, fn_data->fn->args[arg].data.id);
-            table->variables[arg].data.value = fn_data->args[arg].data.value;
-        }
-        else
-        {
-            // Unimplemented();
-            // Take information from the closed scoped upper layer
-            SymbolTable *ttable = CheckVarInScope(stable_stack, fn_data->args[arg].data.id);
-            Assert(ttable != NULL);
-            SymbolVar *var                   = FindSymbolTableEntryVar(ttable, fn_data->args[arg].data.id);
-            table->variables[arg].data.value = var->data.value;
-        }
-        table->var_count++;
+        FuncData *fn_data = expr->data.term.value.func_data;
+        if (fn_data->is_builtin)
+            return 0;
+        return fn_data->args_used + FrameStackSize(fn_data->fn->expr_tree);
     }
-    PushToSymbolTableStack(stable_stack, table);
-    float val = 0;
+
+    uint32_t left  = FrameStackSize(expr->left);
+    uint32_t right = FrameStackSize(expr->right);
+    return left > right ? left : right;
+}
+
+float FunctionApplication(SymbolTableStack *stable_stack, FrameStack *frames, FuncData *fn_data)
+{
+    // If it is builtin, arguments could be applied directly
     if (fn_data->is_builtin)
     {
-        val = table->variables[0].data.value;
-        val = builtins.functions[fn_data->builtin_index].fn(val);
+        const Builtin *builtin = &builtins.functions[fn_data->builtin_index];
+        float          a       = BoundArgument(stable_stack, frames, &fn_data->args[0]);
+        if (builtin->arity == 1)
+            return builtin->fn(a);
+        return builtin->fn2(a, BoundArgument(stable_stack, frames, &fn_data->args[1]));
     }
-    else
-        val = EvalExprTreeWithSymbolTableStack(stable_stack, fn_data->fn->expr_tree);
-    free(PopFromSymbolTableStack(stable_stack));
+
+    // Assert(fn_data->args_used == fn_data->fn->args_count);
+    Assert(frames->top + fn_data->args_used <= frames->max);
+
+    // Arguments are bound by position, the callee reads them through its TERM_ARG leaves
+    uint32_t caller = frames->base;
+    uint32_t callee = frames->top;
+    for (uint32_t arg = 0; arg < fn_data->args_used; ++arg)
+        frames->values[callee + arg] = BoundArgument(stable_stack, frames, &fn_data->args[arg]);
+
+    frames->base = callee;
+    frames->top  = callee + fn_data->args_used;
+    float val    = EvalExprTreeWithSymbolTableStack(stable_stack, frames, fn_data->fn->expr_tree);
+    frames->top  = callee;
+    frames->base = caller;
     return val;
 }
 
-float EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, ExprTree *expr)
+float EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, FrameStack *frames, ExprTree *expr)
 {
     // Every numerals are uint32_t based so,
     if (expr->node_type == LEAF)
     {
-        if (expr->data.term.type == TERM_VALUE)
+        // Identifiers were bound to their slots after parsing, so no name is looked up here
+        switch (expr->data.term.type)
         {
+        case TERM_VALUE:
             return expr->data.term.value.value;
-        }
-        else
-        {
-            // look for the current identifier in the symbol table
-            // Try to lookahead a bit and see if its a function call or just a plain variable
-
-            // Proceeding assuming its a plain variable for now
-            if (expr->data.term.type == TERM_ID)
-            {
-                // Functions given higher priority
-                // TODO :: Resolve it a bit later
-                SymbolTable *table = CheckVarInScope(stable_stack, expr->data.term.value.id);
-                Assert(table != NULL);
-                // SymbolFn *fn = FindSymbolTableEntryFn(symbol_table, expr->data.term.value.id);
-                // if (fn != NULL)
-                //{
-                //     return 0;
-                // }
-                //  It could even be a function invocation
-                SymbolVar *var = FindSymbolTableEntryVar(table, expr->data.term.value.id);
-                NamedAssert(var != NULL, expr->data.term.value.id);
-                return var->data.value;
-            }
-
-            // Assert(!"Only numerals allowed for now");
+        case TERM_ARG:
+            return frames->values[frames->base + expr->data.term.value.binding.slot];
+        case TERM_SLOT:
+            return stable_stack->symbol_tables[expr->data.term.value.binding.depth]
+                ->variables[expr->data.term.value.binding.slot]
+                .data.value;
+        default:
+            NamedAssert(!"Unbound identifier", expr->data.term.value.id);
         }
     }
 
@@ -944,19 +1023,22 @@ float EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, ExprTree
     switch (expr->data.operation)
     {
     case OP_ADD:
-        return EvalExprTreeWithSymbolTableStack(stable_stack, expr->left) +
-               EvalExprTreeWithSymbolTableStack(stable_stack, expr->right);
+        return EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->left) +
+               EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->right);
     case OP_SUB:
-        return EvalExprTreeWithSymbolTableStack(stable_stack, expr->left) -
-               EvalExprTreeWithSymbolTableStack(stable_stack, expr->right);
+        return EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->left) -
+               EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->right);
     case OP_MUL:
-        return EvalExprTreeWithSymbolTableStack(stable_stack, expr->left) *
-               EvalExprTreeWithSymbolTableStack(stable_stack, expr->right);
+        return EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->left) *
+               EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->right);
     case OP_DIV:
-        return EvalExprTreeWithSymbolTableStack(stable_stack, expr->left) /
-               EvalExprTreeWithSymbolTableStack(stable_stack, expr->right);
+        return EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->left) /
+               EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->right);
+    case OP_EXP:
+        return (float)Power(EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->left),
+                            EvalExprTreeWithSymbolTableStack(stable_stack, frames, expr->right));
     case OP_FUNC_APPLY:
-        return FunctionApplication(stable_stack, &expr->data.term.value.func_data);
+        return FunctionApplication(stable_stack, frames, expr->data.term.value.func_data);
 
     default:
         Assert(!"Unsupported Operation ....");
@@ -964,6 +1046,7 @@ float EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, ExprTree
 }
 
 bool ParseVar(Parser *parser);
+static void ReleaseReplacedFns(Interpreter *interpreter);
 
 // It might need to take current symbol table to calculate its value at the moment
 // TODO :: Create an interpreted session
@@ -974,10 +1057,12 @@ void ParseStart(Parser *parser)
     Token next_token = TokenizerLookahead(parser->tokenizer);
     // f(x) = x
 
+    // Promotion workers read the scopes and the trees a definition may rebind
+    AcquireInterpreterLock(parser->interpreter->lock);
     switch (next_token.type)
     {
     case TOKEN_NONE:
-        return;
+        break;
     case TOKEN_ID:
     {
         // Not enough information from here
@@ -986,6 +1071,8 @@ void ParseStart(Parser *parser)
     }
     break;
     }
+    ReleaseInterpreterLock(parser->interpreter->lock);
+    ReleaseReplacedFns(parser->interpreter);
 }
 
 SymbolFn *CreateSymbolFn(uint32_t args_max)
@@ -994,28 +1081,61 @@ SymbolFn *CreateSymbolFn(uint32_t args_max)
     return fn;
 }
 
-// TODO :: Implement scope checking at the site of definition
-bool ParseFuncBody(Parser *parser, SymbolTable *symbol_table, SymbolFn *fn)
+SymbolFn *RetainSymbolFn(SymbolFn *fn)
 {
-    // It will start right after consuming equal token
-    // The scope that should be currently use is the one created by the function's arg parameters
-
-    // Create a new symbol table with variables only
-    // Do not evaluate the variables used in this symbol table
+    AtomicAdd32(&fn->references, 1);
+    return fn;
+}
 
-    SymbolTable *table = CreateSymbolTable(false);
+// Drops a reference, the last one frees fn along with its code and drops the references it holds on its callees and on
+// the function it differentiates. Waits for a promotion of fn in progress, so never call it with the lock held.
+void DestroySymbolFn(SymbolFn *fn)
+{
+    if (!fn || AtomicAdd32(&fn->references, (uint32_t)-1))
+        return;
+    ReleaseTiers(fn);
+    for (uint32_t callee = 0; callee < fn->dependencies.fns_count; ++callee)
+        DestroySymbolFn(fn->dependencies.fns[callee]);
+    DestroySymbolFn(fn->source);
+    DestroyExprArena(fn->arena);
+    free(fn);
+}
 
-    for (uint32_t arg = 0; arg < fn->args_count; ++arg)
+// Tables replace functions while parsing, with the lock held, so their references are dropped once parsing is over
+void ReleaseReplacedFn(SymbolFn *fn)
+{
+    Interpreter *interpreter = fn->interpreter;
+    if (interpreter->replaced_count == interpreter->replaced_max)
     {
-        table->variables[table->var_count] = fn->args[arg];
-        table->var_count                   = table->var_count + 1;
+        interpreter->replaced_max = interpreter->replaced_max ? interpreter->replaced_max * 2 : 8;
+        interpreter->replaced =
+            realloc(interpreter->replaced, sizeof(*interpreter->replaced) * interpreter->replaced_max);
+        Assert(interpreter->replaced != NULL);
     }
+    interpreter->replaced[interpreter->replaced_count++] = fn;
+}
 
-    PushToSymbolTableStack(&symbol_table_stack, table);
-    fn->expr_tree = CreateExprTree(parser);
-    PopFromSymbolTableStack(&symbol_table_stack);
-    // TODO :: Wrap it
-    free(table);
+static void ReleaseReplacedFns(Interpreter *interpreter)
+{
+    for (uint32_t fn = 0; fn < interpreter->replaced_count; ++fn)
+        DestroySymbolFn(interpreter->replaced[fn]);
+    interpreter->replaced_count = 0;
+}
+
+// TODO :: Implement scope checking at the site of definition
+bool ParseFuncBody(Parser *parser, SymbolTable *symbol_table, SymbolFn *fn)
+{
+    // It will start right after consuming equal token
+    // The scope that should be currently use is the one created by the function's arg parameters
+
+    // Identifiers are only recorded while parsing, the binding pass then resolves them against the arguments of fn and
+    // the enclosing scopes
+    fn->interpreter = parser->interpreter;
+    fn->arena       = CreateExprArena();
+    parser->arena   = fn->arena;
+    fn->expr_tree   = CreateExprTree(parser);
+    BindExprTree(parser->interpreter, fn, fn->expr_tree);
+    CollectDependencies(fn);
     return true;
     // If the expr being evaluated is function and then the variable that is in scope shouldn't be dealt with.
     // So CreateExprTree() function should behave differently to parsing function and variables
@@ -1024,10 +1144,15 @@ bool ParseFuncBody(Parser *parser, SymbolTable *symbol_table, SymbolFn *fn)
     // Infuse information directly in the symbol table
 }
 
-SymbolFn *GetLatestParsedFn()
+// Redefined functions keep their slot, so the latest one isn't necessarily the last in the table
+SymbolFn *GetLatestParsedFn(Interpreter *interpreter)
 {
-    Assert(symbol_table_stack.symbol_tables[0]->fn_count != 0);
-    return symbol_table_stack.symbol_tables[0]->functions[symbol_table_stack.symbol_tables[0]->fn_count - 1]; 
+    return interpreter->latest_parsed_fn;
+}
+
+uint32_t GetSymbolFnArity(SymbolFn *fn)
+{
+    return fn->args_count;
 }
 
 bool ParseVar(Parser *parser)
@@ -1044,9 +1169,10 @@ bool ParseVar(Parser *parser)
         // Simply loop through the tokens skipping commas and add to function declaration
 
         SymbolFn *fn = CreateSymbolFn(0);
-        memset(fn, 0, sizeof(*fn));
         Assert(fn != NULL);
-        strcpy(fn->id, token.token_id.name);
+        memset(fn, 0, sizeof(*fn));
+        fn->references = 1;
+        CopyTokenName(parser, token, fn->id);
 
         TokenizeNext(parser->tokenizer);
         token = TokenizeNext(parser->tokenizer);
@@ -1057,7 +1183,7 @@ bool ParseVar(Parser *parser)
             NamedAssert(token.type == TOKEN_ID, token.type);
             // The args only contains the variable
             fn->args[fn->args_count].var_type = VAR_ID;
-            strcpy(fn->args[fn->args_count].data.id, token.token_id.name);
+            CopyTokenName(parser, token, fn->args[fn->args_count].data.id);
 
             fn->args_count = fn->args_count + 1;
             token          = TokenizeNext(parser->tokenizer);
@@ -1075,31 +1201,40 @@ bool ParseVar(Parser *parser)
         NamedAssert(parser->current_token.type == TOKEN_EQUAL, (int)parser->current_token.type);
 
         // Implicity creates a new scope with variables x and y as the parameters
-        SymbolTable *top = TopOfSymbolTableStack(&symbol_table_stack);
+        SymbolTable *top = TopOfSymbolTableStack(&parser->interpreter->stack);
         ParseFuncBody(parser, top, fn);
 
-        InsertSymbolFn(top, fn);
+        fn->generation = ++parser->interpreter->generation;
+        InsertSymbolFn(parser->interpreter, top, fn);
+        parser->interpreter->latest_parsed_fn = fn;
         return true;
     }
     else if (next.type == TOKEN_EQUAL)
     {
         // its a variable, add it to the symbol entry
         SymbolVar var;
-        strcpy(var.data.id, token.token_id.name); // ignore length for now
+        CopyTokenName(parser, token, var.data.id);
 
         TokenizeNext(parser->tokenizer);
 
         // SymbolTable *top       = TopOfSymbolTableStack(&symbol_table_stack);
 
+        // The tree only lives until the value is computed
+        parser->arena       = CreateExprArena();
         ExprTree *expr_tree = CreateExprTree(parser);
+        BindExprTree(parser->interpreter, NULL, expr_tree);
         var.var_type        = VAR_VALUE;
         // I guess, stack doesn't need to be provided here
-        var.data.value = EvalExprTreeWithSymbolTableStack(&symbol_table_stack, expr_tree);
+        FrameStack *frames = CreateFrameStack(FrameStackSize(expr_tree));
+        var.data.value     = EvalExprTreeWithSymbolTableStack(&parser->interpreter->stack, frames, expr_tree);
+        var.generation     = ++parser->interpreter->generation;
+        DestroyFrameStack(frames);
         // var.data.value = EvalExprTree(expr_tree);
-        DestroyExprTree(expr_tree);
+        DestroyExprArena(parser->arena);
+        parser->arena = NULL;
         // parser->current_token = TokenizeNext(parser->tokenizer);    // skip the lookahead
         // ParserVarBody(parser, &symbol);
-        InsertSymbolVar(TopOfSymbolTableStack(&symbol_table_stack), &var);
+        InsertSymbolVar(parser->interpreter, TopOfSymbolTableStack(&parser->interpreter->stack), &var);
         return true;
     }
     return false;
@@ -1160,11 +1295,62 @@ void RunInterpreter(Parser *parser)
     }
 }
 
-ComputationContext *NewComputation(SymbolFn *fn)
+// Everything but the program is private to the context
+// Switches to the program and registers of a tier compiled for the function
+static void AdoptProgram(ComputationContext *context, Program *program)
+{
+    DestroyProgram(context->program);
+    free(context->registers);
+    free(context->batch_registers);
+
+    context->program   = RetainProgram(program);
+    context->registers = malloc(sizeof(*context->registers) * program->count);
+    Assert(context->registers != NULL);
+    context->batch_registers = malloc(sizeof(*context->batch_registers) * program->count * BATCH_LANES);
+    Assert(context->batch_registers != NULL);
+    context->invariants_generation = UINT32_MAX;
+}
+
+// Contexts follow their function up the tiers. A redefinition may invalidate the published code at any time, so the
+// tier, the program and the native code are read together under the lock once there is something to catch up on. The
+// context then holds a reference to the program, and invalidated native code is retired until the function is released.
+static void CatchUpTier(ComputationContext *context)
+{
+    SymbolFn *fn = context->fn;
+    if (PublishedTier(fn) <= context->tier)
+        return;
+
+    TierState *state = &fn->tier_state;
+    AcquireInterpreterLock(fn->interpreter->lock);
+    ExecutionTier tier = PublishedTier(fn);
+    if (tier > context->tier)
+    {
+        if (context->program != state->program)
+            AdoptProgram(context, state->program);
+        context->native = tier == TIER_NATIVE ? JitEntry2D(state->jit) : NULL;
+        context->tier   = tier;
+    }
+    ReleaseInterpreterLock(fn->interpreter->lock);
+}
+
+// Adds the samples evaluated since the last report to the counters of the function, every few hundred samples so that
+// contexts on several threads rarely touch the same cache line
+#define TIER_REPORT_INTERVAL 256
+
+// samples are evaluated on top of the unreported ones
+static void ReportSamples(ComputationContext *context, size_t samples)
+{
+    CountEvaluations(context->fn, context->unreported + (uint64_t)samples);
+    context->unreported = 0;
+    CatchUpTier(context);
+}
+
+// Contexts start on the tier their function has reached, the tree for a new one. Nothing is compiled here.
+static ComputationContext *CreateComputationContext(SymbolFn *fn)
 {
     ComputationContext *context = malloc(sizeof(*context));
     Assert(context != NULL); // Just for keeping msvc happy
-    context->fn        = fn;
+    context->fn        = RetainSymbolFn(fn);
 
     SymbolTable *table = CreateSymbolTable(true);
     // Populate this symbol table with the arguments of functions
@@ -1175,101 +1361,350 @@ ComputationContext *NewComputation(SymbolFn *fn)
         table->var_count                            = table->var_count + 1;
     }
 
-    context->table = table;
+    context->table                 = table;
+
+    context->tier                  = TIER_TREE;
+    context->unreported            = 0;
+    context->native                = NULL;
+    context->program               = NULL;
+    context->registers             = NULL;
+    context->batch_registers       = NULL;
+    context->inlined_program       = NULL;
+    context->gradient_registers    = NULL;
+    context->interval_registers    = NULL;
+    context->generation            = fn->interpreter->generation;
+    context->invariants_generation = UINT32_MAX;
+
+    // The outermost frame holds x and y even for functions of a single argument
+    uint32_t outer       = fn->args_count > 2 ? fn->args_count : 2;
+    context->frames      = CreateFrameStack(outer + FrameStackSize(fn->expr_tree));
+    context->frames->top = outer;
+    memset(context->frames->values, 0, sizeof(*context->frames->values) * outer);
+
+    CatchUpTier(context);
     return context;
 }
 
+ComputationContext *NewComputation(SymbolFn *fn)
+{
+    Assert(fn != NULL);
+    return CreateComputationContext(fn);
+}
+
+// Compiled code is shared, so a clone costs the scratch space only
+ComputationContext *CloneComputation(ComputationContext *context)
+{
+    Assert(context != NULL);
+    ComputationContext *clone = CreateComputationContext(context->fn);
+    clone->generation         = context->generation;
+    return clone;
+}
+
+// Program of the context, compiled right away when the function is still on the tree tier. Used by the modes that
+// have no tree walker of their own.
+Program *ComputationProgram(ComputationContext *context)
+{
+    if (!context->program)
+    {
+        EnsureTier(context->fn, TIER_BYTECODE);
+        CatchUpTier(context);
+    }
+    return context->program;
+}
+
+// Functions are looked up in the global scope, as calls are parsed. Derivatives are taken again from the current
+// definition of their source once it was replaced, and kept when that one has no derivative. Others are their own
+// current definition. Returns a reference.
+static SymbolFn *CurrentDefinition(SymbolFn *fn)
+{
+    if (fn->source)
+    {
+        SymbolFn *source  = CurrentDefinition(fn->source);
+        SymbolFn *current = source != fn->source ? DifferentiateSymbolFn(source, fn->source_arg) : NULL;
+        DestroySymbolFn(source);
+        return current ? current : RetainSymbolFn(fn);
+    }
+    SymbolFn *current = FindSymbolTableEntryFn(fn->interpreter, fn->interpreter->stack.symbol_tables[0], fn->id);
+    return RetainSymbolFn(current ? current : fn);
+}
+
+ComputationChange RefreshComputation(ComputationContext *context)
+{
+    Assert(context != NULL);
+    SymbolFn *fn     = CurrentDefinition(context->fn);
+    uint32_t  code   = 0;
+    uint32_t  values = 0;
+    LatestChanges(fn, &code, &values);
+
+    if (fn == context->fn && code <= context->generation)
+    {
+        DestroySymbolFn(fn);
+        if (values <= context->generation)
+            return COMPUTATION_UNCHANGED;
+        // Globals are loaded on every run, so the program reads the new values already
+        context->generation = context->fn->interpreter->generation;
+        return COMPUTATION_VALUES_CHANGED;
+    }
+
+    // Code compiled for fn before the change is stale, as is every context made from it. Contents of a fresh context
+    // are swapped in, so the context keeps its address for whoever holds it. The old definition goes away with the
+    // last context running it.
+    InvalidateTiers(fn, code);
+    ComputationContext *fresh = NewComputation(fn);
+    DestroySymbolFn(fn);
+    ComputationContext  stale = *context;
+    *context                  = *fresh;
+    *fresh                    = stale;
+    DestroyComputationContext(fresh);
+    return COMPUTATION_RECOMPILED;
+}
+
+// The hoisted instructions only read constants and globals, and every change of a global bumps the generation of the
+// interpreter. They are run again when it moved, and their values copied to every lane of the batch registers too.
+static void UpdateInvariants(ComputationContext *context)
+{
+    uint32_t generation = context->fn->interpreter->generation;
+    if (context->invariants_generation == generation)
+        return;
+
+    Program *program = context->program;
+    if (program->invariant_count)
+        ExecuteProgramRange(program, context->frames, context->registers, 0, program->invariant_count);
+    for (uint32_t reg = 0; reg < program->invariant_count; ++reg)
+    {
+        float *row = context->batch_registers + reg * BATCH_LANES;
+        for (uint32_t lane = 0; lane < BATCH_LANES; ++lane)
+            row[lane] = context->registers[reg];
+    }
+    context->invariants_generation = generation;
+}
+
 // float EvalFromContext(ComputationContext* context, uint32_t var_count,  ...)
 float EvalFromContext(ComputationContext *context, float x, float y)
 {
     Assert(context != NULL);
+    if (++context->unreported >= TIER_REPORT_INTERVAL)
+        ReportSamples(context, 0);
+
+    if (context->tier == TIER_NATIVE)
+        return (float)context->native(x, y);
+
     // Change first argument regardless of the name
-    context->table->variables[0].data.value = x;
-    context->table->variables[0].var_type   = VAR_VALUE;
+    context->frames->values[0] = x;
+    context->frames->values[1] = y;
+    if (context->tier == TIER_TREE)
+        return EvalExprTreeWithSymbolTableStack(&context->fn->interpreter->stack, context->frames,
+                                                context->fn->expr_tree);
+
+    // Calls to user functions push their arguments above the outermost frame and pop them on return
+    Program *program = context->program;
+    UpdateInvariants(context);
+    return ExecuteProgramRange(program, context->frames, context->registers, program->invariant_count, program->count);
+}
 
-    context->table->variables[1].data.value = y;
-    context->table->variables[1].var_type   = VAR_VALUE;
+// Forward mode and intervals can't follow calls evaluated by the tree walker, so they run a program with every call
+// inlined
+static Program *InlinedProgram(ComputationContext *context)
+{
+    if (!context->inlined_program)
+    {
+        Program *program = context->program;
+        if (program && !program->calls_count)
+            context->inlined_program = RetainProgram(program);
+        else
+            context->inlined_program = CompileSymbolFnWithBudget(context->fn, UINT32_MAX);
+    }
+    return context->inlined_program;
+}
 
-    PushToSymbolTableStack(&symbol_table_stack, context->table);
+float EvalFromContextWithGradient(ComputationContext *context, float x, float y, float gradient[2])
+{
+    Assert(context != NULL);
+    Program *program = InlinedProgram(context);
+    if (!context->gradient_registers)
+    {
+        context->gradient_registers = malloc(sizeof(*context->gradient_registers) * program->count * 3);
+        Assert(context->gradient_registers != NULL);
+    }
 
-    float val = EvalExprTreeWithSymbolTableStack(&symbol_table_stack, context->fn->expr_tree);
+    context->frames->values[0] = x;
+    context->frames->values[1] = y;
+    return ExecuteProgramDual(program, context->frames, context->gradient_registers, gradient);
+}
 
-    PopFromSymbolTableStack(&symbol_table_stack);
-    return val;
+Interval EvalFromContextInterval(ComputationContext *context, Interval x, Interval y)
+{
+    Assert(context != NULL);
+    Program *program = InlinedProgram(context);
+    if (!context->interval_registers)
+    {
+        context->interval_registers = malloc(sizeof(*context->interval_registers) * program->count);
+        Assert(context->interval_registers != NULL);
+    }
+    return ExecuteProgramInterval(program, context->frames, context->interval_registers, x, y);
 }
 
-float Eval1DFunction(SymbolFn *fn, float x)
+void EvalFromContextBatch(ComputationContext *context, const float *xs, const float *ys, float *out, size_t n)
 {
-    SymbolTable *top_table           = TopOfSymbolTableStack(&symbol_table_stack);
-    top_table->variables[0].var_type = TERM_VALUE;
-    PushToSymbolTableStack(&symbol_table_stack, top_table);
-    PopFromSymbolTableStack(&symbol_table_stack);
-    /*return EvalExprTreeWithSymbolTableStack(&symbol_table_stack,)*/
+    Assert(context != NULL);
+    static const float zeros[BATCH_LANES] = {0};
+
+    float              xs_tail[BATCH_LANES];
+    float              ys_tail[BATCH_LANES];
+
+    // Batches are counted as a whole, the native tier keeps running them on the SIMD interpreter
+    if (n >= TIER_REPORT_INTERVAL - context->unreported)
+        ReportSamples(context, n);
+    else
+        context->unreported = context->unreported + (uint32_t)n;
+
+    for (size_t start = 0; start < n; start += BATCH_LANES)
+    {
+        size_t       lanes    = n - start < BATCH_LANES ? n - start : BATCH_LANES;
+        const float *xs_block = xs + start;
+        const float *ys_block = ys ? ys + start : zeros;
+
+        // A long batch may be what made the function hot, so it switches to the program as soon as one is published
+        if (context->tier == TIER_TREE)
+        {
+            SymbolTableStack *stack = &context->fn->interpreter->stack;
+            ExprTree         *body  = context->fn->expr_tree;
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                context->frames->values[0] = xs_block[lane];
+                context->frames->values[1] = ys_block[lane];
+                out[start + lane]          = EvalExprTreeWithSymbolTableStack(stack, context->frames, body);
+            }
+            CatchUpTier(context);
+            continue;
+        }
+
+        // The last partial block is padded, so that kernels always run over full blocks
+        if (lanes < BATCH_LANES)
+        {
+            memset(xs_tail, 0, sizeof(xs_tail));
+            memcpy(xs_tail, xs_block, sizeof(*xs_tail) * lanes);
+            xs_block = xs_tail;
+            if (ys)
+            {
+                memset(ys_tail, 0, sizeof(ys_tail));
+                memcpy(ys_tail, ys_block, sizeof(*ys_tail) * lanes);
+                ys_block = ys_tail;
+            }
+        }
+
+        UpdateInvariants(context);
+        float *result = ExecuteProgramBatch(context->program, context->frames, context->batch_registers,
+                                            context->program->invariant_count, xs_block, ys_block);
+        memcpy(out + start, result, sizeof(*out) * lanes);
+    }
 }
 
 void DestroyComputationContext(ComputationContext *context)
 {
-    free(context->table);
+    DestroyProgram(context->program);
+    free(context->registers);
+    free(context->batch_registers);
+    DestroyProgram(context->inlined_program);
+    free(context->gradient_registers);
+    free(context->interval_registers);
+    DestroyFrameStack(context->frames);
+    DestroySymbolTable(context->table);
+    DestroySymbolFn(context->fn);
     free(context);
 }
 
-void EvalAndPrintFunctions(SymbolTableStack *stable_stack, SymbolFn *fn)
+OptimizationReport GetOptimizationReport(ComputationContext *context)
 {
-    SymbolTable *table = CreateSymbolTable(true);
-    // Populate this symbol table with the arguments of functions
-    for (uint32_t arg = 0; arg < fn->args_count; ++arg)
-    {
-        table->variables[table->var_count]          = fn->args[arg];
-        table->variables[table->var_count].var_type = TERM_VALUE;
-        table->var_count                            = table->var_count + 1;
-    }
+    Assert(context != NULL);
+    return ComputationProgram(context)->report;
+}
 
-    // find x
-    SymbolVar *var_x = FindSymbolTableEntryVar(table, "x");
-    Assert(var_x != NULL);
-    SymbolVar *var_y = FindSymbolTableEntryVar(table, "y");
-    Assert(var_y != NULL);
+void EvalAndPrintFunctions(SymbolTableStack *stable_stack, SymbolFn *fn)
+{
+    // x and y are the first two arguments of the outermost frame
+    uint32_t    outer  = fn->args_count > 2 ? fn->args_count : 2;
+    FrameStack *frames = CreateFrameStack(outer + FrameStackSize(fn->expr_tree));
+    frames->top        = outer;
 
-    PushToSymbolTableStack(stable_stack, table);
     for (uint32_t x = 0; x < 10; ++x)
     {
-        var_x->data.value = x;
+        frames->values[0] = x;
         for (uint32_t y = 0; y < 10; ++y)
         {
-            var_y->data.value = y;
+            frames->values[1] = y;
             fprintf(stdout, "(%2u,%2u) -> %3.2f |", x, y,
-                    EvalExprTreeWithSymbolTableStack(stable_stack, fn->expr_tree));
+                    EvalExprTreeWithSymbolTableStack(stable_stack, frames, fn->expr_tree));
         }
         fprintf(stdout, "\n");
     }
-    free(PopFromSymbolTableStack(stable_stack));
+    DestroyFrameStack(frames);
 }
 
-Parser *CreateParser(const char *str, uint32_t len) // string that remains valid
+Parser *CreateParser(Interpreter *interpreter, const char *str, uint32_t len) // string that remains valid
 {
+    Assert(interpreter != NULL);
     Parser *parser = malloc(sizeof(*parser));
     Assert(parser != NULL);
-    *parser = (Parser){.tokenizer = CreateTokenizer((uint8_t *)str, len), .current_token = TOKEN_NONE};
+    *parser = (Parser){.interpreter   = interpreter,
+                       .tokenizer     = CreateTokenizer((uint8_t *)str, len),
+                       .current_token = {.type = TOKEN_NONE}};
     return parser;
 }
 
 void UpdateParserData(Parser *parser, const char *str, uint32_t len)
 {
-    parser->tokenizer->buffer.data = str;
-    parser->tokenizer->buffer.pos  = 0;
-    parser->tokenizer->buffer.len  = len; 
+    TokenizerSetBuffer(parser->tokenizer, (uint8_t *)str, len);
 }
 
 void InitInterpreter()
 {
-    InitSymbolTableStack(&symbol_table_stack); 
-    InitBuiltinFunctions(); 
+    // The batch kernels are picked once here instead of racing on first use
+    BatchInstructionSet();
+}
+
+Interpreter *CreateInterpreter(void)
+{
+    Interpreter *interpreter = malloc(sizeof(*interpreter));
+    Assert(interpreter != NULL);
+    memset(interpreter, 0, sizeof(*interpreter));
+    interpreter->inline_budget = 256;
+    interpreter->accuracy      = BUILTIN_FAST;
+    interpreter->lock          = CreateInterpreterLock();
+    SetTierThresholds(interpreter, 4096, 262144);
+
+    InitSymbolTableStack(&interpreter->stack);
+    RegisterBuiltins(interpreter);
+    return interpreter;
+}
+
+void DestroyInterpreter(Interpreter *interpreter)
+{
+    if (!interpreter)
+        return;
+    WaitForPromotions(interpreter);
+    // Functions replaced by a redefinition or by a rebound copy go away with the last function in the tables calling
+    // them
+    for (uint32_t scope = 0; scope < interpreter->stack.count; ++scope)
+    {
+        SymbolTable *table = interpreter->stack.symbol_tables[scope];
+        for (uint32_t fn = 0; fn < table->fn_count; ++fn)
+            DestroySymbolFn(table->functions[fn]);
+        DestroySymbolTable(table);
+    }
+    free(interpreter->stack.symbol_tables);
+    free(interpreter->replaced);
+    DestroyNameMap(&interpreter->builtin_names);
+    DestroyInterner(&interpreter->interner);
+    DestroyInterpreterLock(interpreter->lock);
+    free(interpreter->aot_cache);
+    free(interpreter);
 }
 
 int smain(int argc, char **argv)
 {
-    InitSymbolTableStack(&symbol_table_stack);
-    InitBuiltinFunctions();
+    InitInterpreter();
+    Interpreter *interpreter = CreateInterpreter();
     // const char *string = "1 + 2 * (3 * 4 + 44 / 4 * 2) / 4 - 3 ";
     // const char *string    = "2 * 2";
     // Tokenizer  *tokenizer = CreateTokenizer(string, strlen(string));
@@ -1299,29 +1734,34 @@ int smain(int argc, char **argv)
 
     // const char *expr    = "a = 4 \n cd = 4 \n g(x,y) = x + y";
     // const char *expr    = "cd = 34 \n g(x,y) = y + x \n f(x,y) = x * y \n a = f(3,2) + g(3,2)";
-    Parser *nparser = CreateParser(expr, strlen(expr));
+    Parser *nparser = CreateParser(interpreter, expr, strlen(expr));
     RunInterpreter(nparser);
 
-    SymbolTable *scope = CheckVarInScope(&symbol_table_stack, "cd");
+    SymbolTable *scope = CheckVarInScope(interpreter, "cd");
     Assert(scope != NULL);
 
     // We know have functions, now we need a way to evaluate it
-    PrintSymbolTable(symbol_table_stack.symbol_tables[0]);
+    PrintSymbolTable(interpreter->stack.symbol_tables[0]);
 
     fprintf(stdout, "Showing function implementation test \n");
 
-    for (uint32_t fn = 0; fn < symbol_table_stack.symbol_tables[0]->fn_count - 1; ++fn)
+    for (uint32_t fn = 0; fn < interpreter->stack.symbol_tables[0]->fn_count - 1; ++fn)
     {
         fprintf(stdout, "\n%u function\n\n", fn);
-        EvalAndPrintFunctions(&symbol_table_stack, symbol_table_stack.symbol_tables[0]->functions[fn]);
+        EvalAndPrintFunctions(&interpreter->stack, interpreter->stack.symbol_tables[0]->functions[fn]);
     }
 
-    ComputationContext *context = NewComputation(symbol_table_stack.symbol_tables[0]->functions[0]);
+    ComputationContext *context = NewComputation(interpreter->stack.symbol_tables[0]->functions[0]);
     for (float x = -5; x <= 5; x++)
     {
         fprintf(stdout, "%3.3f : %3.3f.\n", x, EvalFromContext(context, x, x));
     }
+    OptimizationReport report = GetOptimizationReport(context);
+    fprintf(stdout, "Nodes : %u parsed, %u calls inlined, %u after folding, %u after sharing, %u hoisted.\n",
+            report.nodes_before, report.calls_inlined, report.nodes_after_folding, report.nodes_after_sharing,
+            report.hoisted);
     DestroyComputationContext(context);
+    DestroyInterpreter(interpreter);
 
     return 0;
 }
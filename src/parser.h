@@ -1,28 +1,171 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct SymbolFn    SymbolFn;
 typedef struct SymbolTable SymbolTable;
 typedef struct SymbolVar   SymbolVar;
 typedef struct Parser      Parser;
+typedef struct Program     Program;
+typedef struct FrameStack  FrameStack;
+typedef struct JitFunction JitFunction;
+typedef struct AotFunction AotFunction;
+typedef struct Interpreter Interpreter;
 
-typedef struct ComputationContext // probably dependency graph
+// Size of a function, counted in instructions, at each stage of compilation
+typedef struct OptimizationReport
 {
-    uint32_t     var_count;
-    SymbolFn    *fn;    // Function under computation
-    SymbolTable *table; // Most enclosing scope of execution
-    SymbolVar   *vars[10];
+    uint32_t nodes_before;        // as parsed
+    uint32_t calls_inlined;       // user function calls replaced by the body of the callee
+    uint32_t nodes_after_folding; // after inlining, constant folding and simplification
+    uint32_t nodes_after_sharing; // after identical subexpressions are merged
+    uint32_t hoisted;             // of those, reading no argument : run once per change of the globals, not per sample
+} OptimizationReport;
+
+typedef double (*JitFn1D)(double x);
+typedef double (*JitFn2D)(double x, double y);
+
+// Closed range of values, empty when lo > hi
+typedef struct Interval
+{
+    float lo;
+    float hi;
+} Interval;
+
+// Accuracy of the builtins evaluated by EvalFromContextBatch. The fast tier runs vector kernels within a few float ulp
+// of libm for finite results, about 1e-7 relative, which is plenty for pixels. pow drifts up to about 1e-5 as its
+// result nears the float range, and sin, cos and tan lose precision for arguments beyond a few thousand and are nan
+// beyond about 1e9. Otherwise nan, inf, overflow and underflow come out as libm gives them. The accurate tier computes
+// every lane with libm, as the scalar interpreters always do.
+typedef enum BuiltinAccuracy
+{
+    BUILTIN_FAST,
+    BUILTIN_ACCURATE
+} BuiltinAccuracy;
+
+// Ways a function is evaluated, cheapest to set up first. Functions move up as they are sampled, see SetTierThresholds.
+typedef enum ExecutionTier
+{
+    TIER_TREE,     // walking the parsed tree, nothing is compiled
+    TIER_BYTECODE, // inlined, folded, shared and hoisted program, run by the scalar and the SIMD batch interpreters
+    TIER_NATIVE,   // x86-64 code for single samples, batches keep running the bytecode
+    TIER_COUNT
+} ExecutionTier;
+
+// Tier of a function, shared by all of its contexts
+typedef struct TierReport
+{
+    ExecutionTier tier;        // published, what contexts switch to
+    ExecutionTier requested;   // being compiled in the background when above tier
+    uint64_t      evaluations; // samples evaluated by all contexts of the function, up to a few hundred per context
+} TierReport;
+
+// The compiled code of a context is immutable and shared by every context of its function, the rest is scratch space for
+// one thread. Give each worker its own CloneComputation and they can evaluate the same function in parallel, as long as
+// nothing is parsed into the interpreter meanwhile. Contexts start on the tier their function has reached and move up
+// with it, see ExecutionTier.
+typedef struct ComputationContext
+{
+    uint32_t      var_count;
+    SymbolFn     *fn;    // Function under computation
+    SymbolTable  *table; // Most enclosing scope of execution
+    SymbolVar    *vars[10];
+
+    ExecutionTier tier;       // what the context runs, catches up with its function when it reports samples
+    uint32_t      unreported; // samples evaluated since the context last added to the counters of its function
+    JitFn2D       native;     // entry of the native tier
+
+    Program      *program;         // Compiled form of fn->expr_tree, NULL on the tree tier
+    float        *registers;       // One per instruction of the program
+    FrameStack   *frames;          // Arguments of the computation and of every call made while evaluating it
+    float        *batch_registers; // BATCH_LANES values per instruction, for EvalFromContextBatch
+
+    Program      *inlined_program;    // program without calls, compiled on first use by the gradient and interval modes
+    float        *gradient_registers; // value and two partial derivatives per instruction
+    Interval     *interval_registers; // range of every instruction over a box
+
+    uint32_t      generation;            // of the interpreter at the last RefreshComputation, or at creation
+    uint32_t      invariants_generation; // of the interpreter when the registers not reading x or y were last filled
 } ComputationContext;
 
-Parser *CreateParser(const char *str, uint32_t len); // string that should remain valid till the parsing continues
+// What RefreshComputation did to a context
+typedef enum ComputationChange
+{
+    COMPUTATION_UNCHANGED,
+    COMPUTATION_VALUES_CHANGED, // a variable it reads was redefined, the program reads the new value as it is
+    COMPUTATION_RECOMPILED      // its function or one it calls was redefined, the program was compiled again
+} ComputationChange;
+
+// Process wide setup of the read-only tables every interpreter shares, call once before starting any thread
+void                InitInterpreter();
+Interpreter        *CreateInterpreter(void);
+// Contexts of the functions it parsed and their derivatives must be destroyed first
+void                DestroyInterpreter(Interpreter *interpreter);
+
+// string that should remain valid till the parsing continues
+Parser             *CreateParser(Interpreter *interpreter, const char *str, uint32_t len);
+// Cheap, functions are only compiled once they turn out to be sampled a lot
 ComputationContext *NewComputation(SymbolFn *fn);
-SymbolFn           *GetLatestParsedFn();
+// Fresh scratch space over the code of context, clones are created and destroyed by the thread owning context
+ComputationContext *CloneComputation(ComputationContext *context);
+// NULL until a function has been parsed
+SymbolFn           *GetLatestParsedFn(Interpreter *interpreter);
+// Arguments fn was defined with, x and then y
+uint32_t            GetSymbolFnArity(SymbolFn *fn);
+// Brings context up to date with the definitions parsed since it was compiled or last refreshed, following the latest
+// definition of its function by name. Anything it reads, directly or through the functions it calls, counts. Until
+// then it runs the definitions it was made from. The context keeps its address, clones are refreshed on their own.
+ComputationChange   RefreshComputation(ComputationContext *context);
+// Assigns a global variable defined earlier, like parsing "id = value" would, for animations and parameter sweeps.
+// Subexpressions of a function that don't read its arguments are evaluated once per such change, not per sample.
+// False when there is no such variable.
+bool                SetVariable(Interpreter *interpreter, const char *id, float value);
 
 float               EvalFromContext(ComputationContext *context, float x, float y);
+// out[i] = f(xs[i], ys[i]) for n samples, ys may be NULL for functions of x alone
+void EvalFromContextBatch(ComputationContext *context, const float *xs, const float *ys, float *out, size_t n);
+// f(x, y) along with df/dx and df/dy, computed exactly in a single forward pass
+float EvalFromContextWithGradient(ComputationContext *context, float x, float y, float gradient[2]);
+// Range guaranteed to hold f at every point of the box x * y, possibly wider. Empty where f is undefined on all of it.
+Interval EvalFromContextInterval(ComputationContext *context, Interval x, Interval y);
+
+// New function computing the derivative of fn in its argument arg, simplified and ready for NewComputation. It reads
+// the scopes of fn, and RefreshComputation differentiates the latest definition of fn again once fn or a function it
+// calls is redefined. NULL when fn has no symbolic derivative, as with (x + 1) ^ x.
+// Functions are reference counted : contexts hold their own, so DestroySymbolFn may come before their destruction.
+SymbolFn           *DifferentiateSymbolFn(SymbolFn *fn, uint32_t arg);
+void                DestroySymbolFn(SymbolFn *fn);
 
 void                DestroyComputationContext(ComputationContext *context);
+OptimizationReport  GetOptimizationReport(ComputationContext *context);
+// Native code for the function of the context, NULL when the target isn't x86-64 or the function still calls other
+// user functions at runtime. The entries are interchangeable with ParametricFn1D and ImplicitFn2D.
+JitFunction        *JitCompile(ComputationContext *context);
+JitFn1D             JitEntry1D(JitFunction *jit);
+JitFn2D             JitEntry2D(JitFunction *jit);
+void                JitDestroy(JitFunction *jit);
+// Native code for the function of the context written out as C, built by the system compiler into a shared object and
+// loaded with dlopen. Objects are cached on disk by a hash of the optimized expression, so an expression seen in any
+// earlier session loads without compiling. NULL on Windows, when no compiler could run, the cache isn't private to the
+// user or the function reads more than 64 globals. cc is the compiler unless MORPH_CC names another.
+AotFunction        *AotCompile(ComputationContext *context);
+double              AotEval(AotFunction *aot, double x, double y);
+// out[i] = f(xs[i], ys[i]) like EvalFromContextBatch, globals are read once for the whole batch
+void                AotEvalBatch(AotFunction *aot, const float *xs, const float *ys, float *out, size_t n);
+void                AotDestroy(AotFunction *aot);
+// Directory of the cached objects, created when missing. NULL restores the default : MORPH_AOT_CACHE, else the cache
+// directory of the user. It must be owned by the user and writable by no one else, AotCompile returns NULL otherwise.
+void                SetAotCache(Interpreter *interpreter, const char *directory);
+
+// Largest count of callee nodes inlined into a single function, calls beyond it are made at runtime
+void                SetInlineBudget(Interpreter *interpreter, uint32_t budget);
+// Tier of the batch builtins of functions compiled afterwards, BUILTIN_FAST by default
+void                SetBuiltinAccuracy(Interpreter *interpreter, BuiltinAccuracy accuracy);
+// Samples after which functions are promoted to bytecode and to native code, counted over all of their contexts
+void                SetTierThresholds(Interpreter *interpreter, uint64_t bytecode, uint64_t native);
+TierReport          GetTierReport(SymbolFn *fn);
 void                UpdateParser(Parser *parser, const char *str, uint32_t len);
 void                UpdateParserData(Parser *parser, const char *str, uint32_t len);
 void                ParseStart(Parser *parser);
-void                InitInterpreter();
@@ -0,0 +1,514 @@
+#pragma once
+
+// Types shared between the parser, the tree-walking interpreter and the bytecode compiler
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "./parser.h"
+
+#if defined(__GNUC__)
+#define Unreachable() __builtin_unreachable()
+#elif defined(_MSC_VER)
+#define Unreachable() __assume(false);
+#endif
+
+#define Unimplemented()                                                                                                \
+    {                                                                                                                  \
+        fprintf(stderr, "Function %s() not implemented : %d.", __func__, __LINE__);                                    \
+        abort();                                                                                                       \
+    }
+#define Assert(str)                                                                                                    \
+    {                                                                                                                  \
+        if (!(str))                                                                                                    \
+        {                                                                                                              \
+            fprintf(stderr, "Function : %s() Line : %d Assertion Failed : %s.\n", __func__, __LINE__, #str);           \
+            abort();                                                                                                   \
+        }                                                                                                              \
+    }
+
+// Atomics on plain integers, for the little state shared with the promotion workers of tier.c. Loads acquire, stores
+// release, additions return the new value.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AtomicLoad32(ptr)         ((uint32_t)_InterlockedOr((volatile long *)(ptr), 0))
+#define AtomicStore32(ptr, value) _InterlockedExchange((volatile long *)(ptr), (long)(value))
+#define AtomicAdd32(ptr, value)   ((uint32_t)_InterlockedExchangeAdd((volatile long *)(ptr), (long)(value)) + (value))
+#define AtomicLoad64(ptr)         ((uint64_t)_InterlockedOr64((volatile long long *)(ptr), 0))
+#define AtomicAdd64(ptr, value)                                                                                        \
+    ((uint64_t)_InterlockedExchangeAdd64((volatile long long *)(ptr), (long long)(value)) + (value))
+#else
+#define AtomicLoad32(ptr)         __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define AtomicStore32(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define AtomicAdd32(ptr, value)   __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL)
+#define AtomicLoad64(ptr)         __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define AtomicAdd64(ptr, value)   __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED)
+#endif
+
+#define MAX_ID_LEN 64
+
+typedef enum
+{
+    OP_ADD,
+    OP_SUB,
+    OP_DIV,
+    OP_MUL,
+    OP_EXP,
+    OP_EQUAL,
+    OP_FUNC_APPLY,
+    OP_NONE
+} Op;
+
+typedef enum
+{
+    NODE,
+    LEAF
+} NodeType;
+
+typedef enum TermType
+{
+    TERM_FUNC, // for function definitions and calling
+    TERM_ID,   // for simple variables with values
+    TERM_VALUE,
+    TERM_ARG,  // bound to an argument of the enclosing function
+    TERM_SLOT  // bound to a variable of the scope at the given depth
+} TermType;
+
+typedef enum
+{
+    VAR_ID,
+    VAR_VALUE,
+    VAR_ARG, // Same meaning as TERM_ARG and TERM_SLOT, used by the arguments of function calls
+    VAR_SLOT
+} SymbolVarType;
+
+// Resolved location of an identifier, filled by the binding pass so that evaluation never looks up names
+typedef struct Binding
+{
+    uint16_t depth; // index into the symbol table stack, counted from the global scope
+    uint16_t slot;  // index of the argument or of the variable in its table
+} Binding;
+
+typedef struct SymbolVar
+{
+    SymbolVarType var_type;
+    struct
+    {
+        char  id_len;
+        char  id[MAX_ID_LEN];
+        float value;
+    } data; // named just for convenience
+    Binding  binding;
+    uint32_t generation; // of the interpreter when a variable of a scope was last assigned
+} SymbolVar;
+
+// Call sites are kept out of the nodes, in the arena of the tree, so a node stays a few dozen bytes
+typedef struct
+{
+    bool       is_builtin;
+    uint32_t   builtin_index;
+    uint32_t   args_used; // count of arguments used in calling the functions
+    SymbolVar *args;      // arguments passed to the function, args_used of them
+    SymbolFn  *fn;        // Reference to actual function being invoked
+} FuncData;
+
+typedef struct
+{
+    // could be num or variable or function invocation too
+    // handle all these cases
+    TermType type;
+    union {
+        float       value;
+        const char *id; // interned
+        Binding     binding;
+        FuncData   *func_data;
+    } value;
+} Terminal;
+
+typedef struct ExprTree
+{
+    NodeType node_type;
+
+    union {
+        Op       operation;
+        Terminal term;
+    } data;
+
+    struct ExprTree *left;
+    struct ExprTree *right;
+} ExprTree;
+
+// Nodes and call sites of a tree are bump allocated from the arena of their owner, the whole tree is released at once
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t             used;
+    size_t             size;
+    max_align_t        data[];
+} ArenaBlock;
+
+typedef struct ExprArena
+{
+    ArenaBlock *blocks; // the block being filled comes first
+} ExprArena;
+
+// Interned names, mapped to their slot in a scope or in the builtin registry
+typedef enum NameKind
+{
+    NAME_VAR,
+    NAME_FN,
+    NAME_BUILTIN
+} NameKind;
+
+typedef struct NameEntry
+{
+    const char *name; // interned, compared by address
+    uint32_t    kind;
+    uint32_t    slot;
+} NameEntry;
+
+typedef struct NameMap
+{
+    uint32_t   count;
+    uint32_t   max; // power of two
+    NameEntry *entries;
+} NameMap;
+
+typedef struct InternedString
+{
+    uint32_t    hash;
+    uint32_t    len;
+    const char *str;
+} InternedString;
+
+typedef struct Interner
+{
+    uint32_t        count;
+    uint32_t        max; // power of two
+    InternedString *strings;
+} Interner;
+
+// Builtins
+// Every builtin is one entry of the registry in builtins.c, indexed by BuiltinIndex. Unary builtins fill the entry
+// points without a 2, binary ones the others. The registry itself never changes, so every interpreter and thread
+// shares it.
+typedef enum BuiltinIndex
+{
+    BUILTIN_SIN,
+    BUILTIN_COS,
+    BUILTIN_TAN,
+    BUILTIN_EXP,
+    BUILTIN_SQRT,
+    BUILTIN_LOG,
+    BUILTIN_ABS,
+    BUILTIN_FLOOR,
+    BUILTIN_POW,
+    BUILTIN_MIN,
+    BUILTIN_MAX,
+    BUILTIN_ATAN2,
+    BUILTIN_MOD,
+    BUILTIN_CBRT,
+    // Partial derivatives of the builtins above, only ever called by differentiated code
+    BUILTIN_NEG_SIN,
+    BUILTIN_SQUARED_SEC,
+    BUILTIN_HALF_INV_SQRT,
+    BUILTIN_RECIPROCAL,
+    BUILTIN_SIGN,
+    BUILTIN_POW_DA,
+    BUILTIN_POW_DB,
+    BUILTIN_MIN_DA,
+    BUILTIN_MIN_DB,
+    BUILTIN_MAX_DA,
+    BUILTIN_MAX_DB,
+    BUILTIN_ATAN2_DY,
+    BUILTIN_ATAN2_DX,
+    BUILTIN_MOD_DB,
+    BUILTIN_CBRT_SLOPE,
+    BUILTIN_COUNT
+} BuiltinIndex;
+
+// Partial derivatives that aren't calls to another builtin
+#define PARTIAL_ZERO -1
+#define PARTIAL_ONE  -2
+#define PARTIAL_NONE -3 // the builtin can't be differentiated
+
+typedef double (*fn_ptr)(double f);
+typedef double (*fn2_ptr)(double a, double b);
+typedef void (*batch_fn)(float *out, const float *a); // BATCH_LANES lanes
+typedef void (*batch2_fn)(float *out, const float *a, const float *b);
+typedef Interval (*interval_fn)(Interval a);
+typedef Interval (*interval2_fn)(Interval a, Interval b);
+
+typedef struct Builtin
+{
+    const char  *name;
+    uint32_t     arity;  // 1 or 2
+    bool         hidden; // not callable by name
+    fn_ptr       fn;
+    fn2_ptr      fn2;
+    batch_fn     batch; // every lane computed by fn, the accurate tier of the batch interpreter
+    batch2_fn    batch2;
+    interval_fn  interval; // enclosure over ranges, NULL when nothing better than the whole line is known
+    interval2_fn interval2;
+    int32_t      partials[2]; // builtin computing the derivative in each argument from the same arguments, or PARTIAL_*
+} Builtin;
+
+typedef struct BuiltinFunctions
+{
+    uint32_t count;
+    Builtin  functions[BUILTIN_COUNT];
+} BuiltinFunctions;
+
+// Edges of the dependency graph leaving a function, everything its body reads directly. Each entry appears once.
+typedef struct Dependencies
+{
+    uint32_t   vars_count;
+    uint32_t   vars_max;
+    Binding   *vars; // global variables
+    uint32_t   fns_count;
+    uint32_t   fns_max;
+    SymbolFn **fns; // user functions called, each holding a reference
+} Dependencies;
+
+// Promotion of a function through the execution tiers, see tier.c. Code of the published tier and below is complete and
+// never changes, the rest is guarded by the lock of the interpreter.
+typedef struct RetiredJit
+{
+    JitFunction       *jit;
+    struct RetiredJit *next;
+} RetiredJit;
+
+typedef struct TierState
+{
+    uint64_t     evaluations; // atomic
+    uint32_t     tier;        // atomic, published with a release store once its code is complete
+    uint32_t     requested;   // atomic reads, written under the lock
+    bool         running;     // a worker is compiling
+    uint32_t     generation;  // of the interpreter when the program was compiled
+    Program     *program;     // of TIER_BYTECODE, holds a reference
+    JitFunction *jit;         // of TIER_NATIVE
+    RetiredJit  *retired;     // native code invalidated by a redefinition, contexts may still be running it
+} TierState;
+
+typedef struct SymbolFn
+{
+    uint32_t     type; // implicit 1D, 2D or HD
+    char         id[MAX_ID_LEN];
+    uint32_t     args_count;
+    SymbolVar    args[10];
+    ExprTree    *expr_tree;
+    ExprArena   *arena;       // owns expr_tree and dependencies
+    Interpreter *interpreter; // whose scopes the bindings of expr_tree refer to
+    Dependencies dependencies;
+    uint32_t     generation; // of the interpreter when it was defined or its calls were last rebound
+    TierState    tier_state;
+    uint32_t     references; // atomic, held by its table slot, its contexts, its callers and its derivatives
+    SymbolFn    *source;     // of a derivative, differentiated in source_arg again once it is redefined
+    uint32_t     source_arg;
+} SymbolFn;
+
+// TODO :: Upgrade symbol table to use stack based implementation
+// Entries are kept in insertion order in the arrays, bindings refer to them by index. names indexes both arrays.
+typedef struct SymbolTable
+{
+    uint32_t   var_count;
+    uint32_t   var_max;
+    uint32_t   fn_count;
+    uint32_t   fn_max;
+
+    SymbolVar *variables;
+    SymbolFn **functions;
+    NameMap    names;
+
+    bool       should_evaluate;
+} SymbolTable;
+
+typedef struct SymbolTableStack
+{
+    uint32_t      count;
+    uint32_t      max;
+    SymbolTable **symbol_tables;
+} SymbolTableStack;
+
+typedef struct InterpreterLock InterpreterLock;
+
+// Everything parsing and binding reads or writes. Interpreters share nothing mutable, so each can be driven by its own
+// thread, and evaluation only reads the scopes of the interpreter that parsed the function.
+struct Interpreter
+{
+    SymbolTableStack stack;
+    Interner         interner;
+    NameMap          builtin_names; // interned builtin name -> index into builtins
+    SymbolFn        *latest_parsed_fn;
+    uint32_t         inline_budget;
+    BuiltinAccuracy  accuracy;   // of the batch builtins in programs compiled from now on
+    uint32_t         generation; // count of definitions parsed so far, stamps what each of them replaced
+
+    InterpreterLock *lock;                        // held while parsing and by promotion workers
+    uint32_t         workers;                     // promotion workers alive, under the lock
+    uint64_t         tier_thresholds[TIER_COUNT]; // samples a function needs to reach each tier
+    char            *aot_cache;                   // directory of the shared objects built by aot.c, NULL for the default
+
+    SymbolFn       **replaced; // dropped from the tables while parsing, released once the lock is given back
+    uint32_t         replaced_count;
+    uint32_t         replaced_max;
+};
+
+// Samples evaluated together by the batch interpreter, a multiple of every vector width
+#define BATCH_LANES 64
+
+// Call frames
+// Arguments of every active call live in one contiguous array of values, a call pushes its arguments on top and the
+// callee reads them relative to base. The array is sized once for the deepest call chain, so calls never allocate.
+typedef struct FrameStack
+{
+    uint32_t base; // first argument of the innermost call
+    uint32_t top;  // first free value
+    uint32_t max;
+    float   *values;
+} FrameStack;
+
+// Bytecode
+// Every instruction produces exactly one value, written to the register with the same index as the instruction.
+// Operands always refer to earlier registers, so a program is executed by a single forward sweep and the result
+// is the register of the last instruction.
+typedef enum OpCode
+{
+    OPCODE_CONST,   // r = value
+    OPCODE_ARG,     // r = args[a]
+    OPCODE_LOAD,    // r = variable b of the scope at depth a
+    OPCODE_ADD,     // r = r[a] + r[b]
+    OPCODE_SUB,     // r = r[a] - r[b]
+    OPCODE_MUL,     // r = r[a] * r[b]
+    OPCODE_DIV,     // r = r[a] / r[b]
+    OPCODE_BUILTIN,  // r = builtins[b](r[a])
+    OPCODE_BUILTIN2, // r = builtins[c](r[a], r[b])
+    OPCODE_CALL      // r = user function application, a indexes into program->calls
+} OpCode;
+
+typedef struct Instruction
+{
+    uint16_t opcode;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+    float    value;
+} Instruction;
+
+typedef struct Program
+{
+    uint32_t           count;
+    uint32_t           max;
+    Instruction       *code;
+    uint32_t           invariant_count; // leading instructions that read no argument, see HoistInvariants
+
+    uint32_t           calls_count;
+    uint32_t           calls_max;
+    FuncData         **calls; // user function call sites, still evaluated by the tree walker on the frame stack
+
+    ExprTree          *tree; // optimized copy of the source tree, owns the call sites
+    ExprArena         *arena; // holds tree
+    OptimizationReport report;
+
+    SymbolTableStack  *stack;      // scopes read by OPCODE_LOAD and by the call sites
+    uint32_t           references; // contexts sharing the program, it is never modified after compilation
+    BuiltinAccuracy    accuracy;   // picks the builtin kernels of the batch interpreter
+} Program;
+
+extern const BuiltinFunctions builtins;
+
+SymbolTable *CheckVarInScope(Interpreter *interpreter, const char *id);
+SymbolVar   *FindSymbolTableEntryVar(Interpreter *interpreter, SymbolTable *symbol_table, const char *id);
+SymbolFn    *FindSymbolTableEntryFn(Interpreter *interpreter, SymbolTable *symbol_table, const char *id);
+SymbolFn    *RetainSymbolFn(SymbolFn *fn);
+void         ReleaseReplacedFn(SymbolFn *fn);
+SymbolTable *CreateSymbolTable(bool should_evaluate);
+void         DestroySymbolTable(SymbolTable *symbol_table);
+void         PushToSymbolTableStack(SymbolTableStack *stable_stack, SymbolTable *stable);
+SymbolTable *PopFromSymbolTableStack(SymbolTableStack *stable_stack);
+float        FunctionApplication(SymbolTableStack *stable_stack, FrameStack *frames, FuncData *fn_data);
+float        EvalExprTreeWithSymbolTableStack(SymbolTableStack *stable_stack, FrameStack *frames, ExprTree *expr);
+uint32_t     FrameStackSize(ExprTree *expr);
+Program     *ComputationProgram(ComputationContext *context);
+void         BindExprTree(Interpreter *interpreter, SymbolFn *fn, ExprTree *expr);
+
+ExprArena   *CreateExprArena(void);
+void        *ArenaAlloc(ExprArena *arena, size_t size);
+void         DestroyExprArena(ExprArena *arena);
+
+// From builtins.c
+void         RegisterBuiltins(Interpreter *interpreter);
+int32_t      FindBuiltin(Interpreter *interpreter, const char *id);
+double       Power(double base, double exponent);
+
+// From intern.c
+const char  *InternString(Interner *interner, const char *str, uint32_t len);
+const char  *FindInternedString(Interner *interner, const char *str, uint32_t len);
+void         DestroyInterner(Interner *interner);
+void         NameMapInsert(NameMap *map, const char *name, uint32_t kind, uint32_t slot);
+bool         NameMapFind(NameMap *map, const char *name, uint32_t kind, uint32_t *slot);
+void         DestroyNameMap(NameMap *map);
+
+// From optimize.c
+ExprTree    *CloneExprTree(ExprArena *arena, ExprTree *expr);
+uint32_t     CountExprTree(ExprTree *expr);
+ExprTree    *InlineExprTree(ExprArena *arena, ExprTree *expr, uint32_t budget, uint32_t *inlined);
+ExprTree    *SimplifyExprTree(ExprArena *arena, ExprTree *expr);
+
+// From dependency.c
+void         CollectDependencies(SymbolFn *fn);
+void         RebindCallers(SymbolTable *table, SymbolFn *old_fn, SymbolFn *new_fn);
+void         LatestChanges(SymbolFn *fn, uint32_t *code, uint32_t *values);
+
+// From tier.c
+InterpreterLock *CreateInterpreterLock(void);
+void             DestroyInterpreterLock(InterpreterLock *lock);
+void             AcquireInterpreterLock(InterpreterLock *lock);
+void             ReleaseInterpreterLock(InterpreterLock *lock);
+void             CountEvaluations(SymbolFn *fn, uint64_t samples);
+ExecutionTier    PublishedTier(SymbolFn *fn);
+void             EnsureTier(SymbolFn *fn, ExecutionTier tier);
+void             WaitForPromotion(SymbolFn *fn);
+void             WaitForPromotions(Interpreter *interpreter);
+void             InvalidateTiers(SymbolFn *fn, uint32_t generation);
+void             ReleaseTiers(SymbolFn *fn);
+
+// From jit.c
+JitFunction     *JitCompileProgram(Program *program);
+
+// From derivative.c
+ExprTree    *DifferentiateExprTree(ExprArena *arena, ExprTree *expr, uint32_t arg);
+
+// From bytecode.c
+Program     *CompileSymbolFn(SymbolFn *fn);
+Program     *CompileSymbolFnWithBudget(SymbolFn *fn, uint32_t inline_budget);
+Program     *RetainProgram(Program *program);
+void         DestroyProgram(Program *program);
+float        ExecuteProgram(Program *program, FrameStack *frames, float *registers);
+float        ExecuteProgramRange(Program *program, FrameStack *frames, float *registers, uint32_t first, uint32_t last);
+float        ExecuteProgramDual(Program *program, FrameStack *frames, float *registers, float gradient[2]);
+
+// From interval.c
+Interval     IntervalSin(Interval a);
+Interval     IntervalCos(Interval a);
+Interval     IntervalTan(Interval a);
+Interval     IntervalExp(Interval a);
+Interval     IntervalSqrt(Interval a);
+Interval     IntervalLog(Interval a);
+Interval     IntervalAbs(Interval a);
+Interval     IntervalFloor(Interval a);
+Interval     IntervalPow(Interval a, Interval b);
+Interval     IntervalMin(Interval a, Interval b);
+Interval     IntervalMax(Interval a, Interval b);
+Interval     IntervalAtan2(Interval y, Interval x);
+Interval     IntervalMod(Interval a, Interval b);
+Interval     IntervalCbrt(Interval a);
+Interval     ExecuteProgramInterval(Program *program, FrameStack *frames, Interval *registers, Interval x, Interval y);
+
+// From batch.c
+float       *ExecuteProgramBatch(Program *program, FrameStack *frames, float *registers, uint32_t first, const float *xs,
+                                 const float *ys);
+const char  *BatchInstructionSet(void);
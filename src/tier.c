@@ -0,0 +1,288 @@
+#define _CRT_SECURE_NO_WARNINGS
+#define _DEFAULT_SOURCE // sched_yield under -std=c11
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "./parser_common.h"
+
+// Tiered execution
+// A function starts out walked as a tree by its contexts, which costs nothing to set up. Contexts add the samples they
+// evaluate to the counters of their function now and then, and once those cross the thresholds of the interpreter a
+// worker thread compiles the next tier in the background : the optimized bytecode first, then native code. Each tier is
+// published with a single release store once its code is complete, and contexts switch to it the next time they report
+// their samples, so callers never wait for a compiler nor see a half built program.
+//
+// Workers hold the lock of the interpreter while compiling, as parsing rebinds and grows what they read. Promotion
+// state of a function only changes under that lock too, apart from the counter and the published tier.
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct InterpreterLock
+{
+#if defined(_WIN32)
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t mutex;
+#endif
+};
+
+InterpreterLock *CreateInterpreterLock(void)
+{
+    InterpreterLock *lock = malloc(sizeof(*lock));
+    Assert(lock != NULL);
+#if defined(_WIN32)
+    InitializeCriticalSection(&lock->section);
+#else
+    pthread_mutex_init(&lock->mutex, NULL);
+#endif
+    return lock;
+}
+
+void DestroyInterpreterLock(InterpreterLock *lock)
+{
+#if defined(_WIN32)
+    DeleteCriticalSection(&lock->section);
+#else
+    pthread_mutex_destroy(&lock->mutex);
+#endif
+    free(lock);
+}
+
+void AcquireInterpreterLock(InterpreterLock *lock)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(&lock->section);
+#else
+    pthread_mutex_lock(&lock->mutex);
+#endif
+}
+
+void ReleaseInterpreterLock(InterpreterLock *lock)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(&lock->section);
+#else
+    pthread_mutex_unlock(&lock->mutex);
+#endif
+}
+
+static void YieldThread(void)
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+// Compiles fn up to the tier requested, one tier after the other. Native code can't be made for every program, the
+// function stays on bytecode then and nothing asks for native code again.
+static void Promote(SymbolFn *fn)
+{
+    TierState *state = &fn->tier_state;
+    while (state->tier < state->requested)
+    {
+        if (state->tier == TIER_TREE)
+        {
+            state->program    = CompileSymbolFn(fn);
+            state->generation = fn->interpreter->generation;
+            AtomicStore32(&state->tier, TIER_BYTECODE);
+            continue;
+        }
+
+        state->jit = JitCompileProgram(state->program);
+        if (!state->jit)
+            break;
+        AtomicStore32(&state->tier, TIER_NATIVE);
+    }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI PromotionWorker(void *arg)
+#else
+static void *PromotionWorker(void *arg)
+#endif
+{
+    SymbolFn    *fn          = arg;
+    Interpreter *interpreter = fn->interpreter;
+
+    AcquireInterpreterLock(interpreter->lock);
+    Promote(fn);
+    fn->tier_state.running = false;
+    interpreter->workers   = interpreter->workers - 1;
+    ReleaseInterpreterLock(interpreter->lock);
+    return 0;
+}
+
+// Called with the lock held. Workers are detached, WaitForPromotions tells when they are done.
+static void StartWorker(SymbolFn *fn)
+{
+    Interpreter *interpreter = fn->interpreter;
+    fn->tier_state.running   = true;
+    interpreter->workers     = interpreter->workers + 1;
+
+#if defined(_WIN32)
+    HANDLE thread = CreateThread(NULL, 0, PromotionWorker, fn, 0, NULL);
+    if (thread)
+    {
+        CloseHandle(thread);
+        return;
+    }
+#else
+    pthread_t thread;
+    if (!pthread_create(&thread, NULL, PromotionWorker, fn))
+    {
+        pthread_detach(thread);
+        return;
+    }
+#endif
+    // No thread to spare, compile right here
+    Promote(fn);
+    fn->tier_state.running = false;
+    interpreter->workers   = interpreter->workers - 1;
+}
+
+static void RequestTier(SymbolFn *fn, ExecutionTier tier)
+{
+    TierState   *state       = &fn->tier_state;
+    Interpreter *interpreter = fn->interpreter;
+
+    AcquireInterpreterLock(interpreter->lock);
+    if (tier > state->requested)
+    {
+        AtomicStore32(&state->requested, tier);
+        if (!state->running)
+            StartWorker(fn);
+    }
+    ReleaseInterpreterLock(interpreter->lock);
+}
+
+void CountEvaluations(SymbolFn *fn, uint64_t samples)
+{
+    TierState   *state       = &fn->tier_state;
+    Interpreter *interpreter = fn->interpreter;
+    uint64_t     total       = AtomicAdd64(&state->evaluations, samples);
+
+    // Requests only go up, so the tier asked for last is read without the lock
+    ExecutionTier tier = TIER_TREE;
+    while (tier + 1 < TIER_COUNT && total >= interpreter->tier_thresholds[tier + 1])
+        tier = tier + 1;
+    if (tier > AtomicLoad32(&state->requested))
+        RequestTier(fn, tier);
+}
+
+ExecutionTier PublishedTier(SymbolFn *fn)
+{
+    return (ExecutionTier)AtomicLoad32(&fn->tier_state.tier);
+}
+
+// Blocks until fn has reached tier, or as far as it can go
+void EnsureTier(SymbolFn *fn, ExecutionTier tier)
+{
+    RequestTier(fn, tier);
+    WaitForPromotion(fn);
+}
+
+void WaitForPromotion(SymbolFn *fn)
+{
+    Interpreter *interpreter = fn->interpreter;
+    for (;;)
+    {
+        AcquireInterpreterLock(interpreter->lock);
+        bool running = fn->tier_state.running;
+        ReleaseInterpreterLock(interpreter->lock);
+        if (!running)
+            return;
+        YieldThread();
+    }
+}
+
+void WaitForPromotions(Interpreter *interpreter)
+{
+    for (;;)
+    {
+        AcquireInterpreterLock(interpreter->lock);
+        uint32_t workers = interpreter->workers;
+        ReleaseInterpreterLock(interpreter->lock);
+        if (!workers)
+            return;
+        YieldThread();
+    }
+}
+
+// The code of fn changed at generation, through a redefinition of something it calls. Whatever was compiled before is
+// dropped and fn starts over from the tree, keeping its count : a hot function is promoted again by its next report.
+// Contexts still running the old code keep its program alive, and old native code is kept until fn is released.
+void InvalidateTiers(SymbolFn *fn, uint32_t generation)
+{
+    TierState   *state       = &fn->tier_state;
+    Interpreter *interpreter = fn->interpreter;
+
+    AcquireInterpreterLock(interpreter->lock);
+    while (state->running)
+    {
+        ReleaseInterpreterLock(interpreter->lock);
+        YieldThread();
+        AcquireInterpreterLock(interpreter->lock);
+    }
+
+    if (state->program && state->generation < generation)
+    {
+        if (state->jit)
+        {
+            RetiredJit *retired = malloc(sizeof(*retired));
+            Assert(retired != NULL);
+            retired->jit   = state->jit;
+            retired->next  = state->retired;
+            state->retired = retired;
+        }
+        DestroyProgram(state->program);
+        state->program = NULL;
+        state->jit     = NULL;
+        AtomicStore32(&state->tier, TIER_TREE);
+        AtomicStore32(&state->requested, TIER_TREE);
+    }
+    ReleaseInterpreterLock(interpreter->lock);
+}
+
+// The contexts of fn must be gone
+void ReleaseTiers(SymbolFn *fn)
+{
+    WaitForPromotion(fn);
+    DestroyProgram(fn->tier_state.program);
+    JitDestroy(fn->tier_state.jit);
+    for (RetiredJit *retired = fn->tier_state.retired, *next; retired; retired = next)
+    {
+        next = retired->next;
+        JitDestroy(retired->jit);
+        free(retired);
+    }
+    fn->tier_state = (TierState){0};
+}
+
+TierReport GetTierReport(SymbolFn *fn)
+{
+    Assert(fn != NULL);
+    TierReport report  = {0};
+    report.tier        = PublishedTier(fn);
+    report.requested   = (ExecutionTier)AtomicLoad32(&fn->tier_state.requested);
+    report.evaluations = AtomicLoad64(&fn->tier_state.evaluations);
+    return report;
+}
+
+void SetTierThresholds(Interpreter *interpreter, uint64_t bytecode, uint64_t native)
+{
+    Assert(bytecode <= native);
+    interpreter->tier_thresholds[TIER_TREE]     = 0;
+    interpreter->tier_thresholds[TIER_BYTECODE] = bytecode;
+    interpreter->tier_thresholds[TIER_NATIVE]   = native;
+}